@@ -0,0 +1,456 @@
+#include "assets.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+#include "debuggl.h"
+#include "filesystem.h"
+#include "parallel.h"
+
+namespace {
+    template<typename T>
+    size_t vectorBytes(const std::vector<T>& v) {
+        return v.size() * sizeof(T);
+    }
+
+    unsigned uploadBuffer(int target, const void* data, size_t bytes) {
+        unsigned buffer = 0;
+        CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+        CHECK_GL_ERROR(glBindBuffer(target, buffer));
+        CHECK_GL_ERROR(glBufferData(target, bytes, data, GL_STATIC_DRAW));
+        return buffer;
+    }
+
+    // One vertex buffer from per-vertex arrays given as (data, bytes per
+    // vertex), each vertex's attributes back to back.
+    std::vector<char> interleave(size_t count, const std::vector<std::pair<const void*, size_t>>& arrays) {
+        size_t stride = 0;
+        for (const auto& a : arrays)
+            stride += a.second;
+        std::vector<char> out(stride * count);
+        size_t offset = 0;
+        for (const auto& a : arrays) {
+            const char* src = static_cast<const char*>(a.first);
+            for (size_t v = 0; v < count; v++)
+                memcpy(&out[v * stride + offset], src + v * a.second, a.second);
+            offset += a.second;
+        }
+        return out;
+    }
+
+    // What loading an asset costs: a mesh has both a CPU copy and its GPU
+    // upload.
+    size_t assetBytes(const MeshAsset& asset) {
+        return 2 * asset.cpuBytes();
+    }
+
+    size_t assetBytes(const TextureAsset& asset) {
+        return asset.bytes;
+    }
+
+    double elapsedMs(std::chrono::steady_clock::time_point start) {
+        auto d = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+};
+
+MeshAsset::~MeshAsset() {
+    for (const MeshBuffers& b : buffers_) {
+        unsigned ids[] = { b.vertices, b.indices };
+        glDeleteBuffers(2, ids);
+    }
+}
+
+const MeshBuffers& MeshAsset::buffers(size_t i) const {
+    if (buffers_.empty())
+        buffers_.resize(meshes.size());
+    MeshBuffers& b = buffers_[i];
+    if (!b.vertices) {
+        const Mesh& m = meshes[i];
+        size_t count = m.vertices.size();
+        b.has_uvs = m.uvs.size() == count && count;
+        // The element array binding is VAO state, don't disturb the bound one.
+        GLint vao = 0;
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+        glBindVertexArray(0);
+        std::vector<std::pair<const void*, size_t>> arrays;
+        std::vector<char> vertices;
+        if (packed_) {
+            PackedMesh p;
+            packMesh(m, p);
+            b.packed = true;
+            b.position_offset = p.position_offset;
+            b.position_scale = p.position_scale;
+            b.uv_transform = p.uv_transform;
+            arrays.push_back({p.positions.data(), 4 * sizeof(uint16_t)});
+            if (b.has_uvs) {
+                b.uv_offset = 4 * sizeof(uint16_t);
+                arrays.push_back({p.uvs.data(), 2 * sizeof(uint16_t)});
+            }
+            vertices = interleave(count, arrays);
+            if (p.shortIndices()) {
+                b.index_type = GL_UNSIGNED_SHORT;
+                b.indices = uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, p.indices16.data(), vectorBytes(p.indices16));
+                gpu_bytes_ += vectorBytes(p.indices16);
+            } else {
+                b.indices = uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, p.indices32.data(), vectorBytes(p.indices32));
+                gpu_bytes_ += vectorBytes(p.indices32);
+            }
+        } else {
+            arrays.push_back({m.vertices.data(), sizeof(glm::vec4)});
+            b.normal_offset = sizeof(glm::vec4);
+            arrays.push_back({m.normals.data(), sizeof(glm::vec4)});
+            if (b.has_uvs) {
+                b.uv_offset = 2 * sizeof(glm::vec4);
+                arrays.push_back({m.uvs.data(), sizeof(glm::vec2)});
+            }
+            vertices = interleave(count, arrays);
+            b.indices = uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, m.faces.data(), vectorBytes(m.faces));
+            gpu_bytes_ += vectorBytes(m.faces);
+        }
+        b.stride = count ? vertices.size() / count : 0;
+        b.vertices = uploadBuffer(GL_ARRAY_BUFFER, vertices.data(), vertices.size());
+        gpu_bytes_ += vertices.size();
+        glBindVertexArray(vao);
+    }
+    return b;
+}
+
+size_t MeshAsset::cpuBytes() const {
+    size_t bytes = 0;
+    for (const Mesh& m : meshes) {
+        bytes += vectorBytes(m.vertices) + vectorBytes(m.normals) +
+            vectorBytes(m.uvs) + vectorBytes(m.faces);
+    }
+    return bytes;
+}
+
+TextureAsset::~TextureAsset() {
+    glDeleteTextures(1, &id);
+}
+
+AssetRegistry& AssetRegistry::get() {
+    static AssetRegistry registry;
+    return registry;
+}
+
+template<typename T, typename Load>
+std::shared_ptr<T> AssetRegistry::find(Table<T>& table, const std::string& file, Load load) {
+    table.stats.requested++;
+    std::string key = canonical_path(file);
+
+    auto by_path = table.by_path.find(key);
+    if (by_path != table.by_path.end()) {
+        if (std::shared_ptr<T> asset = by_path->second.lock()) {
+            request(table, *asset);
+            return asset;
+        }
+    }
+
+    // Same content under another name?
+    uint64_t hash = 0;
+    bool hashed = hash_file(key, hash);
+    if (hashed) {
+        auto by_hash = table.by_hash.find(hash);
+        if (by_hash != table.by_hash.end()) {
+            if (std::shared_ptr<T> asset = by_hash->second.lock()) {
+                table.by_path[key] = asset;
+                request(table, *asset);
+                return asset;
+            }
+        }
+    }
+
+    std::shared_ptr<T> asset = load(key);
+    table.stats.unique++;
+    table.stats.requested_bytes += assetBytes(*asset);
+    table.stats.loaded_bytes += assetBytes(*asset);
+    table.by_path[key] = asset;
+    if (hashed)
+        table.by_hash[hash] = asset;
+    return asset;
+}
+
+std::shared_ptr<const MeshAsset> AssetRegistry::mesh(const std::string& file) {
+    return find(meshes_, file, [this](const std::string& key) {
+        std::shared_ptr<MeshAsset> asset = std::make_shared<MeshAsset>();
+        asset->packed_ = pack_meshes_;
+        std::vector<Material> materials;
+        loader_.loadObj(key.c_str(), asset->meshes, materials);
+        return asset;
+    });
+}
+
+std::shared_ptr<const TextureAsset> AssetRegistry::texture(const std::string& file) {
+    return find(textures_, file, [this](const std::string& key) {
+        size_t bytes = 0;
+        unsigned id = loader_.loadTexture(key.c_str(), &bytes);
+        return std::make_shared<TextureAsset>(id, bytes);
+    });
+}
+
+template<typename T>
+std::shared_ptr<T> AssetRegistry::insert(Table<T>& table, const Prefetch& p, std::shared_ptr<T> asset) {
+    // Another prefetched name (or a live asset) may have the same content.
+    if (p.hashed) {
+        auto by_hash = table.by_hash.find(p.hash);
+        if (by_hash != table.by_hash.end()) {
+            if (std::shared_ptr<T> shared = by_hash->second.lock()) {
+                table.by_path[p.file] = shared;
+                return shared;
+            }
+        }
+    }
+    if (!asset)
+        return asset;
+    table.stats.unique++;
+    table.stats.loaded_bytes += assetBytes(*asset);
+    table.by_path[p.file] = asset;
+    if (p.hashed)
+        table.by_hash[p.hash] = asset;
+    return asset;
+}
+
+template<typename T>
+void AssetRegistry::request(Table<T>& table, const T& asset) {
+    if (asset.resident())
+        table.stats.requested_bytes += assetBytes(asset);
+    else
+        table.stats.pending_requests[&asset]++;
+}
+
+template<typename T>
+void AssetRegistry::makeResident(Table<T>& table, T& asset) {
+    asset.resident_ = true;
+    size_t bytes = assetBytes(asset);
+    auto pending = table.stats.pending_requests.find(&asset);
+    if (pending != table.stats.pending_requests.end()) {
+        table.stats.requested_bytes += pending->second * bytes;
+        table.stats.pending_requests.erase(pending);
+    }
+    table.stats.loaded_bytes += bytes;
+}
+
+std::vector<AssetRegistry::Prefetch> AssetRegistry::collect(
+        const std::vector<std::string>& meshes,
+        const std::vector<std::string>& textures) {
+    // One job per unique file that isn't loaded already.
+    std::vector<Prefetch> jobs;
+    std::set<std::string> seen;
+    auto add = [&](const std::string& file, bool is_mesh) {
+        std::string key = canonical_path(file);
+        if (!seen.insert(key).second)
+            return;
+        if (is_mesh ? !meshes_.by_path[key].expired() : !textures_.by_path[key].expired())
+            return;
+        Prefetch p;
+        p.file = key;
+        p.is_mesh = is_mesh;
+        jobs.push_back(p);
+    };
+    for (const std::string& file : meshes)
+        add(file, true);
+    for (const std::string& file : textures)
+        add(file, false);
+    return jobs;
+}
+
+double AssetRegistry::parse(std::vector<Prefetch>& jobs, int threads) {
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(int(jobs.size()), threads, [&jobs, start](int i) {
+        Prefetch& p = jobs[i];
+        p.thread = std::this_thread::get_id();
+        p.start_ms = elapsedMs(start);
+        auto job = std::chrono::steady_clock::now();
+        p.hashed = hash_file(p.file, p.hash);
+        if (p.is_mesh) {
+            if (!p.mesh)
+                p.mesh = std::make_shared<MeshAsset>();
+            std::vector<Material> materials;
+            Loader loader;
+            loader.loadObj(p.file.c_str(), p.mesh->meshes, materials);
+        } else {
+            p.cooked = readTexture(p.file, p.texels);
+            if (!p.cooked) {
+                p.pixels = loadImg(p.file, p.width, p.height, p.channels);
+                if (!p.pixels)
+                    printf("Texture failed to load at path: %s\n", p.file.c_str());
+                // Cook it for next time, and upload the compressed levels.
+                if (compressTexture(p.pixels, p.width, p.height, p.channels, p.texels)) {
+                    writeCookedTexture(p.file, p.texels);
+                    p.cooked = true;
+                    freeImg(p.pixels);
+                    p.pixels = nullptr;
+                }
+            }
+        }
+        p.load_ms = elapsedMs(job);
+    });
+    return elapsedMs(start);
+}
+
+void AssetRegistry::prefetch(const std::vector<std::string>& meshes,
+                             const std::vector<std::string>& textures,
+                             int threads) {
+    releasePrefetched();
+    prefetched_ = collect(meshes, textures);
+    prefetch_threads_ = threads > 0 ? threads : hardware_threads();
+    prefetch_ms_ = parse(prefetched_, prefetch_threads_);
+    upload_ms_ = 0.0;
+}
+
+void AssetRegistry::upload() {
+    auto start = std::chrono::steady_clock::now();
+    for (Prefetch& p : prefetched_) {
+        auto job = std::chrono::steady_clock::now();
+        if (p.is_mesh) {
+            std::shared_ptr<MeshAsset> mesh = insert(meshes_, p, p.mesh);
+            if (mesh == p.mesh) {
+                mesh->packed_ = pack_meshes_;
+                for (size_t i = 0; i < mesh->meshes.size(); i++)
+                    mesh->buffers(i);
+            }
+            p.mesh = mesh;
+        } else if (!p.texture) {
+            std::shared_ptr<TextureAsset> texture = insert(textures_, p, std::shared_ptr<TextureAsset>());
+            if (!texture) {
+                size_t bytes = 0;
+                unsigned id = p.cooked ? loader_.createTexture(p.texels, &bytes)
+                    : loader_.createTexture(p.pixels, p.width, p.height, p.channels, &bytes);
+                texture = insert(textures_, p, std::make_shared<TextureAsset>(id, bytes));
+            }
+            p.texture = texture;
+            freeImg(p.pixels);
+            p.pixels = nullptr;
+            p.texels = CookedTexture();
+        }
+        p.upload_ms = elapsedMs(job);
+    }
+    upload_ms_ = elapsedMs(start);
+}
+
+void AssetRegistry::loadAsync(const std::vector<std::string>& meshes,
+                              const std::vector<std::string>& textures,
+                              UploadThread& uploader) {
+    releasePrefetched();
+    prefetched_.clear();
+    prefetch_threads_ = hardware_threads();
+    prefetch_ms_ = upload_ms_ = 0.0;
+
+    // Register not yet resident assets now, so every request in the
+    // meantime shares them. Content hashes aren't known yet, copies under
+    // other names are loaded separately.
+    auto jobs = std::make_shared<std::vector<Prefetch>>(collect(meshes, textures));
+    for (Prefetch& p : *jobs) {
+        if (p.is_mesh) {
+            p.mesh = std::make_shared<MeshAsset>();
+            p.mesh->resident_ = false;
+            p.mesh->packed_ = pack_meshes_;
+            meshes_.by_path[p.file] = p.mesh;
+            meshes_.stats.unique++;
+        } else {
+            p.texture = std::make_shared<TextureAsset>(0, 0);
+            p.texture->resident_ = false;
+            textures_.by_path[p.file] = p.texture;
+            textures_.stats.unique++;
+        }
+    }
+
+    // The loader thread parses everything on the pool, then uploads and
+    // fences each asset on its own so the first ones show up early.
+    auto parse_ms = std::make_shared<double>(0.0);
+    int threads = prefetch_threads_;
+    uploader.push([jobs, parse_ms, threads]() {
+        *parse_ms = parse(*jobs, threads);
+    }, [this, parse_ms]() {
+        prefetch_ms_ = *parse_ms;
+    });
+    for (size_t i = 0; i < jobs->size(); i++) {
+        uploader.push([jobs, i]() {
+            Prefetch& p = (*jobs)[i];
+            auto job = std::chrono::steady_clock::now();
+            if (p.is_mesh) {
+                for (size_t m = 0; m < p.mesh->meshes.size(); m++)
+                    p.mesh->buffers(m);
+            } else {
+                Loader loader;
+                p.texture->id = p.cooked ? loader.createTexture(p.texels, &p.texture->bytes, true)
+                    : loader.createTexture(p.pixels, p.width, p.height, p.channels, &p.texture->bytes, true);
+                p.texels = CookedTexture();
+                freeImg(p.pixels);
+                p.pixels = nullptr;
+            }
+            p.upload_ms = elapsedMs(job);
+        }, [this, jobs, i]() {
+            Prefetch& p = (*jobs)[i];
+            if (p.is_mesh)
+                makeResident(meshes_, *p.mesh);
+            else
+                makeResident(textures_, *p.texture);
+            if (p.hashed) {
+                if (p.is_mesh)
+                    meshes_.by_hash.insert(std::make_pair(p.hash, std::weak_ptr<MeshAsset>(p.mesh)));
+                else
+                    textures_.by_hash.insert(std::make_pair(p.hash, std::weak_ptr<TextureAsset>(p.texture)));
+            }
+            upload_ms_ += p.upload_ms;
+            // Only the timeline is kept, the users hold the asset.
+            prefetched_.push_back(p);
+            prefetched_.back().mesh.reset();
+            prefetched_.back().texture.reset();
+            p.mesh.reset();
+            p.texture.reset();
+        });
+    }
+}
+
+void AssetRegistry::releasePrefetched() {
+    // Keep the entries themselves for printTimeline().
+    for (Prefetch& p : prefetched_) {
+        freeImg(p.pixels);
+        p.pixels = nullptr;
+        p.texels = CookedTexture();
+        p.mesh.reset();
+        p.texture.reset();
+    }
+}
+
+void AssetRegistry::printTimeline() const {
+    if (prefetched_.empty())
+        return;
+    printf("Asset timeline (%d threads):\n", prefetch_threads_);
+    printf("  %-6s %-7s %10s %10s %10s  %s\n", "thread", "kind", "start ms", "load ms", "upload ms", "file");
+    std::vector<std::thread::id> threads;
+    double load_total = 0.0;
+    for (const Prefetch& p : prefetched_) {
+        size_t t = std::find(threads.begin(), threads.end(), p.thread) - threads.begin();
+        if (t == threads.size())
+            threads.push_back(p.thread);
+        printf("  %-6lu %-7s %10.2f %10.2f %10.2f  %s\n", (unsigned long)t,
+            p.is_mesh ? "mesh" : "texture", p.start_ms, p.load_ms, p.upload_ms, p.file.c_str());
+        load_total += p.load_ms;
+    }
+    printf("Load: %.2f ms wall (%.2f ms of work), upload: %.2f ms\n",
+        prefetch_ms_, load_total, upload_ms_);
+}
+
+void AssetRegistry::printStats() const {
+    size_t requested = meshes_.stats.requested_bytes + textures_.stats.requested_bytes;
+    size_t loaded = meshes_.stats.loaded_bytes + textures_.stats.loaded_bytes;
+    printf("Assets: meshes %lu requested / %lu unique, textures %lu requested / %lu unique, %.2f MB saved\n",
+        (unsigned long)meshes_.stats.requested, (unsigned long)meshes_.stats.unique,
+        (unsigned long)textures_.stats.requested, (unsigned long)textures_.stats.unique,
+        (requested > loaded ? requested - loaded : 0) / (1024.0 * 1024.0));
+    std::set<const MeshAsset*> live;
+    size_t mesh_bytes = 0;
+    for (const auto& entry : meshes_.by_path) {
+        std::shared_ptr<MeshAsset> mesh = entry.second.lock();
+        if (mesh && live.insert(mesh.get()).second)
+            mesh_bytes += mesh->gpuBytes();
+    }
+    printf("Mesh memory: %.2f MB%s, texture memory: %.2f MB\n", mesh_bytes / (1024.0 * 1024.0),
+        pack_meshes_ ? " (packed)" : "", textures_.stats.loaded_bytes / (1024.0 * 1024.0));
+}
@@ -0,0 +1,198 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "loader.h"
+#include "mesh.h"
+#include "packed_mesh.h"
+#include "upload_thread.h"
+
+/*
+ * MeshAsset: the meshes of one OBJ file, shared by every Object that
+ * loads it. The GPU copy is created on the first buffers() call and
+ * released with the last handle.
+ */
+struct MeshBuffers {
+    // One interleaved vertex buffer, offsets and stride in bytes. The
+    // position is first: four floats, or in the PackedMesh format four
+    // uint16 with the normal in the last. Then the normal (floats only)
+    // and, if the mesh has any, the uv.
+    unsigned vertices = 0;
+    size_t stride = 0;
+    size_t normal_offset = 0;
+    size_t uv_offset = 0;
+    bool has_uvs = false;
+    unsigned indices = 0;
+    unsigned index_type = GL_UNSIGNED_INT;
+    // In the PackedMesh format these decode positions and uvs.
+    bool packed = false;
+    glm::vec3 position_offset = glm::vec3(0.0f);
+    glm::vec3 position_scale = glm::vec3(1.0f);
+    glm::vec4 uv_transform = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+};
+
+class MeshAsset {
+public:
+    MeshAsset() {}
+    ~MeshAsset();
+    MeshAsset(const MeshAsset&) = delete;
+    MeshAsset& operator=(const MeshAsset&) = delete;
+
+    std::vector<Mesh> meshes;
+
+    // GPU buffers of meshes[i], uploaded on first use.
+    const MeshBuffers& buffers(size_t i) const;
+    size_t cpuBytes() const;
+    size_t gpuBytes() const { return gpu_bytes_; }
+    // False while a loadAsync() upload is still in flight; meshes and
+    // buffers must not be touched until then.
+    bool resident() const { return resident_; }
+
+private:
+    friend class AssetRegistry;
+    bool resident_ = true;
+    // Upload in the PackedMesh format, see AssetRegistry::packMeshes().
+    bool packed_ = false;
+    mutable std::vector<MeshBuffers> buffers_;
+    mutable size_t gpu_bytes_ = 0;
+};
+
+// TextureAsset: one decoded, uploaded GL texture.
+class TextureAsset {
+public:
+    TextureAsset(unsigned id, size_t bytes) : id(id), bytes(bytes) {}
+    ~TextureAsset();
+    TextureAsset(const TextureAsset&) = delete;
+    TextureAsset& operator=(const TextureAsset&) = delete;
+
+    // Only set by the registry, handles are const.
+    unsigned id;
+    size_t bytes;
+    // See MeshAsset::resident().
+    bool resident() const { return resident_; }
+
+private:
+    friend class AssetRegistry;
+    bool resident_ = true;
+};
+
+/*
+ * AssetRegistry: hands out shared handles to meshes and textures so each
+ * unique file is decoded and uploaded once.
+ *
+ * Assets are looked up by canonical path first and then by content hash,
+ * so copies of the same file under different names are shared as well.
+ * The registry only keeps weak references: an asset is freed when the
+ * last handle goes away and would be loaded again on the next request.
+ */
+class AssetRegistry {
+public:
+    static AssetRegistry& get();
+
+    std::shared_ptr<const MeshAsset> mesh(const std::string& file);
+    std::shared_ptr<const TextureAsset> texture(const std::string& file);
+
+    /*
+     * Two-phase loading, for many assets at once:
+     *      prefetch: parse meshes and decode images on threads workers
+     *                (<= 0: one per core), no GL calls
+     *      upload: create every GL buffer and texture on this (the GL)
+     *              thread; mesh() and texture() then return them
+     *      releasePrefetched: drop the registry's own references once
+     *              the users hold theirs, unused assets are freed
+     */
+    void prefetch(const std::vector<std::string>& meshes,
+                  const std::vector<std::string>& textures,
+                  int threads = 0);
+    void upload();
+    void releasePrefetched();
+
+    /*
+     * loadAsync: the same without blocking. The assets are registered at
+     * once but not resident(); uploader parses and decodes them on a
+     * worker pool, uploads them in its own context and makes each one
+     * resident from its poll() once its fence has signaled.
+     */
+    void loadAsync(const std::vector<std::string>& meshes,
+                   const std::vector<std::string>& textures,
+                   UploadThread& uploader);
+
+    // Meshes loaded from now on are uploaded in the 12 byte per vertex
+    // PackedMesh format (the default) or as the float vectors of Mesh.
+    void packMeshes(bool packed) { pack_meshes_ = packed; }
+
+    // Requested vs unique loads and the bytes sharing avoided.
+    void printStats() const;
+    // Per asset parse/decode and upload times of the last prefetch.
+    void printTimeline() const;
+
+private:
+    AssetRegistry() {}
+
+    struct Stats {
+        size_t requested = 0;
+        size_t unique = 0;
+        size_t requested_bytes = 0; // what every request would have cost alone
+        size_t loaded_bytes = 0;
+        // Requests for assets that aren't resident yet, their size is
+        // only known once loaded.
+        std::map<const void*, size_t> pending_requests;
+    };
+
+    // One unique file of a prefetch.
+    struct Prefetch {
+        std::string file;
+        bool is_mesh = true;
+        uint64_t hash = 0;
+        bool hashed = false;
+        std::shared_ptr<MeshAsset> mesh;
+        unsigned char* pixels = nullptr;
+        int width = 0, height = 0, channels = 0;
+        // Block-compressed levels instead of pixels.
+        bool cooked = false;
+        CookedTexture texels;
+        std::shared_ptr<TextureAsset> texture;
+        std::thread::id thread;
+        double start_ms = 0.0, load_ms = 0.0, upload_ms = 0.0;
+    };
+
+    template<typename T>
+    struct Table {
+        std::map<std::string, std::weak_ptr<T>> by_path;
+        std::map<uint64_t, std::weak_ptr<T>> by_hash;
+        Stats stats;
+    };
+
+    template<typename T, typename Load>
+    std::shared_ptr<T> find(Table<T>& table, const std::string& file, Load load);
+
+    template<typename T>
+    std::shared_ptr<T> insert(Table<T>& table, const Prefetch& p, std::shared_ptr<T> asset);
+    template<typename T>
+    void request(Table<T>& table, const T& asset);
+    template<typename T>
+    void makeResident(Table<T>& table, T& asset);
+
+    std::vector<Prefetch> collect(const std::vector<std::string>& meshes,
+                                  const std::vector<std::string>& textures);
+    // CPU half of loading jobs on threads workers, returns the wall time.
+    static double parse(std::vector<Prefetch>& jobs, int threads);
+
+    Loader loader_;
+    Table<MeshAsset> meshes_;
+    Table<TextureAsset> textures_;
+    std::vector<Prefetch> prefetched_;
+    int prefetch_threads_ = 0;
+    bool pack_meshes_ = true;
+    double prefetch_ms_ = 0.0, upload_ms_ = 0.0;
+};
+
+#endif
@@ -0,0 +1,1057 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "debuggl.h"
+#include "filesystem.h"
+#include "light_clusters.h"
+#include "loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "menger.h"
+#include "menger_renderer.h"
+#include "obj_parser.h"
+#include "packed_mesh.h"
+#include "parallel.h"
+#include "shader_permutation.h"
+#include "texture_cache.h"
+
+namespace {
+
+const char* menger_vertex_shader =
+#include "shaders/default.vert"
+;
+
+const char* menger_fragment_shader =
+#include "shaders/default.frag"
+;
+
+const char* menger_instanced_vertex_shader =
+#include "shaders/menger_instanced.vert"
+;
+
+const char* menger_sdf_vertex_shader =
+#include "shaders/menger_sdf.vert"
+;
+
+const char* menger_sdf_fragment_shader =
+#include "shaders/menger_sdf.frag"
+;
+
+const char* object_vertex_shader =
+#include "shaders/object.vert"
+;
+
+const char* object_fragment_shader =
+#include "shaders/object.frag"
+;
+
+const int kBenchWidth = 1080;
+const int kBenchHeight = 720;
+
+double
+elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	auto d = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Best of a few runs, the first one also pays for page faults. bytes gets
+// the size of the generated CPU-side data, i.e. what has to be uploaded.
+double
+time_menger(Menger::Mode mode, int level, int threads, size_t* bytes)
+{
+	Menger menger;
+	menger.set_mode(mode);
+	menger.set_nesting_level(level);
+	menger.set_threads(threads);
+	std::vector<glm::vec4> vertices, normals, instances;
+	std::vector<glm::uvec3> faces;
+	glm::vec4 position(0.0f, 0.0f, 0.0f, 1.0f);
+	if (mode == Menger::kInstanced)
+		menger.generate_geometry(vertices, normals, faces, position);
+	double best = 0.0;
+	int runs = level >= 4 ? 2 : 5;
+	for (int i = 0; i < runs; i++) {
+		auto start = std::chrono::steady_clock::now();
+		// Instanced regeneration only rebuilds the offsets.
+		if (mode == Menger::kInstanced)
+			menger.generate_instances(instances, position);
+		else
+			menger.generate_geometry(vertices, normals, faces, position);
+		double ms = elapsed_ms(start);
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+	*bytes = (vertices.size() + normals.size() + instances.size()) * sizeof(glm::vec4) +
+		faces.size() * sizeof(glm::uvec3);
+	return best;
+}
+
+const char*
+mode_name(Menger::Mode mode)
+{
+	switch (mode) {
+	case Menger::kCubes: return "cubes";
+	case Menger::kCulled: return "culled";
+	case Menger::kInstanced: return "instanced";
+	case Menger::kRaymarched: return "raymarched";
+	}
+	return "?";
+}
+
+// Best time of the per-frame kInstanced cull, from the menger_gpu camera
+// with a bokeh margin like main's. count gets the cubes it keeps.
+double
+time_menger_cull(int level, size_t* count)
+{
+	Menger menger;
+	menger.set_mode(Menger::kInstanced);
+	menger.set_nesting_level(level);
+	glm::vec3 eye(1.1f, 0.8f, 1.4f);
+	MengerView view;
+	view.view_projection = glm::perspective(glm::radians(45.0f),
+			float(kBenchWidth) / kBenchHeight, 0.01f, 100.0f) *
+		glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	view.eye = eye;
+	view.pixel_scale = kBenchHeight / (2.0f * tanf(glm::radians(45.0f) * 0.5f));
+	view.margin = 0.05f;
+	view.focus = glm::length(eye);
+	std::vector<glm::vec4> offsets;
+	glm::vec4 position(0.0f, 0.0f, 0.0f, 1.0f);
+	double best = 0.0;
+	for (int i = 0; i < 5; i++) {
+		auto start = std::chrono::steady_clock::now();
+		menger.generate_visible_instances(offsets, position, view);
+		double ms = elapsed_ms(start);
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+	*count = offsets.size();
+	return best;
+}
+
+int
+bench_menger()
+{
+	int threads = hardware_threads();
+	printf("Menger generation, best time in ms (1 thread vs %d threads)\n", threads);
+	printf("%-10s %-6s %12s %12s %8s %10s\n", "mode", "level", "1 thread", "N threads", "speedup", "MB");
+	const Menger::Mode modes[] = { Menger::kCubes, Menger::kCulled, Menger::kInstanced };
+	for (Menger::Mode mode : modes) {
+		for (int level = 1; level <= 5; level++) {
+			// Level 5 as a cube soup is ~115M vertices, several GB.
+			if (mode == Menger::kCubes && level == 5) {
+				printf("%-10s %-6d %12s %12s %8s %10s\n", "cubes", level, "skipped", "-", "-", "-");
+				continue;
+			}
+			size_t bytes = 0;
+			double single = time_menger(mode, level, 1, &bytes);
+			double multi = time_menger(mode, level, threads, &bytes);
+			printf("%-10s %-6d %12.2f %12.2f %7.2fx %10.2f\n",
+				mode_name(mode), level, single, multi, single / multi,
+				bytes / (1024.0 * 1024.0));
+		}
+	}
+
+	// kInstanced re-culls on the render thread whenever the camera moves.
+	printf("\nkInstanced view culling, best time in ms (render thread)\n");
+	printf("%-6s %12s %12s\n", "level", "ms", "cubes");
+	for (int level = 1; level <= 5; level++) {
+		size_t count = 0;
+		double ms = time_menger_cull(level, &count);
+		printf("%-6d %12.3f %12zu\n", level, ms, count);
+	}
+	return 0;
+}
+
+// A hidden window with the same 3.3 core context the app asks for, plus an
+// offscreen framebuffer to draw into. Returns nullptr if there is no GL.
+GLFWwindow*
+open_gl_context()
+{
+	if (!glfwInit())
+		return nullptr;
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow* window = glfwCreateWindow(kBenchWidth, kBenchHeight, "bench", nullptr, nullptr);
+	if (!window) {
+		glfwTerminate();
+		return nullptr;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK) {
+		glfwTerminate();
+		return nullptr;
+	}
+	glGetError();  // clear GLEW's error for it
+
+	GLuint fbo, color, depth;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kBenchWidth, kBenchHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, kBenchWidth, kBenchHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	glViewport(0, 0, kBenchWidth, kBenchHeight);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	printf("Renderer: %s\n", glGetString(GL_RENDERER));
+	return window;
+}
+
+// Average GPU time of one sponge draw, measured with GL_TIME_ELAPSED.
+double
+time_menger_gpu(Menger::Mode mode, int level)
+{
+	const int kWarmup = 5;
+	const int kFrames = 30;
+
+	Menger menger;
+	menger.set_mode(mode);
+	menger.set_nesting_level(level);
+
+	// Sponge at the origin, filling most of the frame.
+	glm::mat4 view = glm::lookAt(glm::vec3(1.1f, 0.8f, 1.4f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f),
+			float(kBenchWidth) / kBenchHeight, 0.01f, 100.0f);
+	glm::vec4 light_position(5.0f, 5.0f, 5.0f, 1.0f);
+	glm::vec4 eye_position = glm::inverse(view)[3];
+	auto matrix_binder = [](int loc, const void* data) {
+		glUniformMatrix4fv(loc, 1, GL_FALSE, (const GLfloat*)data);
+	};
+	auto vector_binder = [](int loc, const void* data) {
+		glUniform4fv(loc, 1, (const GLfloat*)data);
+	};
+	std::vector<ShaderUniform> uniforms = {
+		{ "view", matrix_binder, [&view]() -> const void* { return &view[0][0]; } },
+		{ "projection", matrix_binder, [&projection]() -> const void* { return &projection[0][0]; } },
+		{ "light_position", vector_binder, [&light_position]() -> const void* { return &light_position[0]; } },
+		{ "view_position", vector_binder, [&eye_position]() -> const void* { return &eye_position[0]; } },
+	};
+	std::vector<DirectionalLight> directionalLights;
+	std::vector<PointLight> pointLights;
+	std::vector<SpotLight> spotLights;
+
+	const char* vs = menger_vertex_shader;
+	const char* fs = menger_fragment_shader;
+	if (mode == Menger::kInstanced)
+		vs = menger_instanced_vertex_shader;
+	if (mode == Menger::kRaymarched) {
+		vs = menger_sdf_vertex_shader;
+		fs = menger_sdf_fragment_shader;
+	}
+	MengerRenderer renderer(&menger, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	LightBuffer::get().setLights(directionalLights, pointLights, spotLights);
+	renderer.setup(vs, fs, uniforms,
+			glm::vec4(5.0f, 1.5f, 1.5f, 1.0f));
+
+	GLuint query;
+	glGenQueries(1, &query);
+	double total = 0.0;
+	for (int i = 0; i < kWarmup + kFrames; i++) {
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		renderer.render();
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		if (i >= kWarmup)
+			total += ns * 1e-6;
+	}
+	glDeleteQueries(1, &query);
+	return total / kFrames;
+}
+
+int
+bench_menger_gpu()
+{
+	GLFWwindow* window = open_gl_context();
+	if (!window) {
+		fprintf(stderr, "menger_gpu: could not create an OpenGL 3.3 context\n");
+		return 1;
+	}
+	printf("Menger GPU time per draw in ms at %dx%d\n", kBenchWidth, kBenchHeight);
+	printf("%-6s %12s %12s %12s\n", "level", "culled", "instanced", "raymarched");
+	for (int level = 1; level <= 10; level++) {
+		// Meshes past level 4 are too big to be worth drawing.
+		if (level <= 4) {
+			double culled = time_menger_gpu(Menger::kCulled, level);
+			double instanced = time_menger_gpu(Menger::kInstanced, level);
+			double raymarched = time_menger_gpu(Menger::kRaymarched, level);
+			printf("%-6d %12.3f %12.3f %12.3f\n", level, culled, instanced, raymarched);
+		} else {
+			double raymarched = time_menger_gpu(Menger::kRaymarched, level);
+			printf("%-6d %12s %12s %12.3f\n", level, "-", "-", raymarched);
+		}
+	}
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
+
+// The meshes main.cc loads, with repeats, in load order.
+const char* const kSceneMeshes[] = {
+	"/src/assets/primitives/cone.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere2.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/cylinder.obj",
+	"/src/assets/primitives/torus.obj",
+	"/src/assets/primitives/monkey.obj",
+	"/src/assets/animals/cat/cat.obj",
+	"/src/assets/animals/dog/dog.obj",
+	"/src/assets/animals/deer.obj",
+	"/src/assets/buildings/flatiron/13943_Flatiron_Building_v1_l1.obj",
+	"/src/assets/primitives/cube.obj",
+	"/src/assets/primitives/cube.obj",
+	"/src/assets/primitives/cube.obj",
+	"/src/assets/primitives/cube.obj",
+	"/src/assets/primitives/cube.obj",
+};
+
+// Milliseconds to load every scene mesh once: 0 parses with Assimp,
+// 1 with parseObj, 2 reads the cache, 3 maps the cache.
+double
+time_scene_load(int how)
+{
+	Loader loader;
+	auto start = std::chrono::steady_clock::now();
+	for (const char* mesh : kSceneMeshes) {
+		std::string file = path(mesh);
+		std::vector<Mesh> meshes;
+		std::vector<Material> materials;
+		bool ok = how == 0 ? loader.importObj(file.c_str(), meshes, materials)
+		        : how == 1 ? parseObj(file.c_str(), meshes)
+		                   : readMeshCache(file, meshes, kMeshCacheAny, how == 3);
+		if (!ok)
+			fprintf(stderr, "loader: could not load %s\n", file.c_str());
+	}
+	return elapsed_ms(start);
+}
+
+int
+bench_loader()
+{
+	// Make sure every cache exists and is current first.
+	Loader loader;
+	for (const char* mesh : kSceneMeshes) {
+		std::vector<Mesh> meshes;
+		std::vector<Material> materials;
+		loader.loadObj(path(mesh).c_str(), meshes, materials);
+	}
+
+	const char* names[] = { "cold parse (Assimp)", "cold parse (native)", "warm cache (read)", "warm cache (mmap)" };
+	printf("Scene mesh loading, %d loads, best of 3 in ms\n", int(sizeof(kSceneMeshes) / sizeof(kSceneMeshes[0])));
+	for (int how = 0; how < 4; how++) {
+		double best = 0.0;
+		for (int i = 0; i < 3; i++) {
+			double ms = time_scene_load(how);
+			if (i == 0 || ms < best)
+				best = ms;
+		}
+		printf("%-22s %10.2f\n", names[how], best);
+	}
+	return 0;
+}
+
+// The textures main.cc uses, plus the cat's unused TGAs.
+const char* const kSceneTextures[] = {
+	"/src/assets/textures/grass.png",
+	"/src/assets/textures/wall_s.jpg",
+	"/src/assets/textures/gold.jpg",
+	"/src/assets/textures/wood2.png",
+	"/src/assets/textures/wood_s.jpg",
+	"/src/assets/textures/wood.jpg",
+	"/src/assets/textures/metal2.jpg",
+	"/src/assets/textures/metal2_s.jpg",
+	"/src/assets/textures/black.jpg",
+	"/src/assets/textures/wood3.png",
+	"/src/assets/animals/dog/Dog_diffuse.jpg",
+	"/src/assets/textures/metal.jpg",
+	"/src/assets/textures/metal_s.jpg",
+	"/src/assets/textures/concrete.png",
+	"/src/assets/textures/wall.png",
+	"/src/assets/animals/cat/cat_diff.tga",
+	"/src/assets/animals/cat/cat_norm.tga",
+	"/src/assets/animals/cat/cat_spec.tga",
+};
+
+// Best of 3 of f(), in ms.
+template <typename F>
+double
+best_of_3(F f)
+{
+	double best = 0.0;
+	for (int i = 0; i < 3; i++) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		double ms = elapsed_ms(start);
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+int
+bench_textures()
+{
+	// Upload times need GL, the rest doesn't.
+	GLFWwindow* window = open_gl_context();
+	Loader loader;
+	printf("Scene textures, best of 3 in ms, VRAM in MB\n");
+	printf("%-22s %8s %8s %8s %8s %9s %9s\n", "texture", "decode", "read",
+	       "upload", "upload", "raw MB", "cooked MB");
+	printf("%-22s %8s %8s %8s %8s\n", "", "(stb)", "(dds)", "(raw)", "(dds)");
+	double total[4] = { 0, 0, 0, 0 };
+	size_t raw_bytes = 0, cooked_bytes = 0;
+	for (const char* texture : kSceneTextures) {
+		std::string file = path(texture);
+		int width, height, channels;
+		unsigned char* pixels = nullptr;
+		double decode = best_of_3([&]() {
+			freeImg(pixels);
+			pixels = loadImg(file, width, height, channels);
+		});
+		CookedTexture cooked;
+		if (!pixels || (!readTexture(file, cooked) &&
+		    !(compressTexture(pixels, width, height, channels, cooked) &&
+		      writeCookedTexture(file, cooked)))) {
+			fprintf(stderr, "textures: could not load %s\n", file.c_str());
+			freeImg(pixels);
+			continue;
+		}
+		double read = best_of_3([&]() { readTexture(file, cooked); });
+
+		double upload[2] = { 0, 0 };
+		size_t bytes[2] = { size_t(width) * height * channels * 4 / 3, cooked.bytes() };
+		if (window) {
+			for (int how = 0; how < 2; how++) {
+				upload[how] = best_of_3([&]() {
+					GLuint id = how == 0
+						? loader.createTexture(pixels, width, height, channels, &bytes[0])
+						: loader.createTexture(cooked, &bytes[1]);
+					glFinish();
+					glDeleteTextures(1, &id);
+				});
+			}
+		}
+		freeImg(pixels);
+
+		std::string name = file.substr(file.find_last_of("/\\") + 1);
+		printf("%-22s %8.2f %8.2f %8.2f %8.2f %9.2f %9.2f\n", name.c_str(),
+		       decode, read, upload[0], upload[1],
+		       bytes[0] / (1024.0 * 1024.0), bytes[1] / (1024.0 * 1024.0));
+		total[0] += decode;
+		total[1] += read;
+		total[2] += upload[0];
+		total[3] += upload[1];
+		raw_bytes += bytes[0];
+		cooked_bytes += bytes[1];
+	}
+	printf("%-22s %8.2f %8.2f %8.2f %8.2f %9.2f %9.2f\n", "total",
+	       total[0], total[1], total[2], total[3],
+	       raw_bytes / (1024.0 * 1024.0), cooked_bytes / (1024.0 * 1024.0));
+	if (!window)
+		printf("(no GL context, uploads not measured)\n");
+	else
+		glfwTerminate();
+	return 0;
+}
+
+// The big OBJs, for bench_obj.
+const char* const kObjFiles[] = {
+	"/src/assets/buildings/flatiron/13943_Flatiron_Building_v1_l1.obj",
+	"/src/assets/animals/dog/dog.obj",
+	"/src/assets/animals/cat/cat.obj",
+	"/src/assets/animals/deer.obj",
+	"/src/assets/objects/truck/PickUp.obj",
+};
+
+inline float
+relative_error(float a, float b)
+{
+	return std::fabs(a - b) / std::max(1.0f, std::max(std::fabs(a), std::fabs(b)));
+}
+
+/*
+ * Compare the triangles of two imports of the same file corner by corner:
+ * position, normal and uv through the face indices, so a different vertex
+ * order doesn't matter. Returns the number of triangles that differ by
+ * more than float parsing noise, or are missing from either side.
+ */
+size_t
+compare_meshes(const std::vector<Mesh>& a, const std::vector<Mesh>& b, float& worst)
+{
+	const float tolerance = 1e-5f;
+	worst = 0.0f;
+	size_t bad = 0;
+	for (size_t i = 0; i < std::max(a.size(), b.size()); i++) {
+		if (i >= a.size() || i >= b.size()) {
+			bad += i < a.size() ? a[i].faces.size() : b[i].faces.size();
+			continue;
+		}
+		const Mesh& ma = a[i];
+		const Mesh& mb = b[i];
+		size_t count = std::min(ma.faces.size(), mb.faces.size());
+		bad += std::max(ma.faces.size(), mb.faces.size()) - count;
+		bool uvs = !ma.uvs.empty() && !mb.uvs.empty();
+		bad += (ma.uvs.empty() != mb.uvs.empty()) ? count : 0;
+		for (size_t f = 0; f < count; f++) {
+			float error = 0.0f;
+			for (int j = 0; j < 3; j++) {
+				unsigned ia = ma.faces[f][j], ib = mb.faces[f][j];
+				for (int k = 0; k < 3; k++) {
+					error = std::max(error, relative_error(ma.vertices[ia][k], mb.vertices[ib][k]));
+					error = std::max(error, relative_error(ma.normals[ia][k], mb.normals[ib][k]));
+				}
+				for (int k = 0; uvs && k < 2; k++)
+					error = std::max(error, relative_error(ma.uvs[ia][k], mb.uvs[ib][k]));
+			}
+			worst = std::max(worst, error);
+			bad += error > tolerance;
+		}
+	}
+	return bad;
+}
+
+int
+bench_obj()
+{
+	int threads = hardware_threads();
+	Loader loader;
+	printf("OBJ parsing, best of 3 in ms, native on 1 and %d threads\n", threads);
+	printf("%-40s %7s %9s %9s %9s %9s  %s\n", "file", "MB", "Assimp", "native/1",
+	       "native/N", "triangles", "check");
+	double total[3] = { 0, 0, 0 };
+	int failed = 0;
+	for (const char* obj : kObjFiles) {
+		std::string file = path(obj);
+		std::vector<Mesh> assimp, native;
+		std::vector<Material> materials;
+		double ms[3];
+		ms[0] = best_of_3([&]() {
+			assimp.clear();
+			loader.importObj(file.c_str(), assimp, materials);
+		});
+		ms[1] = best_of_3([&]() {
+			native.clear();
+			parseObj(file.c_str(), native, 1);
+		});
+		ms[2] = best_of_3([&]() {
+			native.clear();
+			parseObj(file.c_str(), native, threads);
+		});
+
+		float worst;
+		size_t bad = compare_meshes(assimp, native, worst);
+		size_t triangles = 0;
+		for (const Mesh& m : native)
+			triangles += m.faces.size();
+		uint64_t size = 0;
+		int64_t mtime;
+		stat_file(file, size, mtime);
+		char check[96];
+		if (bad || assimp.size() != native.size())
+			snprintf(check, sizeof(check), "FAILED: %lu/%lu meshes, %lu triangles differ",
+			         (unsigned long)native.size(), (unsigned long)assimp.size(), (unsigned long)bad);
+		else
+			snprintf(check, sizeof(check), "ok, %lu meshes, max error %.1e", (unsigned long)native.size(), worst);
+		failed += bad || assimp.size() != native.size();
+
+		std::string name = file.substr(file.find_last_of("/\\") + 1);
+		printf("%-40s %7.2f %9.2f %9.2f %9.2f %9lu  %s\n", name.c_str(), size / (1024.0 * 1024.0),
+		       ms[0], ms[1], ms[2], (unsigned long)triangles, check);
+		for (int i = 0; i < 3; i++)
+			total[i] += ms[i];
+	}
+	printf("%-40s %7s %9.2f %9.2f %9.2f\n", "total", "", total[0], total[1], total[2]);
+	return failed ? 1 : 0;
+}
+
+
+// Meshes for bench_meshopt: the big ones object.frag shades, and some
+// primitives.
+const char* const kOptimizedMeshes[] = {
+	"/src/assets/buildings/flatiron/13943_Flatiron_Building_v1_l1.obj",
+	"/src/assets/animals/dog/dog.obj",
+	"/src/assets/animals/cat/cat.obj",
+	"/src/assets/primitives/monkey.obj",
+	"/src/assets/animals/deer.obj",
+	"/src/assets/objects/truck/PickUp.obj",
+	"/src/assets/primitives/sphere.obj",
+	"/src/assets/primitives/torus.obj",
+};
+
+int
+bench_meshopt()
+{
+	printf("Mesh optimization, per mesh after dedupVertices\n");
+	printf("%-36s %9s %9s %6s %6s %8s %8s %8s\n", "mesh", "triangles", "vertices",
+	       "ACMR", "ACMR", "overdraw", "overdraw", "ms");
+	printf("%-36s %9s %9s %6s %6s %8s %8s\n", "", "", "", "before", "after", "before", "after");
+	for (const char* obj : kOptimizedMeshes) {
+		std::string file = path(obj);
+		std::vector<Mesh> meshes;
+		if (!parseObj(file.c_str(), meshes)) {
+			fprintf(stderr, "meshopt: could not load %s\n", file.c_str());
+			continue;
+		}
+		std::string name = file.substr(file.find_last_of("/\\") + 1);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			Mesh& m = meshes[i];
+			generateNormals(m);
+			dedupVertices(m);
+			float acmr = vertexCacheMissRatio(m), overdraw = overdrawRatio(m);
+			auto start = std::chrono::steady_clock::now();
+			optimizeVertexCache(m);
+			optimizeOverdraw(m);
+			optimizeVertexFetch(m);
+			double ms = elapsed_ms(start);
+			std::string label = meshes.size() > 1 ? name + " #" + std::to_string(i) : name;
+			printf("%-36s %9lu %9lu %6.3f %6.3f %8.3f %8.3f %8.2f\n", label.c_str(),
+			       (unsigned long)m.faces.size(), (unsigned long)m.vertices.size(),
+			       acmr, vertexCacheMissRatio(m), overdraw, overdrawRatio(m), ms);
+		}
+	}
+	return 0;
+}
+
+// GPU bytes of the float and PackedMesh formats of the meshes Loader
+// gives, and the worst error packing introduces.
+int
+bench_vertexformat()
+{
+	printf("Vertex format, float vs packed\n");
+	printf("%-36s %9s %10s %10s %6s %10s %9s %9s\n", "mesh", "vertices", "float KB",
+	       "packed KB", "ratio", "position", "normal", "uv");
+	printf("%-36s %9s %10s %10s %6s %10s %9s %9s\n", "", "", "", "", "",
+	       "error", "degrees", "error");
+	size_t float_total = 0, packed_total = 0;
+	for (const char* obj : kOptimizedMeshes) {
+		std::string file = path(obj);
+		std::vector<Mesh> meshes;
+		if (!parseObj(file.c_str(), meshes)) {
+			fprintf(stderr, "vertexformat: could not load %s\n", file.c_str());
+			continue;
+		}
+		processMeshes(meshes);
+		std::string name = file.substr(file.find_last_of("/\\") + 1);
+		size_t vertices = 0, float_bytes = 0, packed_bytes = 0;
+		float position_error = 0.0f, normal_error = 0.0f, uv_error = 0.0f;
+		for (const Mesh& m : meshes) {
+			PackedMesh p;
+			packMesh(m, p);
+			vertices += m.vertices.size();
+			float_bytes += m.vertices.size() * sizeof(glm::vec4) + m.normals.size() * sizeof(glm::vec4) +
+				m.uvs.size() * sizeof(glm::vec2) + m.faces.size() * sizeof(glm::uvec3);
+			packed_bytes += p.bytes();
+			// Position error relative to the largest side of the bounds.
+			float size = std::max(p.position_scale.x, std::max(p.position_scale.y, p.position_scale.z));
+			for (size_t v = 0; v < m.vertices.size(); v++) {
+				const uint16_t* q = &p.positions[4 * v];
+				glm::vec3 position = p.position_offset +
+					p.position_scale * glm::vec3(q[0], q[1], q[2]) / 65535.0f;
+				position_error = std::max(position_error,
+					glm::length(position - glm::vec3(m.vertices[v])) / size);
+				glm::vec3 n = glm::vec3(m.normals[v]);
+				if (glm::length(n) > 0.0f) {
+					float c = glm::clamp(glm::dot(unpackNormal(q[3]), glm::normalize(n)), -1.0f, 1.0f);
+					normal_error = std::max(normal_error, glm::degrees(std::acos(c)));
+				}
+				if (!p.uvs.empty()) {
+					glm::vec2 uv = glm::vec2(p.uv_transform.x, p.uv_transform.y) +
+						glm::vec2(p.uv_transform.z, p.uv_transform.w) *
+						glm::vec2(p.uvs[2 * v], p.uvs[2 * v + 1]) / 65535.0f;
+					uv_error = std::max(uv_error, glm::length(uv - m.uvs[v]));
+				}
+			}
+		}
+		float_total += float_bytes;
+		packed_total += packed_bytes;
+		printf("%-36s %9lu %10.1f %10.1f %6.2f %10.2e %9.3f %9.2e\n", name.c_str(),
+		       (unsigned long)vertices, float_bytes / 1024.0, packed_bytes / 1024.0,
+		       float_bytes / double(std::max<size_t>(packed_bytes, 1)),
+		       position_error, normal_error, uv_error);
+	}
+	printf("%-36s %9s %10.1f %10.1f %6.2f\n", "total", "", float_total / 1024.0,
+	       packed_total / 1024.0, float_total / double(std::max<size_t>(packed_total, 1)));
+	return 0;
+}
+
+// Average GPU time of drawing meshes kDraws times with their attributes in
+// separate buffers or interleaved in one. The viewport is tiny so vertex
+// fetch and shading, not fragments, set the time.
+double
+time_vertex_layout(const std::vector<Mesh>& meshes, bool interleaved)
+{
+	const int kWarmup = 5;
+	const int kFrames = 30;
+	const int kDraws = 20;
+
+	glm::vec3 low(meshes[0].vertices[0]), high = low;
+	for (const Mesh& m : meshes) {
+		for (const glm::vec4& v : m.vertices) {
+			low = glm::min(low, glm::vec3(v));
+			high = glm::max(high, glm::vec3(v));
+		}
+	}
+	float size = std::max(high.x - low.x, std::max(high.y - low.y, high.z - low.z));
+	glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / size)) *
+		glm::translate(glm::mat4(1.0f), -0.5f * (low + high));
+	glm::mat4 view = glm::lookAt(glm::vec3(1.1f, 0.8f, 1.4f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.01f, 100.0f);
+	glm::vec4 light_position(5.0f, 5.0f, 5.0f, 1.0f);
+	glm::vec4 eye_position = glm::inverse(view)[3];
+	auto matrix_binder = [](int loc, const void* data) {
+		glUniformMatrix4fv(loc, 1, GL_FALSE, (const GLfloat*)data);
+	};
+	auto vector_binder = [](int loc, const void* data) {
+		glUniform4fv(loc, 1, (const GLfloat*)data);
+	};
+	std::vector<ShaderUniform> uniforms = {
+		{ "model", matrix_binder, [&model]() -> const void* { return &model[0][0]; } },
+		{ "view", matrix_binder, [&view]() -> const void* { return &view[0][0]; } },
+		{ "projection", matrix_binder, [&projection]() -> const void* { return &projection[0][0]; } },
+		{ "light_position", vector_binder, [&light_position]() -> const void* { return &light_position[0]; } },
+		{ "view_position", vector_binder, [&eye_position]() -> const void* { return &eye_position[0]; } },
+	};
+	std::vector<DirectionalLight> directionalLights;
+	std::vector<PointLight> pointLights;
+	std::vector<SpotLight> spotLights;
+
+	LightBuffer::get().setLights(directionalLights, pointLights, spotLights);
+	std::vector<std::unique_ptr<RenderPass>> passes;
+	for (const Mesh& m : meshes) {
+		RenderDataInput input;
+		input.assign(0, "vertex_position", m.vertices.data(), m.vertices.size(), 4, GL_FLOAT);
+		input.assign(1, "vertex_normal", m.normals.data(), m.normals.size(), 4, GL_FLOAT);
+		if (!m.uvs.empty())
+			input.assign(2, "vertex_uv", m.uvs.data(), m.uvs.size(), 2, GL_FLOAT);
+		if (interleaved)
+			input.interleave();
+		input.assign_index(m.faces.data(), m.faces.size(), 3);
+		passes.emplace_back(new RenderPass(-1, input,
+			{ object_vertex_shader, nullptr, object_fragment_shader },
+			uniforms, { "fragment_color" }));
+		passes.back()->loadMaterials();
+	}
+
+	GLuint query;
+	glGenQueries(1, &query);
+	double total = 0.0;
+	for (int i = 0; i < kWarmup + kFrames; i++) {
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		for (size_t j = 0; j < meshes.size(); j++) {
+			passes[j]->setup();
+			for (int k = 0; k < kDraws; k++)
+				glDrawElements(GL_TRIANGLES, meshes[j].faces.size() * 3, GL_UNSIGNED_INT, 0);
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		if (i >= kWarmup)
+			total += ns * 1e-6;
+	}
+	glDeleteQueries(1, &query);
+	return total / kFrames;
+}
+
+int
+bench_vertex_layout()
+{
+	GLFWwindow* window = open_gl_context();
+	if (!window) {
+		fprintf(stderr, "layout: could not create an OpenGL 3.3 context\n");
+		return 1;
+	}
+	glViewport(0, 0, 64, 64);
+	printf("GPU time of 20 draws in ms, one buffer per attribute vs interleaved\n");
+	printf("%-36s %9s %10s %12s %8s\n", "mesh", "vertices", "separate", "interleaved", "speedup");
+	for (const char* obj : kOptimizedMeshes) {
+		std::string file = path(obj);
+		std::vector<Mesh> meshes;
+		if (!parseObj(file.c_str(), meshes)) {
+			fprintf(stderr, "layout: could not load %s\n", file.c_str());
+			continue;
+		}
+		processMeshes(meshes);
+		size_t vertices = 0;
+		for (const Mesh& m : meshes)
+			vertices += m.vertices.size();
+		double separate = time_vertex_layout(meshes, false);
+		double interleaved = time_vertex_layout(meshes, true);
+		std::string name = file.substr(file.find_last_of("/\\") + 1);
+		printf("%-36s %9lu %10.3f %12.3f %7.2fx\n", name.c_str(), (unsigned long)vertices,
+		       separate, interleaved, separate / interleaved);
+	}
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
+
+// Average GPU time of kDraws full-frame quads shaded with object.frag as
+// permuted, or the plain source if permutation is nullptr. Depth testing
+// is off so every draw shades every pixel: fragments set the time.
+double
+time_permutation(const ShaderPermutation* permutation, GLuint diffuse, GLuint specular)
+{
+	const int kWarmup = 5;
+	const int kFrames = 30;
+	const int kDraws = 20;
+
+	const glm::vec4 vertices[] = {
+		{ -1.0f, -1.0f, 0.0f, 1.0f }, { 1.0f, -1.0f, 0.0f, 1.0f },
+		{ 1.0f, 1.0f, 0.0f, 1.0f }, { -1.0f, 1.0f, 0.0f, 1.0f },
+	};
+	const glm::vec4 normals[4] = {
+		{ 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f },
+	};
+	const glm::vec2 uvs[] = { { 0.0f, 0.0f }, { 4.0f, 0.0f }, { 4.0f, 4.0f }, { 0.0f, 4.0f } };
+	const glm::uvec3 faces[] = { { 0, 1, 2 }, { 0, 2, 3 } };
+	glm::mat4 identity(1.0f);
+	glm::vec4 light_position(5.0f, 5.0f, 5.0f, 1.0f);
+	glm::vec4 eye_position(0.0f, 0.0f, 2.0f, 1.0f);
+	glm::vec4 light_color(0.1f, 0.1f, 0.15f, 1.0f);
+	auto matrix_binder = [](int loc, const void* data) {
+		glUniformMatrix4fv(loc, 1, GL_FALSE, (const GLfloat*)data);
+	};
+	auto vector_binder = [](int loc, const void* data) {
+		glUniform4fv(loc, 1, (const GLfloat*)data);
+	};
+	auto identity_data = [&identity]() -> const void* { return &identity[0][0]; };
+	std::vector<ShaderUniform> uniforms = {
+		{ "model", matrix_binder, identity_data },
+		{ "view", matrix_binder, identity_data },
+		{ "projection", matrix_binder, identity_data },
+		{ "light_position", vector_binder, [&light_position]() -> const void* { return &light_position[0]; } },
+		{ "view_position", vector_binder, [&eye_position]() -> const void* { return &eye_position[0]; } },
+		{ "light_color", vector_binder, [&light_color]() -> const void* { return &light_color[0]; } },
+	};
+
+	RenderDataInput input;
+	input.assign(0, "vertex_position", vertices, 4, 4, GL_FLOAT);
+	input.assign(1, "vertex_normal", normals, 4, 4, GL_FLOAT);
+	input.assign(2, "vertex_uv", uvs, 4, 2, GL_FLOAT);
+	input.interleave();
+	input.assign_index(faces, 2, 3);
+	const char* fs = object_fragment_shader;
+	if (permutation)
+		fs = permuteShader(fs, *permutation);
+	RenderPass pass(-1, input, { object_vertex_shader, nullptr, fs }, uniforms, { "fragment_color" });
+	pass.loadMaterials();
+	pass.setup();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, diffuse);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, specular);
+
+	GLuint query;
+	glGenQueries(1, &query);
+	double total = 0.0;
+	for (int i = 0; i < kWarmup + kFrames; i++) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		for (int k = 0; k < kDraws; k++)
+			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		if (i >= kWarmup)
+			total += ns * 1e-6;
+	}
+	glDeleteQueries(1, &query);
+	return total / kFrames;
+}
+
+// A mipmapped 256x256 checker, so the maps cost real texture fetches.
+GLuint
+checker_texture(glm::u8vec4 a, glm::u8vec4 b)
+{
+	const int kSize = 256;
+	std::vector<glm::u8vec4> pixels(kSize * kSize);
+	for (int y = 0; y < kSize; y++)
+		for (int x = 0; x < kSize; x++)
+			pixels[y * kSize + x] = ((x / 16 + y / 16) & 1) ? a : b;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, kSize, kSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	return texture;
+}
+
+int
+bench_permutations()
+{
+	GLFWwindow* window = open_gl_context();
+	if (!window) {
+		fprintf(stderr, "permutations: could not create an OpenGL 3.3 context\n");
+		return 1;
+	}
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	// main.cc's lights.
+	std::vector<DirectionalLight> directionalLights = { DirectionalLight(glm::vec3(-1.0f, -1.0f, -1.0f)) };
+	std::vector<PointLight> pointLights = {
+		PointLight(glm::vec3(0.0f, 25.0f, 10.0f)),
+		PointLight(glm::vec3(-20.0f, 50.0f, -20.0f)),
+	};
+	std::vector<SpotLight> spotLights = {
+		SpotLight(glm::vec3(12.0f, 20.0f, 0.0f), glm::vec3(-1.0f, -1.0f, 0.0f)),
+	};
+	LightBuffer::get().setLights(directionalLights, pointLights, spotLights);
+	GLuint diffuse = checker_texture(glm::u8vec4(200, 150, 100, 255), glm::u8vec4(60, 80, 120, 255));
+	GLuint specular = checker_texture(glm::u8vec4(255, 255, 255, 255), glm::u8vec4(30, 30, 30, 255));
+
+	ShaderPermutation counts = ShaderPermutation::currentLights();
+	ShaderPermutation no_specular = counts;
+	no_specular.specular = false;
+	ShaderPermutation plain = counts;
+	plain.textured = false;
+	plain.emissive = false;
+	plain.specular = false;
+	struct Variant {
+		const char* name;
+		const ShaderPermutation* permutation;
+	} variants[] = {
+		{ "light counts from the Lights block", nullptr },
+		{ "light counts compiled in", &counts },
+		{ "  without specular", &no_specular },
+		{ "  untextured, not emissive, no specular", &plain },
+	};
+	printf("GPU time of %d full-frame quads in ms at %dx%d, %d directional, %d point, %d spot lights\n",
+		20, kBenchWidth, kBenchHeight, counts.directional_lights, counts.point_lights, counts.spot_lights);
+	printf("%-42s %10s %8s\n", "object.frag", "ms", "speedup");
+	double base = 0.0;
+	for (const Variant& v : variants) {
+		double ms = time_permutation(v.permutation, diffuse, specular);
+		if (!v.permutation)
+			base = ms;
+		printf("%-42s %10.3f %7.2fx\n", v.name, ms, base / ms);
+	}
+	printf("%lu shader variants built\n", (unsigned long)shaderPermutationCount());
+	glDeleteTextures(1, &diffuse);
+	glDeleteTextures(1, &specular);
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
+
+// CPU time of LightClusters::bin for main.cc's --stress-lights scene, on
+// one thread and on all of them.
+int
+bench_clusters()
+{
+	const int kRuns = 50;
+	LightClusters& clusters = LightClusters::get();
+	glm::vec3 eye(0.0f, 3.0f, 40.0f);
+	glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	int threads = hardware_threads();
+	printf("Light binning into %dx%dx%d clusters at %dx%d, average of %d runs\n",
+	       LightClusters::kTilesX, LightClusters::kTilesY, LightClusters::kSlices,
+	       kBenchWidth, kBenchHeight, kRuns);
+	printf("%6s %9s %9s %9s %10s %10s %8s %5s\n", "lights", "indices", "average", "max",
+	       "ms 1 thr", "ms", "speedup", "same");
+	for (int count : { 64, 256, 1024, 4096, 16384 }) {
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<PointLight> lights;
+		for (int i = 0; i < count; i++) {
+			PointLight light(glm::vec3(-40.0f + 80.0f * unit(random), -1.5f + 9.5f * unit(random),
+			                           -40.0f + 80.0f * unit(random)));
+			light.setAmbient(glm::vec3(0.0f));
+			light.setDiffuse(glm::vec3(0.5f));
+			light.setSpecular(glm::vec3(0.5f));
+			light.setLinear(0.7f);
+			light.setQuadratic(4.0f);
+			lights.push_back(light);
+		}
+		clusters.setLights(lights, {});
+
+		double ms[2];
+		std::vector<uint32_t> table;
+		std::vector<uint16_t> indices;
+		for (int t = 0; t < 2; t++) {
+			auto start = std::chrono::steady_clock::now();
+			for (int run = 0; run < kRuns; run++)
+				clusters.bin(view, glm::radians(45.0f), kBenchWidth, kBenchHeight, 1000.0f, 0.05f,
+				             glm::length(eye), t == 0 ? 1 : threads);
+			ms[t] = elapsed_ms(start) / kRuns;
+			if (t == 0) {
+				table = clusters.table();
+				indices = clusters.indices();
+			}
+		}
+		const ClusterStats& stats = clusters.stats();
+		bool same = table == clusters.table() && indices == clusters.indices();
+		printf("%6d %9lu %9.2f %9lu %10.3f %10.3f %7.2fx %5s\n", count, (unsigned long)stats.indices,
+		       stats.indices / double(LightClusters::kClusters), (unsigned long)stats.max_per_cluster,
+		       ms[0], ms[1], ms[0] / ms[1], same ? "yes" : "NO");
+	}
+	return 0;
+}
+};
+
+int
+run_benchmark(const std::string& name)
+{
+	if (name == "menger")
+		return bench_menger();
+	if (name == "menger_gpu")
+		return bench_menger_gpu();
+	if (name == "loader")
+		return bench_loader();
+	if (name == "textures")
+		return bench_textures();
+	if (name == "obj")
+		return bench_obj();
+	if (name == "meshopt")
+		return bench_meshopt();
+	if (name == "vertexformat")
+		return bench_vertexformat();
+	if (name == "layout")
+		return bench_vertex_layout();
+	if (name == "permutations")
+		return bench_permutations();
+	if (name == "clusters")
+		return bench_clusters();
+	fprintf(stderr, "Unknown benchmark: %s\n", name.c_str());
+	return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+/*
+ * Offline benchmarks, run with
+ *      ./bin/lens --bench <name>
+ * Each one prints a small table to stdout and returns the process exit code.
+ *
+ *      menger: single vs multi-threaded Menger generation, levels 1-5
+ *      menger_gpu: GPU time of the mesh, instanced and raymarched sponge,
+ *              levels 1-10 (needs a GL 3.3 context, the window stays hidden)
+ *      loader: scene mesh loading with Assimp and parseObj vs the binary
+ *              mesh cache, read and memory-mapped
+ *      obj: Assimp vs parseObj on the big OBJs, checking both give the
+ *              same triangles
+ *      meshopt: vertex cache miss ratio and overdraw of the big meshes
+ *              before and after the mesh_optimizer.h passes
+ *      vertexformat: GPU bytes of the big meshes as floats vs packed_mesh.h,
+ *              and the error packing introduces
+ *      layout: GPU time of the big meshes with one buffer per attribute vs
+ *              RenderDataInput::interleave (needs a GL 3.3 context)
+ *      permutations: GPU time of a fragment-bound full-frame object.frag
+ *              with the light counts read at run time vs compiled in, and
+ *              with features compiled out (needs a GL 3.3 context)
+ *      clusters: CPU time of binning 64-16384 point lights into the
+ *              light_clusters.h grid on one thread vs all of them, and how
+ *              many lights a cluster ends up with
+ *      textures: scene texture decode and upload from PNG/JPG/TGA vs the
+ *              cooked block-compressed DDS, and the VRAM each takes
+ */
+int run_benchmark(const std::string& name);
+
+#endif
@@ -12,12 +12,13 @@ std::string get_str_timestamp()
   return time_str;
 }
 
-Controller::Controller(GLFWwindow* window, Camera* camera, Menger* menger, float* exposure, bool* showMeshes, bool* lensEffects, bool* captureImage) {
+Controller::Controller(GLFWwindow* window, Camera* camera, Menger* menger, float* exposure, bool* showMeshes, bool* lensEffects, bool* deferredShading, bool* captureImage) {
 	this->window = window;
 	this->camera = camera;
 	this->menger = menger;
 
 	this->lensEffects = lensEffects;
+	this->deferredShading = deferredShading;
 	this->showMeshes = showMeshes;
 	this->exposure = exposure;
   this->captureImage = captureImage;
@@ -129,6 +130,16 @@ Controller::keyCallback(int key, int scancode, int action, int mods)
 		*(this->showMeshes) = !*(this->showMeshes);
 	} else if (key == GLFW_KEY_4 && action != GLFW_RELEASE) {
 		*(this->lensEffects) = !*(this->lensEffects);
+	} else if (key == GLFW_KEY_5 && action == GLFW_PRESS) {
+		// Forward vs deferred shading, for comparing frame times.
+		*(this->deferredShading) = !*(this->deferredShading);
+	} else if (key == GLFW_KEY_EQUAL && action != GLFW_RELEASE) {
+		// +/-: step through every level the current mode can show.
+		if (menger->nesting_level() < menger->max_nesting_level())
+			menger->set_nesting_level(menger->nesting_level() + 1);
+	} else if (key == GLFW_KEY_MINUS && action != GLFW_RELEASE) {
+		if (menger->nesting_level() > 0)
+			menger->set_nesting_level(menger->nesting_level() - 1);
 	}
 }
 
@@ -0,0 +1,224 @@
+/*
+ * lens_cook: convert every mesh and texture under the asset directory into
+ * the files the game loads at runtime, on all cores:
+ *      <mesh>.obj.meshcache: triangulated, normals generated where the
+ *              OBJ has none, vertices deduplicated, faces and vertices
+ *              reordered for the vertex cache and overdraw (see
+ *              mesh_optimizer.h)
+ *      <image>.cooked.dds: BC1/BC3 mip chain (see texture_cache.h)
+ *
+ * Every output records the hash of its source and of the cook settings,
+ * so a rerun only redoes what changed.
+ *
+ *      ./bin/lens_cook [-j threads] [--force] [--no-optimize] [dir]
+ * dir defaults to src/assets. --no-optimize skips the vertex cache,
+ * overdraw and fetch reordering. It is part of the settings hash, so
+ * switching it recooks every mesh.
+ */
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "filesystem.h"
+#include "loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+#include "parallel.h"
+#include "texture_cache.h"
+
+namespace {
+
+enum Kind { kMesh, kTexture };
+enum Status { kUpToDate, kCooked, kFailed };
+
+struct Job {
+	std::string file;
+	Kind kind;
+	Status status = kFailed;
+	double ms = 0.0;
+	std::string detail;
+};
+
+double
+elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	auto d = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+std::string
+extension(const std::string& file)
+{
+	size_t dot = file.find_last_of('.');
+	if (dot == std::string::npos)
+		return "";
+	std::string ext = file.substr(dot);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext;
+}
+
+void
+cook_mesh(Job& job, bool force, bool optimize)
+{
+	std::vector<Mesh> meshes;
+	if (!force && readMeshCache(job.file, meshes,
+			optimize ? kMeshCacheOptimized : kMeshCacheUnoptimized)) {
+		job.status = kUpToDate;
+		return;
+	}
+	Loader loader;
+	std::vector<Material> materials;
+	// One parser thread, the jobs already use every core.
+	if (!parseObj(job.file.c_str(), meshes, 1) && !loader.importObj(job.file.c_str(), meshes, materials))
+		return;
+	size_t before = 0, after = 0, normals = 0, faces = 0;
+	// Triangle weighted over the file's meshes.
+	double acmr[2] = { 0, 0 }, overdraw[2] = { 0, 0 };
+	for (Mesh& m : meshes) {
+		before += m.vertices.size();
+		normals += generateNormals(m);
+		dedupVertices(m);
+		double weight = double(m.faces.size());
+		acmr[0] += vertexCacheMissRatio(m) * weight;
+		overdraw[0] += overdrawRatio(m) * weight;
+		if (optimize) {
+			optimizeVertexCache(m);
+			optimizeOverdraw(m);
+			optimizeVertexFetch(m);
+		}
+		acmr[1] += vertexCacheMissRatio(m) * weight;
+		overdraw[1] += overdrawRatio(m) * weight;
+		after += m.vertices.size();
+		faces += m.faces.size();
+	}
+	if (!writeMeshCache(job.file, meshes, optimize))
+		return;
+	for (int i = 0; faces && i < 2; i++) {
+		acmr[i] /= faces;
+		overdraw[i] /= faces;
+	}
+	char detail[160];
+	snprintf(detail, sizeof(detail), "%lu -> %lu vertices, ACMR %.2f -> %.2f, overdraw %.2f -> %.2f%s",
+		(unsigned long)before, (unsigned long)after, acmr[0], acmr[1], overdraw[0], overdraw[1],
+		normals ? ", normals generated" : "");
+	job.detail = detail;
+	job.status = kCooked;
+}
+
+void
+cook_texture(Job& job, bool force)
+{
+	CookedTexture texture;
+	if (!force && readTexture(job.file, texture)) {
+		job.status = kUpToDate;
+		return;
+	}
+	int width, height, channels;
+	unsigned char* pixels = loadImg(job.file, width, height, channels);
+	bool ok = compressTexture(pixels, width, height, channels, texture) &&
+		writeCookedTexture(job.file, texture);
+	freeImg(pixels);
+	if (!ok)
+		return;
+	char detail[128];
+	snprintf(detail, sizeof(detail), "%dx%d, %s, %.2f -> %.2f MB", width, height,
+		texture.format == kTextureBC3 ? "BC3" : "BC1",
+		size_t(width) * height * channels * 4 / 3 / (1024.0 * 1024.0),
+		texture.bytes() / (1024.0 * 1024.0));
+	job.detail = detail;
+	job.status = kCooked;
+}
+
+int
+usage()
+{
+	fprintf(stderr, "usage: lens_cook [-j threads] [--force] [--no-optimize] [dir]\n");
+	return EXIT_FAILURE;
+}
+
+};
+
+int
+main(int argc, char* argv[])
+{
+	int threads = 0;
+	bool force = false;
+	bool optimize = true;
+	std::string dir = path("/src/assets");
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-j" && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (arg == "--force")
+			force = true;
+		else if (arg == "--no-optimize")
+			optimize = false;
+		else if (arg[0] == '-')
+			return usage();
+		else
+			dir = arg;
+	}
+	if (threads <= 0)
+		threads = hardware_threads();
+
+	std::vector<std::string> files;
+	list_files(dir, files);
+	std::sort(files.begin(), files.end());
+	std::vector<Job> jobs;
+	for (const std::string& file : files) {
+		std::string ext = extension(file);
+		Job job;
+		job.file = file;
+		if (ext == ".obj")
+			job.kind = kMesh;
+		else if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp")
+			job.kind = kTexture;
+		else
+			continue;
+		jobs.push_back(job);
+	}
+	if (jobs.empty()) {
+		fprintf(stderr, "lens_cook: no meshes or images in %s\n", dir.c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Biggest first, so a large file doesn't start last and hold up the end.
+	std::vector<std::pair<uint64_t, size_t>> order;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		uint64_t size = 0;
+		int64_t mtime;
+		stat_file(jobs[i].file, size, mtime);
+		order.push_back(std::make_pair(size, i));
+	}
+	std::sort(order.rbegin(), order.rend());
+
+	auto start = std::chrono::steady_clock::now();
+	parallel_for(int(jobs.size()), threads, [&](int i) {
+		Job& job = jobs[order[i].second];
+		auto job_start = std::chrono::steady_clock::now();
+		if (job.kind == kMesh)
+			cook_mesh(job, force, optimize);
+		else
+			cook_texture(job, force);
+		job.ms = elapsed_ms(job_start);
+	});
+	double wall = elapsed_ms(start);
+
+	const char* status[] = { "up to date", "cooked", "FAILED" };
+	int counts[3] = { 0, 0, 0 };
+	double work = 0.0;
+	for (const Job& job : jobs) {
+		std::string name = job.file.substr(std::min(job.file.size(), dir.size() + 1));
+		printf("%-10s %8.1f ms  %-48s %s\n", status[job.status], job.ms, name.c_str(), job.detail.c_str());
+		counts[job.status]++;
+		work += job.ms;
+	}
+	printf("%d cooked, %d up to date, %d failed: %.1f ms wall, %.1f ms of work on %d threads\n",
+		counts[kCooked], counts[kUpToDate], counts[kFailed], wall, work, threads);
+	return counts[kFailed] ? EXIT_FAILURE : EXIT_SUCCESS;
+}
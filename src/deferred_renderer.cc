@@ -0,0 +1,150 @@
+#include "deferred_renderer.h"
+#include "debuggl.h"
+#include "light_clusters.h"
+#include "render_pass.h"
+#include "shader_permutation.h"
+#include <iostream>
+
+namespace {
+
+const char* screen_vertex_shader =
+#include "shaders/screen_default.vert"
+;
+
+const char* deferred_light_shader =
+#include "shaders/deferred_light.frag"
+;
+
+struct Target {
+	const char* sampler;
+	GLenum internal_format;
+	GLenum format;
+	GLenum type;
+};
+
+// In gbuffer.frag's output order, read from texture units 0, 1, ...
+const Target kTargetFormats[DeferredRenderer::kTargets] = {
+	{ "gbuffer_emission", GL_RGBA16F, GL_RGBA, GL_FLOAT },
+	{ "gbuffer_albedo", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE },
+	{ "gbuffer_specular", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE },
+	{ "gbuffer_normal", GL_RGBA16F, GL_RGBA, GL_FLOAT },
+	{ "gbuffer_position", GL_RGBA32F, GL_RGBA, GL_FLOAT },
+};
+
+};
+
+DeferredRenderer::DeferredRenderer()
+{
+	for (int i = 0; i < kTargets; i++)
+		textures_[i] = 0;
+}
+
+DeferredRenderer::~DeferredRenderer()
+{
+	if (!framebuffer_)
+		return;
+	glDeleteFramebuffers(1, &framebuffer_);
+	glDeleteTextures(kTargets, textures_);
+	glDeleteRenderbuffers(1, &depth_);
+}
+
+void
+DeferredRenderer::setup(int width, int height, unsigned quad_vao)
+{
+	width_ = width;
+	height_ = height;
+	quad_vao_ = quad_vao;
+
+	CHECK_GL_ERROR(glGenFramebuffers(1, &framebuffer_));
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_));
+	CHECK_GL_ERROR(glGenTextures(kTargets, textures_));
+	for (int i = 0; i < kTargets; i++) {
+		const Target& t = kTargetFormats[i];
+		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, textures_[i]));
+		CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, t.internal_format, width, height, 0, t.format, t.type, NULL));
+		// One texel per pixel, read back where it was written.
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures_[i], 0));
+	}
+	CHECK_GL_ERROR(glGenRenderbuffers(1, &depth_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, depth_));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height));
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_));
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::FRAMEBUFFER:: G-buffer is not complete!" << std::endl;
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	program_ = RenderPass::program(
+			{ screen_vertex_shader, nullptr, permuteShader(deferred_light_shader, ShaderPermutation::currentLights()) },
+			{ { 0, "vertex_position" }, { 1, "aTexCoords" } },
+			{ "fragment_color" });
+}
+
+void
+DeferredRenderer::beginForward(const glm::vec4& clear_color)
+{
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_));
+	GLenum buffers[kTargets];
+	for (int i = 0; i < kTargets; i++)
+		buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+	CHECK_GL_ERROR(glDrawBuffers(kTargets, buffers));
+	const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	CHECK_GL_ERROR(glClearBufferfv(GL_COLOR, 0, &clear_color[0]));
+	for (int i = 1; i < kTargets; i++)
+		CHECK_GL_ERROR(glClearBufferfv(GL_COLOR, i, zero));
+	CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
+
+	// Forward shaders only have fragment_color.
+	for (int i = 1; i < kTargets; i++)
+		buffers[i] = GL_NONE;
+	CHECK_GL_ERROR(glDrawBuffers(kTargets, buffers));
+}
+
+void
+DeferredRenderer::beginGBuffer()
+{
+	GLenum buffers[kTargets];
+	for (int i = 0; i < kTargets; i++)
+		buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+	CHECK_GL_ERROR(glDrawBuffers(kTargets, buffers));
+}
+
+void
+DeferredRenderer::light(const glm::mat4& view, const glm::vec3& eye, unsigned target)
+{
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, target));
+	glDisable(GL_DEPTH_TEST);
+	CHECK_GL_ERROR(glUseProgram(program_));
+	if (!locations_ready_) {
+		// After RenderPass::finishPrograms, none of this waits.
+		for (int i = 0; i < kTargets; i++)
+			glUniform1i(RenderPass::uniformLocation(program_, kTargetFormats[i].sampler), i);
+		glUniform1i(RenderPass::uniformLocation(program_, "cluster_lights"), LightClusters::kTextureUnit);
+		glUniform1i(RenderPass::uniformLocation(program_, "cluster_table"), LightClusters::kTextureUnit + 1);
+		glUniform1i(RenderPass::uniformLocation(program_, "cluster_indices"), LightClusters::kTextureUnit + 2);
+		view_location_ = RenderPass::uniformLocation(program_, "view");
+		eye_location_ = RenderPass::uniformLocation(program_, "view_position");
+		cluster_depth_location_ = RenderPass::uniformLocation(program_, "cluster_depth");
+		cluster_tile_location_ = RenderPass::uniformLocation(program_, "cluster_tile");
+		locations_ready_ = true;
+	}
+	const LightClusters& clusters = LightClusters::get();
+	glUniformMatrix4fv(view_location_, 1, GL_FALSE, &view[0][0]);
+	glUniform3fv(eye_location_, 1, &eye[0]);
+	glUniform2fv(cluster_depth_location_, 1, &clusters.depthParams()[0]);
+	glUniform2fv(cluster_tile_location_, 1, &clusters.tileSize()[0]);
+
+	for (int i = 0; i < kTargets; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, textures_[i]);
+	}
+	if (clusters.enabled())
+		clusters.bind();
+	glActiveTexture(GL_TEXTURE0);
+
+	CHECK_GL_ERROR(glBindVertexArray(quad_vao_));
+	CHECK_GL_ERROR(glDrawArrays(GL_TRIANGLES, 0, 6));
+}
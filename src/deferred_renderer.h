@@ -0,0 +1,60 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glm/glm.hpp>
+
+#include <GL/glew.h>
+
+/*
+ * DeferredRenderer: the optional deferred shading path. Instead of lighting
+ * every fragment of every bokeh ray in object.frag, the scene is drawn once
+ * into a G-buffer and lit by one full-screen pass. The targets:
+ *      emission: RGBA16F, light_color of emissive objects, and the final
+ *              color of what is still shaded forward (sponge, floor)
+ *      albedo, specular: RGBA8 material maps, shininess / 256 in the
+ *              specular alpha
+ *      normal: RGBA16F world normal
+ *      position: RGBA32F world position, w = 1 where there is an object to
+ *              light. Not rebuilt from depth: the scene's 0.0001 near plane
+ *              leaves a 24 bit depth buffer too coarse for that.
+ * shaders/deferred_light.frag lights them with the directional lights of the
+ * LightBuffer and the point and spot lights of the frame's LightClusters,
+ * writing into a framebuffer of the caller. main gives it the one the
+ * forward path resolves its MSAA buffer into, so the post chain after it
+ * is the same for both paths.
+ */
+class DeferredRenderer {
+public:
+	static const int kTargets = 5;
+
+	DeferredRenderer();
+	~DeferredRenderer();
+
+	// Needs a GL context and the scene's lights set, the lighting pass is
+	// specialized for them. quad_vao: a full-screen quad of 6 vertices,
+	// vertex_position at 0 and aTexCoords at 1, like main's.
+	void setup(int width, int height, unsigned quad_vao);
+	// Bind and clear the G-buffer, emission to clear_color. Draws after
+	// this only write emission: for forward shaded geometry.
+	void beginForward(const glm::vec4& clear_color);
+	// Draws after this write every target: Object::renderGBuffer.
+	void beginGBuffer();
+	// Light the G-buffer into target, a framebuffer of the G-buffer's size.
+	void light(const glm::mat4& view, const glm::vec3& eye, unsigned target);
+
+private:
+	int width_ = 0;
+	int height_ = 0;
+	unsigned framebuffer_ = 0;
+	unsigned textures_[kTargets];
+	unsigned depth_ = 0;
+	unsigned quad_vao_ = 0;
+	unsigned program_ = 0;
+	bool locations_ready_ = false;
+	int view_location_ = -1;
+	int eye_location_ = -1;
+	int cluster_depth_location_ = -1;
+	int cluster_tile_location_ = -1;
+};
+
+#endif
@@ -2,10 +2,18 @@
 #define FILESYSTEM_H
 
 #include <stdio.h>  // defines FILENAME_MAX
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sys/stat.h>
 
 #ifdef _WIN32
     #include <direct.h>
+    #include <io.h>
     #ifndef GetCurrentDir
         #define GetCurrentDir _getcwd
     #endif
@@ -13,6 +21,7 @@
         #define PLATFORM 0
     #endif
 #else
+    #include <dirent.h>
     #include <unistd.h>
     #ifndef GetCurrentDir
         #define GetCurrentDir getcwd
@@ -63,4 +72,101 @@ std::string static mtl_path(std::string file, std::string texture) {
     return path + texture;
 }
 
+// Resolve ".." and links so the same file always gets the same name.
+std::string static canonical_path(const std::string& file) {
+    char c[4096];
+#ifdef _WIN32
+    if (!_fullpath(c, file.c_str(), sizeof(c)))
+        return file;
+#else
+    if (!realpath(file.c_str(), c))
+        return file;
+#endif
+    return std::string(c);
+}
+
+static inline bool read_file(const std::string& file, std::vector<char>& data) {
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+    data.resize(size_t(in.tellg()));
+    in.seekg(0);
+    in.read(data.data(), data.size());
+    return bool(in);
+}
+
+static inline bool stat_file(const std::string& file, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0)
+        return false;
+    size = uint64_t(st.st_size);
+    mtime = int64_t(st.st_mtime);
+    return true;
+}
+
+// Append every regular file below dir, recursively, to files.
+static inline void list_files(const std::string& dir, std::vector<std::string>& files) {
+#ifdef _WIN32
+    struct _finddata_t entry;
+    intptr_t handle = _findfirst((dir + "\\*").c_str(), &entry);
+    if (handle == -1)
+        return;
+    do {
+        std::string name = entry.name;
+        if (name == "." || name == "..")
+            continue;
+        if (entry.attrib & _A_SUBDIR)
+            list_files(dir + "\\" + name, files);
+        else
+            files.push_back(dir + "\\" + name);
+    } while (_findnext(handle, &entry) == 0);
+    _findclose(handle);
+#else
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return;
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string file = dir + "/" + name;
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            list_files(file, files);
+        else if (S_ISREG(st.st_mode))
+            files.push_back(file);
+    }
+    closedir(d);
+#endif
+}
+
+// Create dir unless it exists already. Its parent has to.
+static inline bool make_dir(const std::string& dir) {
+#ifdef _WIN32
+    return _mkdir(dir.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// FNV-1a, 64 bit.
+static inline uint64_t content_hash(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static inline bool hash_file(const std::string& file, uint64_t& hash) {
+    std::vector<char> data;
+    if (!read_file(file, data))
+        return false;
+    hash = content_hash(data.data(), data.size());
+    return true;
+}
+
 #endif
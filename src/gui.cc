@@ -1,4 +1,7 @@
 #include "gui.h"
+#include "render_pass.h"
+#include "menger_renderer.h"
+#include "light_clusters.h"
 
 std::string glsl_version = "#version 330 core";
 ImVec4 clear_color = ImColor(114, 144, 154);
@@ -18,6 +21,18 @@ BasicGUI::BasicGUI(GLFWwindow* window, int* score, std::string* object_goal){
   this->object_goal = object_goal;
 }
 
+void BasicGUI::mengerStats(const MengerStats* stats){
+  this->menger_stats = stats;
+}
+
+void BasicGUI::clusterStats(const ClusterStats* stats){
+  this->cluster_stats = stats;
+}
+
+void BasicGUI::deferredShading(const bool* deferred){
+  this->deferred_shading = deferred;
+}
+
 void BasicGUI::render(){
 
   // 3. Show the ImGui test window. Most of the sample code is in ImGui::ShowTestWindow()
@@ -28,7 +43,18 @@ void BasicGUI::render(){
     static float f = 0.0f;
     ImGui::Text("Your score: %d", *(this->score));
 	ImGui::Text("Take a picture of: %s", (*(this->object_goal)).c_str());
+    if (deferred_shading)
+      ImGui::Text("Shading: %s (5 to switch)", *deferred_shading ? "deferred" : "forward");
     ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::Text("GPU uploads: %lu bytes/frame", (unsigned long)RenderPass::getUploadBytes());
+    ImGui::Text("Uniform lookups: %lu/frame", (unsigned long)RenderPass::getUniformLookups());
+    if (menger_stats)
+      ImGui::Text("Menger cubes: %lu / %lu submitted", (unsigned long)menger_stats->submitted_cubes,
+          (unsigned long)menger_stats->total_cubes);
+    if (cluster_stats)
+      ImGui::Text("Clustered lights: %lu, %.1f per cluster, %lu at most, binned in %.2f ms",
+          (unsigned long)cluster_stats->lights, cluster_stats->indices / double(LightClusters::kClusters),
+          (unsigned long)cluster_stats->max_per_cluster, cluster_stats->bin_ms);
 
     ImGui::SetNextWindowPos(ImVec2(300, 5), ImGuiSetCond_FirstUseEver);
     // Rendering
@@ -9,13 +9,22 @@
 #include <GLFW/glfw3.h>
 #include <string>
 
+struct MengerStats;
+struct ClusterStats;
+
 class BasicGUI {
   GLFWwindow* window;
     int* score;
     std::string* object_goal;
+    const MengerStats* menger_stats = nullptr;
+    const ClusterStats* cluster_stats = nullptr;
+    const bool* deferred_shading = nullptr;
 
   public:
     BasicGUI(GLFWwindow* window, int* score, std::string* object_goal);
+    void mengerStats(const MengerStats* stats);
+    void clusterStats(const ClusterStats* stats);
+    void deferredShading(const bool* deferred);
     void render();
 };
 
@@ -0,0 +1,256 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "debuggl.h"
+#include "parallel.h"
+
+constexpr float LightClusters::kNear;
+
+namespace {
+    const int kTiles = LightClusters::kTilesX * LightClusters::kTilesY;
+
+    // Distance at which a light of this attenuation and brightness falls
+    // under 1/256, the last step an 8 bit channel shows.
+    float lightRange(float constant, float linear, float quadratic, float brightest) {
+        float target = brightest * 256.0f;
+        if (target <= constant)
+            return 0.0f;
+        if (quadratic > 0.0f)
+            return (-linear + std::sqrt(linear * linear + 4.0f * quadratic * (target - constant))) /
+                (2.0f * quadratic);
+        if (linear > 0.0f)
+            return (target - constant) / linear;
+        return 1e9f;
+    }
+
+    float brightest(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular) {
+        glm::vec3 sum = ambient + diffuse + specular;
+        return std::max(sum.x, std::max(sum.y, sum.z));
+    }
+
+    int tile(float ndc, int tiles) {
+        return std::min(std::max(int(std::floor((ndc * 0.5f + 0.5f) * tiles)), 0), tiles - 1);
+    }
+};
+
+LightClusters& LightClusters::get() {
+    static LightClusters clusters;
+    return clusters;
+}
+
+void LightClusters::setLights(const std::vector<PointLight>& pointLights,
+                              const std::vector<SpotLight>& spotLights) {
+    size_t count = std::min(pointLights.size() + spotLights.size(), size_t(kMaxLights));
+    texels_.clear();
+    positions_.clear();
+    ranges_.clear();
+    texels_.reserve(count * kTexelsPerLight);
+    positions_.reserve(count);
+    ranges_.reserve(count);
+
+    for (const PointLight& light : pointLights) {
+        if (positions_.size() == count)
+            break;
+        texels_.push_back(glm::vec4(light.getPosition(), light.getConstant()));
+        texels_.push_back(glm::vec4(light.getAmbient(), light.getLinear()));
+        texels_.push_back(glm::vec4(light.getDiffuse(), light.getQuadratic()));
+        texels_.push_back(glm::vec4(light.getSpecular(), 0.0f));
+        texels_.push_back(glm::vec4(0.0f));
+        texels_.push_back(glm::vec4(0.0f));
+        positions_.push_back(light.getPosition());
+        ranges_.push_back(lightRange(light.getConstant(), light.getLinear(), light.getQuadratic(),
+                                     brightest(light.getAmbient(), light.getDiffuse(), light.getSpecular())));
+    }
+    for (const SpotLight& light : spotLights) {
+        if (positions_.size() == count)
+            break;
+        texels_.push_back(glm::vec4(light.getPosition(), light.getConstant()));
+        texels_.push_back(glm::vec4(light.getAmbient(), light.getLinear()));
+        texels_.push_back(glm::vec4(light.getDiffuse(), light.getQuadratic()));
+        texels_.push_back(glm::vec4(light.getSpecular(), 1.0f));
+        texels_.push_back(glm::vec4(light.getDirection(), light.getCutOff()));
+        texels_.push_back(glm::vec4(light.getOuterCutOff(), 0.0f, 0.0f, 0.0f));
+        positions_.push_back(light.getPosition());
+        // The whole sphere, the cone is not worth a tighter bound here.
+        ranges_.push_back(lightRange(light.getConstant(), light.getLinear(), light.getQuadratic(),
+                                     brightest(light.getAmbient(), light.getDiffuse(), light.getSpecular())));
+    }
+    if (pointLights.size() + spotLights.size() > count)
+        std::cerr << "LightClusters: only the first " << kMaxLights << " lights are used" << std::endl;
+
+    enabled_ = true;
+    lights_dirty_ = true;
+}
+
+void LightClusters::bin(const glm::mat4& view, float fovy, int width, int height,
+                        float far, float margin, float focus, int threads) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Structure of arrays, so the per-slice depth test is a plain loop.
+    size_t count = positions_.size();
+    x_.resize(count);
+    y_.resize(count);
+    z_.resize(count);
+    r_.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec4 p = view * glm::vec4(positions_[i], 1.0f);
+        x_[i] = p.x;
+        y_[i] = p.y;
+        z_[i] = -p.z;
+        // Scaled by the far side of the sphere, the one that moves most.
+        float shift = margin;
+        if (focus > 0.0f)
+            shift *= std::max(1.0f, (z_[i] + ranges_[i]) / focus);
+        r_[i] = ranges_[i] + shift;
+    }
+
+    float scale = kSlices / std::log(std::max(far, kNear * 2.0f) / kNear);
+    depth_params_ = glm::vec2(scale, std::log(kNear) * scale);
+    tile_size_ = glm::vec2(float(width) / kTilesX, float(height) / kTilesY);
+    float aspect = height > 0 ? float(width) / height : 1.0f;
+    float cot = 1.0f / std::tan(fovy * 0.5f);
+    glm::vec2 projection(cot / aspect, cot);
+
+    parallel_for(kSlices, threads, [this, scale, projection](int s) {
+        binSlice(s, scale, projection);
+    });
+
+    // Stitch the slices together, dropping what doesn't fit the buffer.
+    table_.resize(2 * kClusters);
+    indices_.clear();
+    stats_ = ClusterStats();
+    stats_.lights = count;
+    for (int s = 0; s < kSlices; s++) {
+        const Slice& slice = slices_[s];
+        size_t base = indices_.size();
+        for (int t = 0; t < kTiles; t++) {
+            size_t offset = base + slice.offsets[t];
+            size_t n = slice.offsets[t + 1] - slice.offsets[t];
+            size_t kept = offset < max_indices_ ? std::min(n, max_indices_ - offset) : 0;
+            table_[2 * (s * kTiles + t)] = uint32_t(std::min(offset, max_indices_));
+            table_[2 * (s * kTiles + t) + 1] = uint32_t(kept);
+            stats_.max_per_cluster = std::max(stats_.max_per_cluster, n);
+            stats_.dropped += n - kept;
+        }
+        size_t fits = base < max_indices_ ? std::min(slice.indices.size(), max_indices_ - base) : 0;
+        indices_.insert(indices_.end(), slice.indices.begin(), slice.indices.begin() + fits);
+    }
+    stats_.indices = indices_.size() + stats_.dropped;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    stats_.bin_ms = elapsed.count();
+}
+
+void LightClusters::binSlice(int s, float scale, const glm::vec2& projection) {
+    Slice& slice = slices_[s];
+    size_t count = z_.size();
+    const float* x = x_.data();
+    const float* y = y_.data();
+    const float* z = z_.data();
+    const float* r = r_.data();
+
+    // The first slice starts at the eye, the last goes on forever: the
+    // shader clamps to them.
+    float near = s == 0 ? 0.0f : kNear * std::exp(s / scale);
+    float far = s == kSlices - 1 ? 1e30f : kNear * std::exp((s + 1) / scale);
+
+    // Depth test first, branch free so it vectorizes.
+    slice.hit.resize(count);
+    uint8_t* hit = slice.hit.data();
+    for (size_t i = 0; i < count; i++)
+        hit[i] = uint8_t((z[i] + r[i] > near) & (z[i] - r[i] < far) & (z[i] + r[i] > 0.0f));
+
+    // Tiles covered by the sphere's bounding box within the slice: its
+    // corners at the nearest and farthest depth bound x / z and y / z.
+    slice.rects.clear();
+    slice.offsets.assign(kTiles + 1, 0);
+    std::vector<uint32_t>& counts = slice.offsets;
+    for (size_t i = 0; i < count; i++) {
+        if (!hit[i])
+            continue;
+        float zn = std::max(std::max(near, z[i] - r[i]), 1e-4f);
+        float zf = std::min(far, z[i] + r[i]);
+        float x0 = x[i] - r[i], x1 = x[i] + r[i];
+        float y0 = y[i] - r[i], y1 = y[i] + r[i];
+        float nx0 = std::min(x0 / zn, x0 / zf) * projection.x;
+        float nx1 = std::max(x1 / zn, x1 / zf) * projection.x;
+        float ny0 = std::min(y0 / zn, y0 / zf) * projection.y;
+        float ny1 = std::max(y1 / zn, y1 / zf) * projection.y;
+        if (nx1 < -1.0f || nx0 > 1.0f || ny1 < -1.0f || ny0 > 1.0f) {
+            hit[i] = 0;
+            continue;
+        }
+        int rect[4] = { tile(nx0, kTilesX), tile(nx1, kTilesX), tile(ny0, kTilesY), tile(ny1, kTilesY) };
+        slice.rects.insert(slice.rects.end(), rect, rect + 4);
+        for (int ty = rect[2]; ty <= rect[3]; ty++)
+            for (int tx = rect[0]; tx <= rect[1]; tx++)
+                counts[ty * kTilesX + tx + 1]++;
+    }
+
+    // Prefix sum, then fill each tile's run in light order.
+    for (int t = 0; t < kTiles; t++)
+        slice.offsets[t + 1] += slice.offsets[t];
+    slice.indices.resize(slice.offsets[kTiles]);
+    std::vector<uint32_t> fill(slice.offsets.begin(), slice.offsets.end() - 1);
+    const int* rect = slice.rects.data();
+    for (size_t i = 0; i < count; i++) {
+        if (!hit[i])
+            continue;
+        for (int ty = rect[2]; ty <= rect[3]; ty++)
+            for (int tx = rect[0]; tx <= rect[1]; tx++)
+                slice.indices[fill[ty * kTilesX + tx]++] = uint16_t(i);
+        rect += 4;
+    }
+}
+
+void LightClusters::upload() {
+    if (!buffers_[0]) {
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        CHECK_GL_ERROR(glGenBuffers(3, buffers_));
+        CHECK_GL_ERROR(glGenTextures(3, textures_));
+        for (int k = 0; k < 3; k++) {
+            CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffers_[k]));
+            CHECK_GL_ERROR(glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_DYNAMIC_DRAW));
+            CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, textures_[k]));
+            CHECK_GL_ERROR(glTexBuffer(GL_TEXTURE_BUFFER, formats[k], buffers_[k]));
+        }
+        GLint texels = 0;
+        CHECK_GL_ERROR(glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels));
+        max_indices_ = size_t(std::max(texels, 1));
+    }
+
+    // Sizes are never zero, and every frame gets fresh storage so the
+    // driver doesn't wait for the last frame's draws to let go of it.
+    if (lights_dirty_) {
+        size_t bytes = std::max(texels_.size(), size_t(1)) * sizeof(glm::vec4);
+        CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffers_[0]));
+        CHECK_GL_ERROR(glBufferData(GL_TEXTURE_BUFFER, bytes, nullptr, GL_STATIC_DRAW));
+        if (!texels_.empty())
+            CHECK_GL_ERROR(glBufferSubData(GL_TEXTURE_BUFFER, 0, texels_.size() * sizeof(glm::vec4), texels_.data()));
+        lights_dirty_ = false;
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffers_[1]));
+    CHECK_GL_ERROR(glBufferData(GL_TEXTURE_BUFFER, table_.size() * sizeof(uint32_t), nullptr, GL_STREAM_DRAW));
+    if (!table_.empty())
+        CHECK_GL_ERROR(glBufferSubData(GL_TEXTURE_BUFFER, 0, table_.size() * sizeof(uint32_t), table_.data()));
+    CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffers_[2]));
+    size_t bytes = std::max(indices_.size(), size_t(1)) * sizeof(uint16_t);
+    CHECK_GL_ERROR(glBufferData(GL_TEXTURE_BUFFER, bytes, nullptr, GL_STREAM_DRAW));
+    if (!indices_.empty())
+        CHECK_GL_ERROR(glBufferSubData(GL_TEXTURE_BUFFER, 0, indices_.size() * sizeof(uint16_t), indices_.data()));
+    CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+}
+
+void LightClusters::bind() const {
+    for (int k = 0; k < 3; k++) {
+        CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + kTextureUnit + k));
+        CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, textures_[k]));
+    }
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+}
@@ -0,0 +1,116 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "lights.h"
+
+struct ClusterStats {
+    size_t lights = 0;
+    size_t indices = 0;          // light-cluster pairs
+    size_t max_per_cluster = 0;
+    size_t dropped = 0;          // pairs past the buffer texture size
+    double bin_ms = 0.0;
+};
+
+/*
+ * LightClusters: clustered forward shading for point and spot lights, so
+ * the scene can have hundreds of them and a fragment only evaluates the
+ * few near it.
+ *
+ * The view frustum is cut into kTilesX x kTilesY screen tiles and kSlices
+ * depth slices, spaced exponentially from kNear. bin() tests the bounding
+ * sphere of every light (where it falls under 1/256) against the clusters
+ * on the CPU, one depth slice per thread, and upload() puts the result in
+ * three buffer textures, bound by bind() from kTextureUnit on:
+ *      lights: kTexelsPerLight RGBA32F texels per light
+ *      table: RG32UI offset and count of each cluster's indices
+ *      indices: R16UI light indices, cluster after cluster
+ * object.frag built with CLUSTERED (see shader_permutation.h) finds its
+ * cluster from gl_FragCoord and its view depth and loops over those only.
+ * Directional lights stay in the LightBuffer.
+ */
+class LightClusters {
+public:
+    static const int kTilesX = 16;
+    static const int kTilesY = 9;
+    static const int kSlices = 24;
+    static const int kClusters = kTilesX * kTilesY * kSlices;
+    static const int kTexelsPerLight = 6;
+    static const int kMaxLights = 65536;   // the R16UI indices
+    static const int kTextureUnit = 5;     // and the two after it
+    static constexpr float kNear = 0.1f;   // nearer is in the first slice
+
+    static LightClusters& get();
+
+    // Off until the first setLights().
+    bool enabled() const { return enabled_; }
+
+    // The point and spot lights to cluster, at most kMaxLights together.
+    void setLights(const std::vector<PointLight>& pointLights,
+                   const std::vector<SpotLight>& spotLights);
+
+    /*
+     * bin: assign the lights to the clusters of a view. CPU only.
+     *      view, fovy (radians), width, height, far: the camera
+     *      margin, focus: for views whose eye is up to margin away from
+     *              view's and which still look at the point focus ahead
+     *              (the bokeh passes). Re-aiming moves something at depth
+     *              z by about margin * |z / focus - 1|, so every light's
+     *              radius grows by margin * max(1, z / focus). focus <= 0:
+     *              by margin.
+     *      threads: <= 0 means hardware_threads()
+     */
+    void bin(const glm::mat4& view, float fovy, int width, int height,
+             float far, float margin = 0.0f, float focus = 0.0f, int threads = 0);
+
+    // Send the last bin() to the buffer textures. Needs a GL context.
+    void upload();
+    void bind() const;
+
+    // slice = log(view depth) * x - y
+    const glm::vec2& depthParams() const { return depth_params_; }
+    // Pixels per tile of the last bin().
+    const glm::vec2& tileSize() const { return tile_size_; }
+    const ClusterStats& stats() const { return stats_; }
+
+    // The last bin(): offset and count per cluster, then the indices.
+    const std::vector<uint32_t>& table() const { return table_; }
+    const std::vector<uint16_t>& indices() const { return indices_; }
+
+private:
+    LightClusters() {}
+
+    struct Slice {
+        std::vector<uint8_t> hit;
+        std::vector<int> rects;          // x0, x1, y0, y1 per hit light
+        std::vector<uint32_t> offsets;   // per tile, then the total
+        std::vector<uint16_t> indices;
+    };
+    void binSlice(int s, float scale, const glm::vec2& projection);
+
+    bool enabled_ = false;
+    bool lights_dirty_ = false;
+    std::vector<glm::vec4> texels_;
+    std::vector<glm::vec3> positions_;
+    std::vector<float> ranges_;
+
+    // View-space spheres of the current bin(), depth positive.
+    std::vector<float> x_, y_, z_, r_;
+    Slice slices_[kSlices];
+
+    std::vector<uint32_t> table_;
+    std::vector<uint16_t> indices_;
+    size_t max_indices_ = 1 << 20;     // until GL says otherwise
+    glm::vec2 depth_params_ = glm::vec2(0.0f);
+    glm::vec2 tile_size_ = glm::vec2(1.0f);
+    ClusterStats stats_;
+
+    unsigned buffers_[3] = { 0, 0, 0 };
+    unsigned textures_[3] = { 0, 0, 0 };
+};
+
+#endif
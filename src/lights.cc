@@ -1,5 +1,12 @@
 #include "lights.h"
 
+#include <algorithm>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "debuggl.h"
+
 DirectionalLight::DirectionalLight() {
     glm::vec3 v = glm::vec3(0.0f, 0.0f, 0.0f);
     
@@ -24,7 +31,7 @@ void DirectionalLight::setDirection(glm::vec3 direction) {
     this->direction = direction;
 }
 
-glm::vec3 DirectionalLight::getDirection() {
+glm::vec3 DirectionalLight::getDirection() const {
     return this->direction;
 }
     
@@ -32,7 +39,7 @@ void DirectionalLight::setAmbient(glm::vec3 ambient) {
     this->ambient = ambient;
 }
 
-glm::vec3 DirectionalLight::getAmbient() {
+glm::vec3 DirectionalLight::getAmbient() const {
     return this->ambient;
 }
     
@@ -40,7 +47,7 @@ void DirectionalLight::setDiffuse(glm::vec3 diffuse) {
     this->diffuse = diffuse;
 }
 
-glm::vec3 DirectionalLight::getDiffuse() {
+glm::vec3 DirectionalLight::getDiffuse() const {
     return this->diffuse;
 }
     
@@ -48,7 +55,7 @@ void DirectionalLight::setSpecular(glm::vec3 specular) {
     this->specular = specular;
 }
 
-glm::vec3 DirectionalLight::getSpecular() {
+glm::vec3 DirectionalLight::getSpecular() const {
     return this->specular;
 }
 
@@ -83,7 +90,7 @@ void PointLight::setPosition(glm::vec3 position) {
     this->position = position;
 }
 
-glm::vec3 PointLight::getPosition() {
+glm::vec3 PointLight::getPosition() const {
     return this->position;
 }
     
@@ -91,7 +98,7 @@ void PointLight::setAmbient(glm::vec3 ambient) {
     this->ambient = ambient;
 }
 
-glm::vec3 PointLight::getAmbient() {
+glm::vec3 PointLight::getAmbient() const {
     return this->ambient;
 }
     
@@ -99,7 +106,7 @@ void PointLight::setDiffuse(glm::vec3 diffuse) {
     this->diffuse = diffuse;
 }
 
-glm::vec3 PointLight::getDiffuse() {
+glm::vec3 PointLight::getDiffuse() const {
     return this->diffuse;
 }
     
@@ -107,7 +114,7 @@ void PointLight::setSpecular(glm::vec3 specular) {
     this->specular = specular;
 }
 
-glm::vec3 PointLight::getSpecular() {
+glm::vec3 PointLight::getSpecular() const {
     return this->specular;
 }
     
@@ -115,7 +122,7 @@ void PointLight::setConstant(float constant) {
     this->constant = constant;
 }
 
-float PointLight::getConstant() {
+float PointLight::getConstant() const {
     return this->constant;
 }
     
@@ -123,7 +130,7 @@ void PointLight::setLinear(float linear) {
     this->linear = linear;
 }
 
-float PointLight::getLinear() {
+float PointLight::getLinear() const {
     return this->linear;
 }
     
@@ -131,7 +138,7 @@ void PointLight::setQuadratic(float quadratic) {
     this->quadratic = quadratic;
 }
 
-float PointLight::getQuadratic() {
+float PointLight::getQuadratic() const {
     return this->quadratic;
 }
 
@@ -172,7 +179,7 @@ void SpotLight::setPosition(glm::vec3 position) {
     this->position = position;
 }
 
-glm::vec3 SpotLight::getPosition() {
+glm::vec3 SpotLight::getPosition() const {
     return this->position;
 }
     
@@ -180,7 +187,7 @@ void SpotLight::setDirection(glm::vec3 direction) {
     this->direction = direction;
 }
 
-glm::vec3 SpotLight::getDirection() {
+glm::vec3 SpotLight::getDirection() const {
     return this->direction;
 }
     
@@ -188,7 +195,7 @@ void SpotLight::setAmbient(glm::vec3 ambient) {
     this->ambient = ambient;
 }
 
-glm::vec3 SpotLight::getAmbient() {
+glm::vec3 SpotLight::getAmbient() const {
     return this->ambient;
 }
     
@@ -196,7 +203,7 @@ void SpotLight::setDiffuse(glm::vec3 diffuse) {
     this->diffuse = diffuse;
 }
 
-glm::vec3 SpotLight::getDiffuse() {
+glm::vec3 SpotLight::getDiffuse() const {
     return this->diffuse;
 }
     
@@ -204,7 +211,7 @@ void SpotLight::setSpecular(glm::vec3 specular) {
     this->specular = specular;
 }
 
-glm::vec3 SpotLight::getSpecular() {
+glm::vec3 SpotLight::getSpecular() const {
     return this->specular;
 }
     
@@ -212,7 +219,7 @@ void SpotLight::setConstant(float constant) {
     this->constant = constant;
 }
 
-float SpotLight::getConstant() {
+float SpotLight::getConstant() const {
     return this->constant;
 }
     
@@ -220,7 +227,7 @@ void SpotLight::setLinear(float linear) {
     this->linear = linear;
 }
 
-float SpotLight::getLinear() {
+float SpotLight::getLinear() const {
     return this->linear;
 }
     
@@ -228,7 +235,7 @@ void SpotLight::setQuadratic(float quadratic) {
     this->quadratic = quadratic;
 }
 
-float SpotLight::getQuadratic() {
+float SpotLight::getQuadratic() const {
     return this->quadratic;
 }
 
@@ -236,7 +243,7 @@ void SpotLight::setCutOff(float cutOff) {
     this->cutOff = cutOff;
 }
 
-float SpotLight::getCutOff() {
+float SpotLight::getCutOff() const {
     return this->cutOff;
 }
     
@@ -244,6 +251,125 @@ void SpotLight::setOuterCutOff(float outerCutOff) {
     this->outerCutOff = outerCutOff;
 }
 
-float SpotLight::getOuterCutOff() {
+float SpotLight::getOuterCutOff() const {
     return this->outerCutOff;
 }
+
+namespace {
+    // std140 mirrors of the shader structs, see the "Lights" block.
+    struct DirectionalLightStd140 {
+        glm::vec3 direction;
+        float pad0;
+        glm::vec3 ambient;
+        float pad1;
+        glm::vec3 diffuse;
+        float pad2;
+        glm::vec3 specular;
+        float pad3;
+    };
+
+    struct PointLightStd140 {
+        glm::vec3 position;
+        float constant;
+        glm::vec3 ambient;
+        float linear;
+        glm::vec3 diffuse;
+        float quadratic;
+        glm::vec3 specular;
+        float pad;
+    };
+
+    struct SpotLightStd140 {
+        glm::vec3 position;
+        float constant;
+        glm::vec3 direction;
+        float linear;
+        glm::vec3 ambient;
+        float quadratic;
+        glm::vec3 diffuse;
+        float cutOff;
+        glm::vec3 specular;
+        float outerCutOff;
+    };
+
+    struct LightsStd140 {
+        DirectionalLightStd140 directionalLights[LightBuffer::kMaxLights];
+        PointLightStd140 pointLights[LightBuffer::kMaxLights];
+        SpotLightStd140 spotLights[LightBuffer::kMaxLights];
+        int dLights;
+        int pLights;
+        int sLights;
+        int pad;
+    };
+
+    static_assert(sizeof(DirectionalLightStd140) == 64 && sizeof(PointLightStd140) == 64 &&
+                  sizeof(SpotLightStd140) == 80 && sizeof(LightsStd140) == 2096,
+                  "LightsStd140 must match the std140 layout of the Lights block");
+};
+
+LightBuffer& LightBuffer::get() {
+    static LightBuffer buffer;
+    return buffer;
+}
+
+void LightBuffer::setLights(const std::vector<DirectionalLight>& directionalLights,
+                            const std::vector<PointLight>& pointLights,
+                            const std::vector<SpotLight>& spotLights) {
+    LightsStd140 block = {};
+    std::vector<DirectionalLight> fallback;
+    const std::vector<DirectionalLight>* directional = &directionalLights;
+    if (directionalLights.empty() && pointLights.empty() && spotLights.empty()) {
+        fallback.push_back(DirectionalLight(glm::vec3(-1.0f, -1.0f, -1.0f)));
+        directional = &fallback;
+    }
+
+    block.dLights = std::min(int(directional->size()), int(kMaxLights));
+    for (int i = 0; i < block.dLights; i++) {
+        const DirectionalLight& l = (*directional)[i];
+        DirectionalLightStd140& b = block.directionalLights[i];
+        b.direction = l.getDirection();
+        b.ambient = l.getAmbient();
+        b.diffuse = l.getDiffuse();
+        b.specular = l.getSpecular();
+    }
+    block.pLights = std::min(int(pointLights.size()), int(kMaxLights));
+    for (int i = 0; i < block.pLights; i++) {
+        const PointLight& l = pointLights[i];
+        PointLightStd140& b = block.pointLights[i];
+        b.position = l.getPosition();
+        b.ambient = l.getAmbient();
+        b.diffuse = l.getDiffuse();
+        b.specular = l.getSpecular();
+        b.constant = l.getConstant();
+        b.linear = l.getLinear();
+        b.quadratic = l.getQuadratic();
+    }
+    block.sLights = std::min(int(spotLights.size()), int(kMaxLights));
+    for (int i = 0; i < block.sLights; i++) {
+        const SpotLight& l = spotLights[i];
+        SpotLightStd140& b = block.spotLights[i];
+        b.position = l.getPosition();
+        b.direction = l.getDirection();
+        b.ambient = l.getAmbient();
+        b.diffuse = l.getDiffuse();
+        b.specular = l.getSpecular();
+        b.constant = l.getConstant();
+        b.linear = l.getLinear();
+        b.quadratic = l.getQuadratic();
+        b.cutOff = l.getCutOff();
+        b.outerCutOff = l.getOuterCutOff();
+    }
+
+    counts_[0] = block.dLights;
+    counts_[1] = block.pLights;
+    counts_[2] = block.sLights;
+    if (!buffer_) {
+        CHECK_GL_ERROR(glGenBuffers(1, &buffer_));
+        CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, buffer_));
+        CHECK_GL_ERROR(glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_DYNAMIC_DRAW));
+        CHECK_GL_ERROR(glBindBufferBase(GL_UNIFORM_BUFFER, kLightBinding, buffer_));
+        return;
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, buffer_));
+    CHECK_GL_ERROR(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block));
+}
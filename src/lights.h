@@ -11,16 +11,16 @@ public:
     ~DirectionalLight();
     
     void setDirection(glm::vec3 direction);
-    glm::vec3 getDirection();
+    glm::vec3 getDirection() const;
     
     void setAmbient(glm::vec3 ambient);
-    glm::vec3 getAmbient();
+    glm::vec3 getAmbient() const;
     
     void setDiffuse(glm::vec3 diffuse);
-    glm::vec3 getDiffuse();
+    glm::vec3 getDiffuse() const;
     
     void setSpecular(glm::vec3 specular);
-    glm::vec3 getSpecular();
+    glm::vec3 getSpecular() const;
 	
 private:
     glm::vec3 direction;
@@ -36,25 +36,25 @@ public:
     ~PointLight();
     
     void setPosition(glm::vec3 position);
-    glm::vec3 getPosition();
+    glm::vec3 getPosition() const;
     
     void setAmbient(glm::vec3 ambient);
-    glm::vec3 getAmbient();
+    glm::vec3 getAmbient() const;
     
     void setDiffuse(glm::vec3 diffuse);
-    glm::vec3 getDiffuse();
+    glm::vec3 getDiffuse() const;
     
     void setSpecular(glm::vec3 specular);
-    glm::vec3 getSpecular();
+    glm::vec3 getSpecular() const;
     
     void setConstant(float constant);
-    float getConstant();
+    float getConstant() const;
     
     void setLinear(float linear);
-    float getLinear();
+    float getLinear() const;
     
     void setQuadratic(float quadratic);
-    float getQuadratic();
+    float getQuadratic() const;
 	
 private:
     glm::vec3 position;
@@ -73,34 +73,34 @@ public:
     ~SpotLight();
     
     void setPosition(glm::vec3 position);
-    glm::vec3 getPosition();
+    glm::vec3 getPosition() const;
     
     void setDirection(glm::vec3 direction);
-    glm::vec3 getDirection();
+    glm::vec3 getDirection() const;
     
     void setAmbient(glm::vec3 ambient);
-    glm::vec3 getAmbient();
+    glm::vec3 getAmbient() const;
     
     void setDiffuse(glm::vec3 diffuse);
-    glm::vec3 getDiffuse();
+    glm::vec3 getDiffuse() const;
     
     void setSpecular(glm::vec3 specular);
-    glm::vec3 getSpecular();
+    glm::vec3 getSpecular() const;
     
     void setConstant(float constant);
-    float getConstant();
+    float getConstant() const;
     
     void setLinear(float linear);
-    float getLinear();
+    float getLinear() const;
     
     void setQuadratic(float quadratic);
-    float getQuadratic();
+    float getQuadratic() const;
     
     void setCutOff(float cutOff);
-    float getCutOff();
+    float getCutOff() const;
     
     void setOuterCutOff(float outerCutOff);
-    float getOuterCutOff();
+    float getOuterCutOff() const;
 	
 private:
     glm::vec3 position;
@@ -115,4 +115,36 @@ private:
     float outerCutOff;
 };
 
+/*
+ * LightBuffer: the scene's lights in one std140 uniform buffer, bound at
+ * kLightBinding for the "Lights" block of default.frag, object.frag and
+ * menger_sdf.frag. RenderPass points every program that has the block at
+ * that binding, so all of them share the one copy and changing the
+ * lights is a single glBufferSubData.
+ */
+class LightBuffer {
+public:
+    static const int kMaxLights = 10; // per kind, the shaders' array size
+    static const unsigned kLightBinding = 0;
+
+    static LightBuffer& get();
+
+    // Upload the lights, at most kMaxLights of each kind. With none at all
+    // a default directional light is used. Needs a GL context.
+    void setLights(const std::vector<DirectionalLight>& directionalLights,
+                   const std::vector<PointLight>& pointLights,
+                   const std::vector<SpotLight>& spotLights);
+
+    // How many of each kind the last setLights() uploaded, -1 before the
+    // first. Shader permutations bake these in, see shader_permutation.h.
+    int directionalCount() const { return counts_[0]; }
+    int pointCount() const { return counts_[1]; }
+    int spotCount() const { return counts_[2]; }
+
+private:
+    LightBuffer() {}
+    unsigned buffer_ = 0;
+    int counts_[3] = { -1, -1, -1 };
+};
+
 #endif
@@ -12,6 +12,21 @@ Loader::~Loader() {
 };
 
 void Loader::loadObj(const char* path, std::vector<Mesh>& meshes, std::vector<Material>& materials) {
+    // Whatever lens_cook wrote. Only a missing or stale cache falls through
+    // to the write below, a valid one of either setting is never replaced.
+    if (readMeshCache(path, meshes))
+        return;
+
+    std::vector<Mesh> imported;
+    if (!parseObj(path, imported) && !importObj(path, imported, materials))
+        return;
+    processMeshes(imported);
+    writeMeshCache(path, imported);
+    for (Mesh& m : imported)
+        meshes.push_back(std::move(m));
+}
+
+bool Loader::importObj(const char* path, std::vector<Mesh>& meshes, std::vector<Material>& materials) {
             
     Assimp::Importer importer;
 
@@ -19,7 +34,7 @@ void Loader::loadObj(const char* path, std::vector<Mesh>& meshes, std::vector<Ma
 	if (!scene) {
 		fprintf(stderr, importer.GetErrorString());
 		getchar();
-		return;
+		return false;
 	}
     
     if (scene->HasAnimations()) {
@@ -49,6 +64,7 @@ void Loader::loadObj(const char* path, std::vector<Mesh>& meshes, std::vector<Ma
     if (scene->HasTextures()) {
         printf("Loader::loadObj(): warning scene contains unsupported textures!\n");
     } 
+    return true;
 };
 
 void Loader::getMeshes(const aiScene* scene, std::vector<Mesh>& meshes) {
@@ -176,12 +192,63 @@ void Loader::getMaterial(const char* path, const aiMaterial* material, std::vect
     materials.push_back(m);
 }
 
-unsigned int Loader::loadTexture(char const* path) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+namespace {
+    // Copy size bytes into a new pixel unpack buffer left bound, and return
+    // what to pass as the pixel pointer: an offset into it, or data itself
+    // if the buffer can't be mapped (pbo is then 0).
+    const void* stageUnpack(const void* data, size_t size, unsigned int& pbo) {
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &pbo);
+            pbo = 0;
+            return data;
+        }
+        memcpy(mapped, data, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        return nullptr;
+    }
+
+    void releaseUnpack(unsigned int pbo) {
+        if (!pbo)
+            return;
+        // The driver keeps it alive until the copy is done.
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+    }
+};
+
+unsigned int Loader::loadTexture(char const* path, size_t* bytes) {
+    // Block-compressed mips if cooked, otherwise decode and cook them now.
+    CookedTexture cooked;
+    if (readTexture(path, cooked))
+        return createTexture(cooked, bytes);
 
     int width, height, nrComponents;
     unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
+    if (!data)
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+    unsigned int textureID;
+    if (compressTexture(data, width, height, nrComponents, cooked)) {
+        writeCookedTexture(path, cooked);
+        textureID = createTexture(cooked, bytes);
+    } else {
+        textureID = createTexture(data, width, height, nrComponents, bytes);
+    }
+    stbi_image_free(data);
+    return textureID;
+}
+
+unsigned int Loader::createTexture(const unsigned char* data, int width, int height, int nrComponents, size_t* bytes, bool unpack_buffer) {
+    if (bytes)
+        *bytes = 0;
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
     if (data)
     {
         GLenum format;
@@ -193,7 +260,17 @@ unsigned int Loader::loadTexture(char const* path) {
             format = GL_RGBA;
 
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        unsigned int pbo = 0;
+        const void* pixels = data;
+        if (unpack_buffer)
+            pixels = stageUnpack(data, size_t(width) * height * nrComponents, pbo);
+        // stb_image rows are tightly packed; with the default alignment of
+        // 4, RGB and RED rows that aren't a multiple of 4 bytes would be
+        // read past the end of the data (or the unpack buffer, an error).
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        releaseUnpack(pbo);
         glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -201,14 +278,69 @@ unsigned int Loader::loadTexture(char const* path) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        stbi_image_free(data);
+        if (bytes)
+            *bytes = size_t(width) * height * nrComponents * 4 / 3;
     }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+
+    return textureID;
+}
+
+unsigned int Loader::createTexture(const CookedTexture& texture, size_t* bytes, bool unpack_buffer) {
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    GLenum format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    if (texture.format == kTextureBC2)
+        format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+    else if (texture.format == kTextureBC3)
+        format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    GLenum layout = texture.format == kTextureBGRA8 ? GL_BGRA : GL_RGBA;
+
+    // All levels in one unpack buffer, each upload reads its own range.
+    std::vector<unsigned char> all;
+    if (unpack_buffer) {
+        all.reserve(texture.bytes());
+        for (const TextureLevel& level : texture.levels)
+            all.insert(all.end(), level.data.begin(), level.data.end());
+    }
+    unsigned int pbo = 0;
+    const unsigned char* base = nullptr;
+    if (unpack_buffer)
+        base = (const unsigned char*)stageUnpack(all.data(), all.size(), pbo);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < texture.levels.size(); i++) {
+        const TextureLevel& level = texture.levels[i];
+        const void* pixels = unpack_buffer ? (const void*)(base + offset) : (const void*)level.data.data();
+        if (texture.compressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), format, level.width, level.height, 0,
+                GLsizei(level.data.size()), pixels);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, GLint(i), GL_RGBA8, level.width, level.height, 0,
+                layout, GL_UNSIGNED_BYTE, pixels);
+        }
+        offset += level.data.size();
     }
+    releaseUnpack(pbo);
 
+    // Compressed levels can't be mipmapped by GL, files without a chain are
+    // drawn from the top level only.
+    size_t levels = texture.levels.size();
+    bool generate = levels == 1 && !texture.compressed();
+    if (generate)
+        glGenerateMipmap(GL_TEXTURE_2D);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels - 1));
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+        levels > 1 || generate ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (bytes)
+        *bytes = generate ? texture.bytes() * 4 / 3 : texture.bytes();
     return textureID;
 }
 
@@ -221,3 +353,6 @@ unsigned char* loadImg(std::string path, int& width, int& height, int& nrChannel
     return data;
 }
 
+void freeImg(unsigned char* data) {
+    stbi_image_free(data);
+}
@@ -24,18 +24,37 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+#include "texture_cache.h"
 #include "material.h"
 #include "filesystem.h"
 
 unsigned char* loadImg(std::string path, int& width, int& height, int& nrChannels);
+void freeImg(unsigned char* data);
 
 class Loader {
 public:
     Loader();
     ~Loader();
     
-    void loadObj(const char* path, std::vector<Mesh>& meshes, std::vector<Material>& materials);      
-    unsigned int loadTexture(char const* path);
+    // Uses the binary mesh cache next to path when it is valid, otherwise
+    // parses with parseObj (importObj if that fails, e.g. not an OBJ), runs
+    // processMeshes and writes the cache.
+    void loadObj(const char* path, std::vector<Mesh>& meshes, std::vector<Material>& materials);
+    // Always parses with Assimp, no cache involved.
+    bool importObj(const char* path, std::vector<Mesh>& meshes, std::vector<Material>& materials);
+    // Uploads the cooked texture next to path when it is valid (or path
+    // itself if it is a .dds), otherwise decodes with stb_image and cooks.
+    // bytes: if given, receives the approximate GPU size including mipmaps.
+    unsigned int loadTexture(char const* path, size_t* bytes = nullptr);
+    // GL half of loadTexture, for images decoded elsewhere (e.g. loadImg
+    // on a worker thread). data may be null, giving an empty texture.
+    // unpack_buffer: stage the pixels through a pixel unpack buffer.
+    unsigned int createTexture(const unsigned char* data, int width, int height, int nrComponents, size_t* bytes = nullptr, bool unpack_buffer = false);
+    // Uploads every level as is, with glCompressedTexImage2D if compressed.
+    unsigned int createTexture(const CookedTexture& texture, size_t* bytes = nullptr, bool unpack_buffer = false);
     
 private:
     void getMeshes(const aiScene* scene, std::vector<Mesh>& meshes);  
@@ -19,10 +19,14 @@
 // Classes
 #include "floor.h"
 #include "menger.h"
+#include "menger_renderer.h"
 #include "camera.h"
 #include "controller.h"
 #include "render_pass.h"
 #include "lights.h"
+#include "light_clusters.h"
+#include "deferred_renderer.h"
+#include "shader_permutation.h"
 #include "filesystem.h"
 
 #include "loader.h"
@@ -30,11 +34,13 @@
 #include "material.h"
 #include "filesystem.h"
 #include "object.h"
+#include "upload_thread.h"
 
 # define M_PI           3.14159265358979323846  /* pi */
 
 //gui
 #include "gui.h"
+#include "bench.h"
 
 // game state variables:
 // ====================
@@ -52,6 +58,8 @@ float aperture = 0.05;
 float exposure = 0.8f;
 bool showMeshes = true;
 bool lensEffects = true;
+// Light the scene through deferred_renderer.h instead of object.frag
+bool deferredShading = false;
 bool captureImage = false;
 // ====================
 
@@ -117,6 +125,18 @@ const char* fragment_shader =
 #include "shaders/default.frag"
 ;
 
+const char* menger_instanced_vertex_shader =
+#include "shaders/menger_instanced.vert"
+;
+
+const char* menger_sdf_vertex_shader =
+#include "shaders/menger_sdf.vert"
+;
+
+const char* menger_sdf_fragment_shader =
+#include "shaders/menger_sdf.frag"
+;
+
 const char* floor_fragment_shader =
 #include "shaders/floor.frag"
 ;
@@ -189,6 +209,33 @@ printVec4(const char* name, glm::vec4 data)
 
 int main(int argc, char* argv[])
 {
+	if (argc > 2 && std::string(argv[1]) == "--bench")
+		return run_benchmark(argv[2]);
+	bool raymarch_menger = false;
+	int stress_lights = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--raymarch") {
+			// Draw the Menger from its distance field, levels up to 10.
+			raymarch_menger = true;
+		} else if (arg == "--unpacked") {
+			// Upload meshes as floats instead of the packed format.
+			AssetRegistry::get().packMeshes(false);
+		} else if (arg == "--no-program-cache") {
+			// Build every program from source, for timing a cold start.
+			RenderPass::useProgramBinaries(false);
+		} else if (arg == "--deferred") {
+			// Start with deferred shading, 5 toggles it.
+			deferredShading = true;
+		} else if (arg == "--stress-lights" && i + 1 < argc) {
+			// N more small point lights over the scene, for timing the
+			// clustered lighting.
+			stress_lights = std::max(atoi(argv[++i]), 0);
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+		}
+	}
+
 	std::string window_title = "LENSTIME";
 	if (!glfwInit()) exit(EXIT_FAILURE);
 
@@ -212,7 +259,7 @@ int main(int argc, char* argv[])
 	glewExperimental = GL_TRUE;
 
 	// Controller
-	g_controller = new Controller(window, g_camera, g_menger, &exposure, &showMeshes, &lensEffects, &captureImage);
+	g_controller = new Controller(window, g_camera, g_menger, &exposure, &showMeshes, &lensEffects, &deferredShading, &captureImage);
 
 	// Setup GUI
 	BasicGUI* gui = new BasicGUI(window, &score, &object_goal);
@@ -228,6 +275,9 @@ int main(int argc, char* argv[])
 
 	glEnable(GL_CULL_FACE); // Added to see faces are correct.
 
+	// Scene assets stream in on this while the first frames are drawn.
+	UploadThread* uploader = new UploadThread(window);
+
 	// <<<Lights>>>
 	std::vector<DirectionalLight> directionalLights;
 	DirectionalLight directionalLight = DirectionalLight(glm::vec3(-1.0f, -1.0f, -1.0f));
@@ -242,6 +292,8 @@ int main(int argc, char* argv[])
 	std::vector<SpotLight> spotLights;
 	SpotLight spotLight = SpotLight(glm::vec3(12.0f, 20.0f, 0.0f), glm::vec3(-1.0f, -1.0f, 0.0f));
 	spotLights.push_back(spotLight);
+	// One uniform buffer every lit program reads.
+	LightBuffer::get().setLights(directionalLights, pointLights, spotLights);
 	// <<<Lights>>>
 
 	// <<<Renderpass Setup>>>
@@ -312,26 +364,25 @@ int main(int argc, char* argv[])
 	ShaderUniform std_view_position = { "view_position", vector_binder, std_view_position_data };
 	// <<<RenderPass Setup>>>
 
-    // <<<Menger Data>>>
-    std::vector<glm::vec4> menger_vertices;
-    std::vector<glm::vec4> menger_normals;
-    std::vector<glm::uvec3> menger_faces;
-
+    // <<<Menger Renderpass>>>
     glm::vec4 menger_pos = glm::vec4(0.0f, 25.0f, 10.0f, 1.0f);
 
-	g_menger->set_nesting_level(1);
-	g_menger->generate_geometry(menger_vertices, menger_normals, menger_faces, menger_pos);
-	g_menger->set_clean();
-
-	glm::vec4 min_bounds = glm::vec4(std::numeric_limits<float>::max());
-	glm::vec4 max_bounds = glm::vec4(-std::numeric_limits<float>::max());
-	for (int i = 0; i < menger_vertices.size(); ++i) {
-		min_bounds = glm::min(menger_vertices[i], min_bounds);
-		max_bounds = glm::max(menger_vertices[i], max_bounds);
+	const char* menger_vs = menger_instanced_vertex_shader;
+	// default.frag with the light loops unrolled for the scene's lights.
+	const char* menger_fs = permuteShader(fragment_shader, ShaderPermutation::currentLights());
+	g_menger->set_mode(Menger::kInstanced);
+	if (raymarch_menger) {
+		g_menger->set_mode(Menger::kRaymarched);
+		menger_vs = menger_sdf_vertex_shader;
+		menger_fs = menger_sdf_fragment_shader;
 	}
-	std::cout << "min_bounds = " << glm::to_string(min_bounds) << "\n";
-	std::cout << "max_bounds = " << glm::to_string(max_bounds) << "\n";
-	// <<<Menger Data>>>
+	g_menger->set_nesting_level(1);
+	MengerRenderer menger_renderer(g_menger, menger_pos);
+	menger_renderer.setup(menger_vs, menger_fs,
+			{ menger_model, std_view, std_proj, std_light, std_view_position },
+			glm::vec4(5.0f, 1.5f, 1.5f, 1.0f));
+	gui->mengerStats(&menger_renderer.stats());
+	// <<<Menger Renderpass>>>
 
     // <<<Floor Data>>>
     std::vector<glm::vec4> floor_vertices;
@@ -345,6 +396,7 @@ int main(int argc, char* argv[])
 	RenderDataInput floor_pass_input;
 	floor_pass_input.assign(0, "vertex_position", floor_vertices.data(), floor_vertices.size(), 4, GL_FLOAT);
 	floor_pass_input.assign(1, "normal", floor_normals.data(), floor_normals.size(), 4, GL_FLOAT);
+	floor_pass_input.interleave();
 	floor_pass_input.assign_index(floor_faces.data(), floor_faces.size(), 3);
 	RenderPass floor_pass(-1,
 			floor_pass_input,
@@ -355,6 +407,10 @@ int main(int argc, char* argv[])
     // <<<Floor Renderpass>>>
 
     // <<<Scene>>>
+    // Objects only record their files here, Object::setupAll loads them all
+    // at once below.
+    std::vector<Object*> scene_objects;
+
     // <<<Cone>>>
     Object* cone = new Object("Christmas Tree");
     cone->load("/src/assets/primitives/cone.obj");
@@ -373,10 +429,9 @@ int main(int argc, char* argv[])
 
     cone->shaders(object_vertex_shader, NULL, object_fragment_shader);
     cone->uniforms(cone_model, std_view, std_proj, std_light, std_view_position);
-    cone->lights(directionalLights, pointLights, spotLights);
     cone->textures("/src/assets/textures/grass.png", "/src/assets/textures/wall_s.jpg");
 
-    cone->setup();
+    scene_objects.push_back(cone);
 
 	photo_objects.push_back(cone);
     // <<<Cone>>>
@@ -399,11 +454,10 @@ int main(int argc, char* argv[])
 
     sphere->shaders(object_vertex_shader, NULL, object_fragment_shader);
     sphere->uniforms(sphere_model, std_view, std_proj, std_light, std_view_position);
-    sphere->lights(directionalLights, pointLights, spotLights);
     sphere->lightColor(glm::vec4(1.9f, 1.9f, 1.9f, 1.0f));
     sphere->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-    sphere->setup();
+    scene_objects.push_back(sphere);
 
 	photo_objects.push_back(sphere);
     // <<<Sphere>>>
@@ -426,10 +480,9 @@ int main(int argc, char* argv[])
 
     sphere2->shaders(object_vertex_shader, NULL, object_fragment_shader);
     sphere2->uniforms(sphere2_model, std_view, std_proj, std_light, std_view_position);
-    sphere2->lights(directionalLights, pointLights, spotLights);
     sphere2->textures("/src/assets/textures/wood2.png", "/src/assets/textures/wood_s.jpg");
 
-    sphere2->setup();
+    scene_objects.push_back(sphere2);
     // <<<Sphere2>>>
 
 		// <<<TreeLight>>>
@@ -450,11 +503,10 @@ int main(int argc, char* argv[])
 
 		treelight->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight->uniforms(treelight_model, std_view, std_proj, std_light, std_view_position);
-		treelight->lights(directionalLights, pointLights, spotLights);
 		treelight->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight->setup();
+		scene_objects.push_back(treelight);
 		// <<<TreeLight>>>
 
 		// <<<TreeLight2>>>
@@ -475,11 +527,10 @@ int main(int argc, char* argv[])
 
 		treelight2->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight2->uniforms(treelight2_model, std_view, std_proj, std_light, std_view_position);
-		treelight2->lights(directionalLights, pointLights, spotLights);
 		treelight2->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight2->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight2->setup();
+		scene_objects.push_back(treelight2);
 		// <<<TreeLight2>>>
 
 		// <<<TreeLight3>>>
@@ -500,11 +551,10 @@ int main(int argc, char* argv[])
 
 		treelight3->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight3->uniforms(treelight3_model, std_view, std_proj, std_light, std_view_position);
-		treelight3->lights(directionalLights, pointLights, spotLights);
 		treelight3->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight3->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight3->setup();
+		scene_objects.push_back(treelight3);
 		// <<<TreeLight3>>>
 
 		// <<<TreeLight4>>>
@@ -525,11 +575,10 @@ int main(int argc, char* argv[])
 
 		treelight4->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight4->uniforms(treelight4_model, std_view, std_proj, std_light, std_view_position);
-		treelight4->lights(directionalLights, pointLights, spotLights);
 		treelight4->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight4->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight4->setup();
+		scene_objects.push_back(treelight4);
 		// <<<TreeLight4>>>
 
 		// <<<TreeLight5>>>
@@ -550,11 +599,10 @@ int main(int argc, char* argv[])
 
 		treelight5->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight5->uniforms(treelight5_model, std_view, std_proj, std_light, std_view_position);
-		treelight5->lights(directionalLights, pointLights, spotLights);
 		treelight5->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight5->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight5->setup();
+		scene_objects.push_back(treelight5);
 		// <<<TreeLight5>>>
 
 		// <<<TreeLight6>>>
@@ -575,11 +623,10 @@ int main(int argc, char* argv[])
 
 		treelight6->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight6->uniforms(treelight6_model, std_view, std_proj, std_light, std_view_position);
-		treelight6->lights(directionalLights, pointLights, spotLights);
 		treelight6->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight6->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight6->setup();
+		scene_objects.push_back(treelight6);
 		// <<<TreeLight6>>>
 
 		// <<<TreeLight7>>>
@@ -600,11 +647,10 @@ int main(int argc, char* argv[])
 
 		treelight7->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight7->uniforms(treelight7_model, std_view, std_proj, std_light, std_view_position);
-		treelight7->lights(directionalLights, pointLights, spotLights);
 		treelight7->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight7->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight7->setup();
+		scene_objects.push_back(treelight7);
 		// <<<TreeLight7>>>
 
 		// <<<TreeLight8>>>
@@ -625,11 +671,10 @@ int main(int argc, char* argv[])
 
 		treelight8->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight8->uniforms(treelight8_model, std_view, std_proj, std_light, std_view_position);
-		treelight8->lights(directionalLights, pointLights, spotLights);
 		treelight8->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight8->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight8->setup();
+		scene_objects.push_back(treelight8);
 		// <<<TreeLight8>>>
 
 		// <<<TreeLight9>>>
@@ -650,11 +695,10 @@ int main(int argc, char* argv[])
 
 		treelight9->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight9->uniforms(treelight9_model, std_view, std_proj, std_light, std_view_position);
-		treelight9->lights(directionalLights, pointLights, spotLights);
 		treelight9->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight9->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight9->setup();
+		scene_objects.push_back(treelight9);
 		// <<<TreeLight9>>>
 
 		// <<<TreeLight10>>>
@@ -675,11 +719,10 @@ int main(int argc, char* argv[])
 
 		treelight10->shaders(object_vertex_shader, NULL, object_fragment_shader);
 		treelight10->uniforms(treelight10_model, std_view, std_proj, std_light, std_view_position);
-		treelight10->lights(directionalLights, pointLights, spotLights);
 		treelight10->lightColor(glm::vec4(1.0f, 1.0f, 1.5f, 1.0f));
 		treelight10->textures("/src/assets/textures/gold.jpg", "/src/assets/textures/wall_s.jpg");
 
-		treelight10->setup();
+		scene_objects.push_back(treelight10);
 		// <<<TreeLight10>>>
 
     // <<<Cylinder>>>
@@ -700,10 +743,9 @@ int main(int argc, char* argv[])
 
     cylinder->shaders(object_vertex_shader, NULL, object_fragment_shader);
     cylinder->uniforms(cylinder_model, std_view, std_proj, std_light, std_view_position);
-    cylinder->lights(directionalLights, pointLights, spotLights);
     cylinder->textures("/src/assets/textures/wood.jpg", "/src/assets/textures/wood_s.jpg");
 
-    cylinder->setup();
+    scene_objects.push_back(cylinder);
     // <<<Cylinder>>>
 
     // <<<Torus>>>
@@ -724,10 +766,9 @@ int main(int argc, char* argv[])
 
     torus->shaders(object_vertex_shader, NULL, object_fragment_shader);
     torus->uniforms(torus_model, std_view, std_proj, std_light, std_view_position);
-    torus->lights(directionalLights, pointLights, spotLights);
     torus->textures("/src/assets/textures/metal2.jpg", "/src/assets/textures/metal2_s.jpg");
 
-    torus->setup();
+    scene_objects.push_back(torus);
 	photo_objects.push_back(torus);
     // <<<Torus>>>
 
@@ -749,11 +790,10 @@ int main(int argc, char* argv[])
 
     monkey->shaders(object_vertex_shader, NULL, object_fragment_shader);
     monkey->uniforms(monkey_model, std_view, std_proj, std_light, std_view_position);
-    monkey->lights(directionalLights, pointLights, spotLights);
     monkey->lightColor(glm::vec4(1.1f, 1.1f, 1.5f, 1.0f));
     monkey->textures("/src/assets/textures/black.jpg", "/src/assets/textures/wall_s.jpg");
 
-    monkey->setup();
+    scene_objects.push_back(monkey);
     // <<<Monkey>>>
 
     // <<<Cat>>>
@@ -774,10 +814,9 @@ int main(int argc, char* argv[])
 
     cat->shaders(object_vertex_shader, NULL, object_fragment_shader);
     cat->uniforms(cat_model, std_view, std_proj, std_light, std_view_position);
-    cat->lights(directionalLights, pointLights, spotLights);
     cat->textures("/src/assets/textures/wood3.png", "/src/assets/textures/wall_s.jpg");
 
-    cat->setup();
+    scene_objects.push_back(cat);
 	photo_objects.push_back(cat);
     // <<<Cat>>>
 
@@ -799,10 +838,9 @@ int main(int argc, char* argv[])
 
     dog->shaders(object_vertex_shader, NULL, object_fragment_shader);
     dog->uniforms(dog_model, std_view, std_proj, std_light, std_view_position);
-    dog->lights(directionalLights, pointLights, spotLights);
     dog->textures("/src/assets/animals/dog/Dog_diffuse.jpg", "/src/assets/textures/wall_s.jpg");
 
-    dog->setup();
+    scene_objects.push_back(dog);
 	photo_objects.push_back(dog);
     // <<<Dog>>>
 
@@ -824,10 +862,9 @@ int main(int argc, char* argv[])
 
     deer->shaders(object_vertex_shader, NULL, object_fragment_shader);
     deer->uniforms(deer_model, std_view, std_proj, std_light, std_view_position);
-    deer->lights(directionalLights, pointLights, spotLights);
     deer->textures("/src/assets/textures/metal.jpg", "/src/assets/textures/metal_s.jpg");
 
-    deer->setup();
+    scene_objects.push_back(deer);
 	photo_objects.push_back(deer);
     // <<<Deer>>>
 
@@ -849,10 +886,9 @@ int main(int argc, char* argv[])
 
     building->shaders(object_vertex_shader, NULL, object_fragment_shader);
     building->uniforms(building_model, std_view, std_proj, std_light, std_view_position);
-    building->lights(directionalLights, pointLights, spotLights);
     building->textures("/src/assets/textures/concrete.png", "/src/assets/textures/wall_s.jpg");
 
-    building->setup();
+    scene_objects.push_back(building);
     // <<<Building>>>
 
     // <<<Grass>>>
@@ -873,10 +909,9 @@ int main(int argc, char* argv[])
 
     grass->shaders(object_vertex_shader, NULL, object_fragment_shader);
     grass->uniforms(grass_model, std_view, std_proj, std_light, std_view_position);
-    grass->lights(directionalLights, pointLights, spotLights);
     grass->textures("/src/assets/textures/grass.png", "/src/assets/textures/wall_s.jpg");
 
-    grass->setup();
+    scene_objects.push_back(grass);
 	photo_objects.push_back(grass);
     // <<<Grass>>>
 
@@ -898,10 +933,9 @@ int main(int argc, char* argv[])
 
     wall->shaders(object_vertex_shader, NULL, object_fragment_shader);
     wall->uniforms(wall_model, std_view, std_proj, std_light, std_view_position);
-    wall->lights(directionalLights, pointLights, spotLights);
     wall->textures("/src/assets/textures/wall.png", "/src/assets/textures/wall_s.jpg");
 
-    wall->setup();
+    scene_objects.push_back(wall);
     // <<<Wall>>>
 
     // <<<Wall2>>>
@@ -922,10 +956,9 @@ int main(int argc, char* argv[])
 
     wall2->shaders(object_vertex_shader, NULL, object_fragment_shader);
     wall2->uniforms(wall2_model, std_view, std_proj, std_light, std_view_position);
-    wall2->lights(directionalLights, pointLights, spotLights);
     wall2->textures("/src/assets/textures/wall.png", "/src/assets/textures/wall_s.jpg");
 
-    wall2->setup();
+    scene_objects.push_back(wall2);
     // <<<Wall2>>>
 
     // <<<Wall3>>>
@@ -946,10 +979,9 @@ int main(int argc, char* argv[])
 
     wall3->shaders(object_vertex_shader, NULL, object_fragment_shader);
     wall3->uniforms(wall3_model, std_view, std_proj, std_light, std_view_position);
-    wall3->lights(directionalLights, pointLights, spotLights);
     wall3->textures("/src/assets/textures/wall.png", "/src/assets/textures/wall_s.jpg");
 
-    wall3->setup();
+    scene_objects.push_back(wall3);
     // <<<Wall3>>>
 
     // <<<Wall4>>>
@@ -970,11 +1002,46 @@ int main(int argc, char* argv[])
 
     wall4->shaders(object_vertex_shader, NULL, object_fragment_shader);
     wall4->uniforms(wall4_model, std_view, std_proj, std_light, std_view_position);
-    wall4->lights(directionalLights, pointLights, spotLights);
     wall4->textures("/src/assets/textures/wall.png", "/src/assets/textures/wall_s.jpg");
 
-    wall4->setup();
+    scene_objects.push_back(wall4);
     // <<<Wall4>>>
+
+	// Every tree light is a real light too. The objects draw the point and
+	// spot lights from their view clusters (light_clusters.h), so this has
+	// to come before their setup.
+	std::vector<PointLight> clustered_lights = pointLights;
+	for (const glm::mat4* m : { &treelight_model_matrix, &treelight2_model_matrix, &treelight3_model_matrix,
+			&treelight4_model_matrix, &treelight5_model_matrix, &treelight6_model_matrix,
+			&treelight7_model_matrix, &treelight8_model_matrix, &treelight9_model_matrix,
+			&treelight10_model_matrix }) {
+		PointLight light = PointLight(glm::vec3((*m)[3]));
+		light.setAmbient(glm::vec3(0.0f));
+		light.setDiffuse(glm::vec3(1.0f, 1.0f, 1.5f));
+		light.setSpecular(glm::vec3(1.0f, 1.0f, 1.5f));
+		light.setLinear(0.7f);
+		light.setQuadratic(1.8f);
+		clustered_lights.push_back(light);
+	}
+	std::mt19937 light_random(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int i = 0; i < stress_lights; i++) {
+		PointLight light(glm::vec3(-40.0f + 80.0f * unit(light_random),
+		                           -1.5f + 9.5f * unit(light_random),
+		                           -40.0f + 80.0f * unit(light_random)));
+		glm::vec3 color = 0.5f * glm::vec3(unit(light_random), unit(light_random), unit(light_random));
+		light.setAmbient(glm::vec3(0.0f));
+		light.setDiffuse(color);
+		light.setSpecular(color);
+		light.setLinear(0.7f);
+		light.setQuadratic(4.0f);
+		clustered_lights.push_back(light);
+	}
+	LightClusters& light_clusters = LightClusters::get();
+	light_clusters.setLights(clustered_lights, spotLights);
+	gui->clusterStats(&light_clusters.stats());
+
+    Object::setupAll(scene_objects, uploader);
     // <<<Scene>>>
 
 	float theta = 0.0f;
@@ -1003,78 +1070,62 @@ int main(int argc, char* argv[])
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
 
 	// Create basic quad program
-	// Setup vertex shader for the quad.
-	GLuint screen_vertex_shader_id = 0;
-	const char* screen_vertex_source_pointer = screen_vertex_shader;
-	CHECK_GL_ERROR(screen_vertex_shader_id = glCreateShader(GL_VERTEX_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_vertex_shader_id, 1, &screen_vertex_source_pointer, nullptr));
-	glCompileShader(screen_vertex_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_vertex_shader_id);
-
-	// Setup default fragment shader for the quad ====================
-	GLuint screen_fragment_shader_id = 0;
-	const char* screen_fragment_source_pointer = screen_fragment_shader;
-	CHECK_GL_ERROR(screen_fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_fragment_shader_id, 1,
-				&screen_fragment_source_pointer, nullptr));
-	glCompileShader(screen_fragment_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_fragment_shader_id);
+	// Every screen program shares screen_vertex_shader and its attributes.
+	// RenderPass::program compiles and links them, or loads the program
+	// binary saved by an earlier run. All of them are submitted before the
+	// first uniform lookup waits for one, so the driver builds them together
+	// with the scene's programs.
+	const std::vector<std::pair<int, std::string>> screen_attributes = {
+		{ 0, "vertex_position" },
+		{ 1, "aTexCoords" },
+	};
 
-	// Setup the program
-	GLuint screen_default_program_id = 0;
-  CHECK_GL_ERROR(screen_default_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_default_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_default_program_id, screen_fragment_shader_id));
+	GLuint screen_default_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_fragment_shader },
+			screen_attributes, { "fragment_color" });
+	GLuint screen_single_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_fragment_shader },
+			screen_attributes, { "fragment_color" });
+	GLuint screen_hdr_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_hdr_shader },
+			screen_attributes, { "fragment_color" });
+	GLuint screen_brightness_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_brightness_shader },
+			screen_attributes, { "fragment_color", "bright_color" });
+	GLuint screen_downsample_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_downsample_shader },
+			screen_attributes, { "fragment_color" });
+	GLuint screen_lensflare_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_lensflare_shader },
+			screen_attributes, { "fragment_color" });
+	GLuint screen_blur_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_blur_shader },
+			screen_attributes, { "fragment_color" });
+	GLuint screen_blur2_program_id = RenderPass::program({ screen_vertex_shader, nullptr, screen_blur2_shader },
+			screen_attributes, { "fragment_color" });
 
+	// Setup default fragment shader for the quad ====================
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_default_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_default_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_default_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_default_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_default_program_id);
-
 	CHECK_GL_ERROR(glUseProgram(screen_default_program_id));
 	// Get the uniform locations.
 	GLint screen_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_projection_matrix_location =
-			glGetUniformLocation(screen_default_program_id, "screenTexture"));
+			RenderPass::uniformLocation(screen_default_program_id, "screenTexture"));
 	glUniform1i(screen_projection_matrix_location, 0);
 
 	GLint screen_effect_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_effect_projection_matrix_location =
-			glGetUniformLocation(screen_default_program_id, "lensEffect"));
+			RenderPass::uniformLocation(screen_default_program_id, "lensEffect"));
 	glUniform1i(screen_effect_projection_matrix_location, 1);
 
 	GLint screen_effect2_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_effect2_projection_matrix_location =
-			glGetUniformLocation(screen_default_program_id, "lensEffect2"));
+			RenderPass::uniformLocation(screen_default_program_id, "lensEffect2"));
 	glUniform1i(screen_effect2_projection_matrix_location, 2);
 	// ===========================================================
 
 	// Setup the program
-	GLuint screen_single_program_id = 0;
-  CHECK_GL_ERROR(screen_single_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_single_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_single_program_id, screen_fragment_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_single_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_single_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_single_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_single_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_single_program_id);
-
 	CHECK_GL_ERROR(glUseProgram(screen_single_program_id));
 	// Get the uniform locations.
 	GLint screen_texture_matrix_location = 0;
 	CHECK_GL_ERROR(screen_texture_matrix_location =
-			glGetUniformLocation(screen_single_program_id, "screenTexture"));
+			RenderPass::uniformLocation(screen_single_program_id, "screenTexture"));
 	glUniform1i(screen_texture_matrix_location, 0);
 	// ===========================================================
 
@@ -1104,37 +1155,19 @@ int main(int argc, char* argv[])
 	}
 
   // Setup hdr fragment shader for the quad ====================
-	GLuint screen_hdr_shader_id = 0;
-	const char* screen_hdr_source_pointer = screen_hdr_shader;
-	CHECK_GL_ERROR(screen_hdr_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_hdr_shader_id, 1,
-				&screen_hdr_source_pointer, nullptr));
-	glCompileShader(screen_hdr_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_hdr_shader_id);
-
-	// Setup the program
-	GLuint screen_hdr_program_id = 0;
-	CHECK_GL_ERROR(screen_hdr_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_hdr_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_hdr_program_id, screen_hdr_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_hdr_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_hdr_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_hdr_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_hdr_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_hdr_program_id);
-
 	// Get the uniform locations.
 	GLint screen_hdr_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_hdr_projection_matrix_location =
-	glGetUniformLocation(screen_hdr_program_id, "screenTexture"));
+	RenderPass::uniformLocation(screen_hdr_program_id, "screenTexture"));
+
+	GLint screen_hdr_exposure_location = 0;
+	CHECK_GL_ERROR(screen_hdr_exposure_location =
+	RenderPass::uniformLocation(screen_hdr_program_id, "exposure"));
 
 	glUseProgram(screen_hdr_program_id);
-	glUniform1f(glGetUniformLocation(screen_hdr_program_id, "exposure"), exposure);
+	glUniform1f(screen_hdr_exposure_location, exposure);
 	// ===========================================================
 
 	// configure hdr_framebuffer
@@ -1165,35 +1198,12 @@ int main(int argc, char* argv[])
 	// ===========================================================
 
 	// Setup brightness fragment shader for the quad ====================
-	GLuint screen_brightness_shader_id = 0;
-	const char* screen_brightness_source_pointer = screen_brightness_shader;
-	CHECK_GL_ERROR(screen_brightness_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_brightness_shader_id, 1,
-				&screen_brightness_source_pointer, nullptr));
-	glCompileShader(screen_brightness_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_brightness_shader_id);
-
-	// Setup the program
-	GLuint screen_brightness_program_id = 0;
-	CHECK_GL_ERROR(screen_brightness_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_brightness_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_brightness_program_id, screen_brightness_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_brightness_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_brightness_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_brightness_program_id, 0, "fragment_color"));
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_brightness_program_id, 1, "bright_color"));
-	glLinkProgram(screen_brightness_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_brightness_program_id);
-
 	// Get the uniform locations.
 	GLint screen_brightness_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_brightness_projection_matrix_location =
-	glGetUniformLocation(screen_brightness_program_id, "screenTexture"));
+	RenderPass::uniformLocation(screen_brightness_program_id, "screenTexture"));
 	// ===========================================================
 
 	// ===========================================================
@@ -1236,37 +1246,15 @@ int main(int argc, char* argv[])
 	// ===========================================================
 
 	// Setup downsample shader for the quad ====================
-	GLuint screen_downsample_shader_id = 0;
-	const char* screen_downsample_source_pointer = screen_downsample_shader;
-	CHECK_GL_ERROR(screen_downsample_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_downsample_shader_id, 1,
-				&screen_downsample_source_pointer, nullptr));
-	glCompileShader(screen_downsample_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_downsample_shader_id);
-
-	// Setup the program
-	GLuint screen_downsample_program_id = 0;
-  CHECK_GL_ERROR(screen_downsample_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_downsample_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_downsample_program_id, screen_downsample_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_downsample_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_downsample_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_downsample_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_downsample_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_downsample_program_id);
-
 	// Get the uniform locations.
 	GLint screen_downsample_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_downsample_projection_matrix_location =
-	glGetUniformLocation(screen_downsample_program_id, "screenTexture"));
+	RenderPass::uniformLocation(screen_downsample_program_id, "screenTexture"));
 
-  int uScaleLocation = glGetUniformLocation(screen_downsample_program_id, "uScale");
-  int uBiasLocation = glGetUniformLocation(screen_downsample_program_id, "uBias");
+  int uScaleLocation = RenderPass::uniformLocation(screen_downsample_program_id, "uScale");
+  int uBiasLocation = RenderPass::uniformLocation(screen_downsample_program_id, "uBias");
 
   glUseProgram(screen_downsample_program_id);
 
@@ -1303,34 +1291,12 @@ int main(int argc, char* argv[])
 	// ===========================================================
 
 	// Setup lensflare shader for the quad ====================
-	GLuint screen_lensflare_shader_id = 0;
-	const char* screen_lensflare_source_pointer = screen_lensflare_shader;
-	CHECK_GL_ERROR(screen_lensflare_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_lensflare_shader_id, 1,
-				&screen_lensflare_source_pointer, nullptr));
-	glCompileShader(screen_lensflare_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_lensflare_shader_id);
-
-	// Setup the program
-	GLuint screen_lensflare_program_id = 0;
-	CHECK_GL_ERROR(screen_lensflare_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_lensflare_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_lensflare_program_id, screen_lensflare_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_lensflare_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_lensflare_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_lensflare_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_lensflare_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_lensflare_program_id);
-
 	// Get the uniform locations.
 	GLint screen_lensflare_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_lensflare_projection_matrix_location =
-	glGetUniformLocation(screen_lensflare_program_id, "screenTexture"));
+	RenderPass::uniformLocation(screen_lensflare_program_id, "screenTexture"));
 	glUniform1i(screen_lensflare_projection_matrix_location, 0);
 
 	std::string lenscolor_image_path = "/assets/lenscolor.png";
@@ -1348,20 +1314,20 @@ int main(int argc, char* argv[])
 	CHECK_GL_ERROR(glUseProgram(screen_lensflare_program_id));
 	GLint lens_color_texture_location = 0;
 	CHECK_GL_ERROR(lens_color_texture_location =
-	glGetUniformLocation(screen_lensflare_program_id, "uLensColor"));
+	RenderPass::uniformLocation(screen_lensflare_program_id, "uLensColor"));
 	glUniform1i(lens_color_texture_location, 1);
 
   float ghostDispersal = 0.5f;
-  glUniform1f(glGetUniformLocation(screen_lensflare_program_id, "uGhostDispersal"), ghostDispersal);
+  glUniform1f(RenderPass::uniformLocation(screen_lensflare_program_id, "uGhostDispersal"), ghostDispersal);
 
 	float numberOfGhosts = 3.0f;
-	glUniform1f(glGetUniformLocation(screen_lensflare_program_id, "uGhosts"), numberOfGhosts);
+	glUniform1f(RenderPass::uniformLocation(screen_lensflare_program_id, "uGhosts"), numberOfGhosts);
 
 	float haloWidth = 0.5f;
-	glUniform1f(glGetUniformLocation(screen_lensflare_program_id, "uHaloWidth"), haloWidth);
+	glUniform1f(RenderPass::uniformLocation(screen_lensflare_program_id, "uHaloWidth"), haloWidth);
 
 	float uDistortion = 0.5f;
-	glUniform1f(glGetUniformLocation(screen_lensflare_program_id, "uDistortion"), haloWidth);
+	glUniform1f(RenderPass::uniformLocation(screen_lensflare_program_id, "uDistortion"), haloWidth);
 	// ===========================================================
 
 	// configure lensflare_framebuffer
@@ -1392,34 +1358,12 @@ int main(int argc, char* argv[])
 	// ===========================================================
 
 	// Setup blur shader for the quad ====================
-	GLuint screen_blur_shader_id = 0;
-	const char* screen_blur_source_pointer = screen_blur_shader;
-	CHECK_GL_ERROR(screen_blur_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_blur_shader_id, 1,
-				&screen_blur_source_pointer, nullptr));
-	glCompileShader(screen_blur_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_blur_shader_id);
-
-	// Setup the program
-	GLuint screen_blur_program_id = 0;
-	CHECK_GL_ERROR(screen_blur_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_blur_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_blur_program_id, screen_blur_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_blur_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_blur_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_blur_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_blur_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_blur_program_id);
-
 	// Get the uniform locations.
 	GLint screen_blur_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_blur_projection_matrix_location =
-	glGetUniformLocation(screen_blur_program_id, "screenTexture"));
+	RenderPass::uniformLocation(screen_blur_program_id, "screenTexture"));
 	// ===========================================================
 
 	// configure blur_framebuffer
@@ -1450,34 +1394,15 @@ int main(int argc, char* argv[])
 	// ===========================================================
 
 	// Setup blur2 shader for the quad ====================
-	GLuint screen_blur2_shader_id = 0;
-	const char* screen_blur2_source_pointer = screen_blur2_shader;
-	CHECK_GL_ERROR(screen_blur2_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(screen_blur2_shader_id, 1,
-				&screen_blur2_source_pointer, nullptr));
-	glCompileShader(screen_blur2_shader_id);
-	CHECK_GL_SHADER_ERROR(screen_blur2_shader_id);
-
-	// Setup the program
-	GLuint screen_blur2_program_id = 0;
-	CHECK_GL_ERROR(screen_blur2_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(screen_blur2_program_id, screen_vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(screen_blur2_program_id, screen_blur2_shader_id));
-
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kScreenVao][kVertexBuffer]));
 
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(screen_blur2_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindAttribLocation(screen_blur2_program_id, 1, "aTexCoords"));
-
-	CHECK_GL_ERROR(glBindFragDataLocation(screen_blur2_program_id, 0, "fragment_color"));
-	glLinkProgram(screen_blur2_program_id);
-	CHECK_GL_PROGRAM_ERROR(screen_blur2_program_id);
-
 	// Get the uniform locations.
 	GLint screen_blur2_projection_matrix_location = 0;
 	CHECK_GL_ERROR(screen_blur2_projection_matrix_location =
-	glGetUniformLocation(screen_blur2_program_id, "screenTexture"));
+	RenderPass::uniformLocation(screen_blur2_program_id, "screenTexture"));
+	GLint screen_blur2_horizontal_location = 0;
+	CHECK_GL_ERROR(screen_blur2_horizontal_location =
+	RenderPass::uniformLocation(screen_blur2_program_id, "horizontal"));
 
 	CHECK_GL_ERROR(glUseProgram(screen_blur2_program_id));
 	// ===========================================================
@@ -1554,10 +1479,29 @@ int main(int argc, char* argv[])
 	}
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+	// Deferred path, lit into geometry_framebuffer like the forward one
+	// resolves into it.
+	DeferredRenderer deferred_renderer;
+	deferred_renderer.setup(window_width, window_height, quadVAO);
+	gui->deferredShading(&deferredShading);
+
 	choose_photo_object();
 
+	// Wait for the programs nothing has used yet and print the startup
+	// timeline.
+	RenderPass::finishPrograms();
+
 	clock_t last_frame_time = clock();
 	while (!glfwWindowShouldClose(window)) {
+		RenderPass::resetUploadBytes();
+		RenderPass::resetUniformLookups();
+
+		// Objects appear as their uploads land.
+		if (uploader->poll() && uploader->pending() == 0) {
+			AssetRegistry::get().printTimeline();
+			AssetRegistry::get().printStats();
+		}
+
 		// Compute the projection matrix.
 		aspect = static_cast<float>(window_width) / window_height;
 		projection_matrix =
@@ -1568,91 +1512,105 @@ int main(int argc, char* argv[])
     glm::vec3 right = glm::normalize(glm::cross(g_camera->up_, g_camera->center_ - g_camera->eye_));
     glm::vec3 p_up = glm::normalize(glm::cross(g_camera->center_ - g_camera->eye_, right));
 
+		// Cull the sponge once for all bokeh rays: they move the eye by up
+		// to aperture and turn it back to center_.
+		MengerView menger_view;
+		menger_view.view_projection = projection_matrix *
+			glm::lookAt(g_camera->eye_, g_camera->center_, p_up);
+		menger_view.eye = g_camera->eye_;
+		menger_view.pixel_scale = window_height / (2.0f * tanf(glm::radians(45.0f) * 0.5f));
+		menger_view.margin = aperture;
+		menger_view.focus = glm::length(g_camera->center_ - g_camera->eye_);
+		menger_renderer.update(menger_view);
+
+		// Same for the clustered lights.
+		light_clusters.bin(glm::lookAt(g_camera->eye_, g_camera->center_, p_up), glm::radians(45.0f),
+				window_width, window_height, 1000.0f, aperture, menger_view.focus);
+		light_clusters.upload();
+		light_clusters.bind();
+
 		// render
 		// ------
-		// bind to geometry_framebuffer and draw scene as we normally would to color texture
-		glBindFramebuffer(GL_FRAMEBUFFER, msaa_framebuffer);
-		glEnable(GL_DEPTH_TEST); // enable depth testing (is disabled for rendering screen-space quad)
+		if (deferredShading) {
+			// The G-buffer once, from the center of the lens, then one
+			// lighting pass straight into geometry_framebuffer.
+			glEnable(GL_DEPTH_TEST);
+			view_matrix = glm::lookAt(g_camera->eye_, g_camera->center_, p_up);
+			deferred_renderer.beginForward(glm::vec4(0.3f, 0.5f, 0.8f, 1.0f));
+			menger_renderer.render();
+			floor_pass.setup();
+			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
+			deferred_renderer.beginGBuffer();
+			if (showMeshes) {
+				for (Object* o : scene_objects)
+					o->renderGBuffer();
+			}
+			deferred_renderer.light(view_matrix, g_camera->eye_, geometry_framebuffer);
+		} else {
+			// bind to geometry_framebuffer and draw scene as we normally would to color texture
+			glBindFramebuffer(GL_FRAMEBUFFER, msaa_framebuffer);
+			glEnable(GL_DEPTH_TEST); // enable depth testing (is disabled for rendering screen-space quad)
 
-		// make sure we clear the geometry_framebuffer's content
-		glClearColor(0.3f, 0.5f, 0.8f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		//glClear(GL_ACCUM_BUFFER_BIT);
-
-    for(int i = 0; i < light_rays_for_bokeh; i++) {
-      glm::vec3 bokeh = right * cosf(i * 2 * M_PI / light_rays_for_bokeh) + p_up * sinf(i * 2 * M_PI / light_rays_for_bokeh);
-      // TODO: Switch back to using our custom get_view_matrix function
-  		view_matrix = glm::lookAt(g_camera->eye_ + aperture * bokeh, g_camera->center_, p_up);
-
-  		if (g_menger && g_menger->is_dirty()) {
-  		  	g_menger->generate_geometry(menger_vertices, menger_normals, menger_faces, menger_pos);
-  			g_menger->set_clean();
-  		}
-
-  		// <<<Render Menger>>>
-  		RenderDataInput menger_pass_input;
-  		menger_pass_input.assign(0, "vertex_position", menger_vertices.data(), menger_vertices.size(), 4, GL_FLOAT);
-  		menger_pass_input.assign(1, "normal", menger_normals.data(), menger_normals.size(), 4, GL_FLOAT);
-  		menger_pass_input.assign_index(menger_faces.data(), menger_faces.size(), 3);
-  		RenderPass menger_pass(-1,
-  				menger_pass_input,
-  				{ vertex_shader, NULL, fragment_shader},
-  				{ menger_model, std_view, std_proj, std_light, std_view_position },
-  				{ "fragment_color" }
-  				);
-
-  		menger_pass.loadLights(directionalLights, pointLights, spotLights);
-  		menger_pass.loadLightColor(glm::vec4(5.0f, 1.5f, 1.5f, 1.0f));
-
-  		menger_pass.setup();
-  		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, menger_faces.size() * 3, GL_UNSIGNED_INT, 0));
-  		// <<<Render Menger>>>
-
-  		// <<<Render Floor>>>
-  		floor_pass.setup();
-  		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
-  		// <<<Render Floor>>>
-
-  				// <<<Scene>>>
-  				if (showMeshes){
-  					//tree lights
-  					treelight->render();
-  					treelight2->render();
-  					treelight3->render();
-  					treelight4->render();
-  					treelight5->render();
-  					treelight6->render();
-  					treelight7->render();
-  					treelight8->render();
-  					treelight9->render();
-  					treelight10->render();
-  					// ==========
-  					cone->render();
-  					sphere->render();
-  					sphere2->render();
-  					cylinder->render();
-  					torus->render();
-  					monkey->render();
-
-  					cat->render();
-  					dog->render();
-  					deer->render();
-
-  					building->render();
-  					grass->render();
-  					wall->render();
-  					wall2->render();
-  					wall3->render();
-  					wall4->render();
-  				}
-  				// <<<Scene>>>
-  		// End of geometry pass ====================================================
-      //glAccum(GL_ACCUM, 0.25);
-    }
-		// 2. now blit multisampled buffer(s) to normal colorbuffer of intermediate FBO. Image is stored in screenTexture
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, msaa_framebuffer);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, geometry_framebuffer);
-    glBlitFramebuffer(0, 0, window_width, window_height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			// make sure we clear the geometry_framebuffer's content
+			glClearColor(0.3f, 0.5f, 0.8f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			//glClear(GL_ACCUM_BUFFER_BIT);
+
+	    for(int i = 0; i < light_rays_for_bokeh; i++) {
+	      glm::vec3 bokeh = right * cosf(i * 2 * M_PI / light_rays_for_bokeh) + p_up * sinf(i * 2 * M_PI / light_rays_for_bokeh);
+	      // TODO: Switch back to using our custom get_view_matrix function
+	  		view_matrix = glm::lookAt(g_camera->eye_ + aperture * bokeh, g_camera->center_, p_up);
+
+	  		// <<<Render Menger>>>
+	  		menger_renderer.render();
+	  		// <<<Render Menger>>>
+
+	  		// <<<Render Floor>>>
+	  		floor_pass.setup();
+	  		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
+	  		// <<<Render Floor>>>
+
+	  				// <<<Scene>>>
+	  				if (showMeshes){
+	  					//tree lights
+	  					treelight->render();
+	  					treelight2->render();
+	  					treelight3->render();
+	  					treelight4->render();
+	  					treelight5->render();
+	  					treelight6->render();
+	  					treelight7->render();
+	  					treelight8->render();
+	  					treelight9->render();
+	  					treelight10->render();
+	  					// ==========
+	  					cone->render();
+	  					sphere->render();
+	  					sphere2->render();
+	  					cylinder->render();
+	  					torus->render();
+	  					monkey->render();
+
+	  					cat->render();
+	  					dog->render();
+	  					deer->render();
+
+	  					building->render();
+	  					grass->render();
+	  					wall->render();
+	  					wall2->render();
+	  					wall3->render();
+	  					wall4->render();
+	  				}
+	  				// <<<Scene>>>
+	  		// End of geometry pass ====================================================
+	      //glAccum(GL_ACCUM, 0.25);
+	    }
+			// 2. now blit multisampled buffer(s) to normal colorbuffer of intermediate FBO. Image is stored in screenTexture
+	    glBindFramebuffer(GL_READ_FRAMEBUFFER, msaa_framebuffer);
+	    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, geometry_framebuffer);
+	    glBlitFramebuffer(0, 0, window_width, window_height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}
 
 
 		//glAccum(GL_RETURN, 1);
@@ -1684,7 +1642,7 @@ int main(int argc, char* argv[])
 			CHECK_GL_ERROR(glUseProgram(screen_hdr_program_id));
 
 			// Adjust exposure for controls
-			glUniform1f(glGetUniformLocation(screen_hdr_program_id, "exposure"), exposure);
+			glUniform1f(screen_hdr_exposure_location, exposure);
 
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, blur_textureColorBuffer);	// use the color attachment texture as the texture of the quad plane
@@ -1702,7 +1660,7 @@ int main(int argc, char* argv[])
 			CHECK_GL_ERROR(glUseProgram(screen_hdr_program_id));
 
 			// Adjust exposure for controls
-			glUniform1f(glGetUniformLocation(screen_hdr_program_id, "exposure"), exposure);
+			glUniform1f(screen_hdr_exposure_location, exposure);
 
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, geometry_textureColorBuffer);	// use the color attachment texture as the texture of the quad plane
@@ -1782,7 +1740,7 @@ int main(int argc, char* argv[])
 		for (unsigned int i = 0; i < amount; i++)
 		{
 				glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
-				glUniform1i(glGetUniformLocation(screen_blur2_program_id, "horizontal"), horizontal);
+				glUniform1i(screen_blur2_horizontal_location, horizontal);
 				glActiveTexture(GL_TEXTURE0);
 				glBindTexture(
 					GL_TEXTURE_2D, first_iteration ? brightness_colorBuffers[1] : pingpongBuffer[!horizontal]
@@ -1917,6 +1875,8 @@ int main(int argc, char* argv[])
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 	}
+	delete uploader;
+	RenderPass::printProgramStats();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
@@ -1,9 +1,44 @@
 #include "menger.h"
 #include "stdio.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include "parallel.h"
 
 namespace {
 	const int kMinLevel = 0;
 	const int kMaxLevel = 4;
+	const int kMaxRaymarchedLevel = 10;
+
+	// Bit i is set when base-3 digit i of c is 1, i.e. when c sits in the
+	// middle third at subdivision level i.
+	unsigned middle_digits(int c, int level)
+	{
+		unsigned mask = 0;
+		for (int i = 0; i < level; i++, c /= 3) {
+			if (c % 3 == 1)
+				mask |= 1u << i;
+		}
+		return mask;
+	}
+
+	// Centers of the 20 sub-cubes kept at the first subdivision.
+	std::vector<glm::vec4> sub_cube_positions(glm::vec4 position, float sub_length)
+	{
+		std::vector<glm::vec4> sub_positions;
+		for (int z = 0; z < 3; z++) {
+			for (int y = 0; y < 3; y++) {
+				for (int x = 0; x < 3; x++) {
+					if (x % 2 + y % 2 + z % 2 < 2) {
+						sub_positions.push_back(glm::vec4(-sub_length + x * sub_length + position.x,
+							-sub_length + y * sub_length + position.y,
+							-sub_length + z * sub_length + position.z, 1.0f));
+					}
+				}
+			}
+		}
+		return sub_positions;
+	}
 };
 
 Menger::Menger()
@@ -22,6 +57,47 @@ Menger::set_nesting_level(int level)
 	dirty_ = true;
 }
 
+int
+Menger::nesting_level() const
+{
+	return nesting_level_;
+}
+
+int
+Menger::max_nesting_level() const
+{
+	return mode_ == kRaymarched ? kMaxRaymarchedLevel : kMaxLevel;
+}
+
+size_t
+Menger::cube_count(int level)
+{
+	size_t ncubes = 1;
+	for (int i = 0; i < level; i++)
+		ncubes *= 20;
+	return ncubes;
+}
+
+void
+Menger::set_mode(Mode mode)
+{
+	if (mode != mode_)
+		dirty_ = true;
+	mode_ = mode;
+}
+
+Menger::Mode
+Menger::mode() const
+{
+	return mode_;
+}
+
+void
+Menger::set_threads(int threads)
+{
+	threads_ = threads;
+}
+
 bool
 Menger::is_dirty() const
 {
@@ -34,7 +110,6 @@ Menger::set_clean()
 	dirty_ = false;
 }
 
-// FIXME generate Menger sponge geometry
 void
 Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
 	std::vector<glm::vec4>& vtx_normals,
@@ -47,13 +122,179 @@ Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
 
 	float length = 1.0f;
 
+	if (mode_ == kCulled) {
+		create_culled(obj_vertices, vtx_normals, obj_faces, position, length);
+		return;
+	}
+
+	if (mode_ == kRaymarched) {
+		// Just the bounds, the shader carves the holes.
+		obj_vertices.resize(36);
+		vtx_normals.resize(36);
+		obj_faces.resize(12);
+		create_cube(obj_vertices, vtx_normals, obj_faces, position, length, 0);
+		return;
+	}
+
+	if (mode_ == kInstanced) {
+		// The template cube, generate_instances places and scales it.
+		obj_vertices.resize(36);
+		vtx_normals.resize(36);
+		obj_faces.resize(12);
+		create_cube(obj_vertices, vtx_normals, obj_faces,
+			glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), length, 0);
+		return;
+	}
+
+	// The cube count is 20^level, so the output can be sized up front and
+	// every sub-cube writes its own range.
+	size_t ncubes = cube_count(nesting_level_);
+	obj_vertices.resize(ncubes * 36);
+	vtx_normals.resize(ncubes * 36);
+	obj_faces.resize(ncubes * 12);
+
 	if (nesting_level_ <= 0) {
 		create_cube(obj_vertices, vtx_normals, obj_faces, position, length, 0);
-	} else {
-		create_menger(obj_vertices, vtx_normals, obj_faces, position, length / 3.0f, 1, 0);
+		return;
+	}
+
+	// Split the 20 top-level sub-cubes across the workers.
+	float sub_length = length / 3.0f;
+	std::vector<glm::vec4> sub_positions = sub_cube_positions(position, sub_length);
+	size_t cubes_per_sub = ncubes / sub_positions.size();
+	parallel_for(int(sub_positions.size()), threads_, [&](int i) {
+		int first_vertex = int(i * cubes_per_sub * 36);
+		if (nesting_level_ > 1) {
+			create_menger(obj_vertices, vtx_normals, obj_faces,
+				sub_positions[i], sub_length / 3.0f, 2, first_vertex);
+		} else {
+			create_cube(obj_vertices, vtx_normals, obj_faces,
+				sub_positions[i], sub_length, first_vertex);
+		}
+	});
+}
+
+void
+Menger::generate_instances(std::vector<glm::vec4>& offsets, glm::vec4 position) const
+{
+	float length = 1.0f;
+	size_t ncubes = cube_count(nesting_level_);
+	offsets.resize(ncubes);
+
+	if (nesting_level_ <= 0) {
+		offsets[0] = glm::vec4(glm::vec3(position), length);
+		return;
+	}
+
+	// Same split as generate_geometry, one offset per sub-cube.
+	float sub_length = length / 3.0f;
+	std::vector<glm::vec4> sub_positions = sub_cube_positions(position, sub_length);
+	size_t cubes_per_sub = ncubes / sub_positions.size();
+	parallel_for(int(sub_positions.size()), threads_, [&](int i) {
+		int first = int(i * cubes_per_sub);
+		if (nesting_level_ > 1) {
+			create_instances(offsets, sub_positions[i], sub_length / 3.0f, 2, first);
+		} else {
+			offsets[first] = glm::vec4(glm::vec3(sub_positions[i]), sub_length);
+		}
+	});
+}
+
+void
+Menger::generate_visible_instances(std::vector<glm::vec4>& offsets,
+	glm::vec4 position, const MengerView& view) const
+{
+	offsets.clear();
+
+	// Frustum planes, pointing inwards (Gribb & Hartmann).
+	const glm::mat4& m = view.view_projection;
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++)
+		row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	glm::vec4 planes[6] = {
+		row[3] + row[0], row[3] - row[0],
+		row[3] + row[1], row[3] - row[1],
+		row[3] + row[2], row[3] - row[2],
+	};
+	for (int i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+
+	cull_instances(offsets, planes, view, glm::vec3(position), 1.0f, 0, false);
+}
+
+void
+Menger::cull_instances(std::vector<glm::vec4>& offsets, const glm::vec4 planes[6],
+	const MengerView& view, glm::vec3 center, float length, int level,
+	bool inside) const
+{
+	// Children of a node that is fully inside can skip the planes.
+	if (!inside) {
+		// Farthest the node reaches from the eye, an upper bound on its depth.
+		float depth = glm::length(center - view.eye) + 0.87f * length;
+		float margin = view.margin;
+		if (view.focus > 0.0f)
+			margin *= std::max(1.0f, depth / view.focus);
+		float half_length = 0.5f * length + margin;
+		inside = true;
+		for (int i = 0; i < 6; i++) {
+			glm::vec3 n = glm::vec3(planes[i]);
+			float r = half_length * (fabsf(n.x) + fabsf(n.y) + fabsf(n.z));
+			float d = glm::dot(n, center) + planes[i].w;
+			if (d < -r)
+				return;
+			if (d < r)
+				inside = false;
+		}
+	}
+
+	bool refine = level < nesting_level_;
+	if (refine) {
+		// The bounding sphere may contain the eye, then always refine.
+		float distance = glm::length(center - view.eye) - 0.87f * length;
+		if (distance > 0.0f)
+			refine = length / 3.0f / distance * view.pixel_scale >= view.hole_pixels;
+	}
+	if (!refine) {
+		offsets.push_back(glm::vec4(center, length));
+		return;
+	}
+
+	float sub_length = length / 3.0f;
+	for (int z = 0; z < 3; z++) {
+		for (int y = 0; y < 3; y++) {
+			for (int x = 0; x < 3; x++) {
+				if (x % 2 + y % 2 + z % 2 < 2) {
+					glm::vec3 center_i = center + sub_length * glm::vec3(x - 1, y - 1, z - 1);
+					cull_instances(offsets, planes, view, center_i, sub_length, level + 1, inside);
+				}
+			}
+		}
 	}
 }
 
+int
+Menger::create_instances(std::vector<glm::vec4>& offsets,
+	glm::vec4 position, float length, int level, int offsets_i) const
+{
+	for (int z = 0; z < 3; z++) {
+		for (int y = 0; y < 3; y++) {
+			for (int x = 0; x < 3; x++) {
+				if (x % 2 + y % 2 + z % 2 < 2) {
+					glm::vec4 position_i = glm::vec4(-length + x * length + position.x,
+						-length + y * length + position.y, -length + z * length + position.z, 1.0f);
+					if (level < nesting_level_) {
+						offsets_i = create_instances(offsets, position_i,
+							length / 3.0f, level + 1, offsets_i);
+					} else {
+						offsets[offsets_i++] = glm::vec4(glm::vec3(position_i), length);
+					}
+				}
+			}
+		}
+	}
+	return offsets_i;
+}
+
 int
 Menger::create_menger(std::vector<glm::vec4>& obj_vertices,
 	std::vector<glm::vec4>& vtx_normals, std::vector<glm::uvec3>& obj_faces,
@@ -92,112 +333,343 @@ Menger::create_cube(std::vector<glm::vec4>& obj_vertices, std::vector<glm::vec4>
 	float minz = -half_length + position.z;
 	float maxz = half_length + position.z;
 
+	// The outputs are pre-sized, this cube owns the 36 vertices starting
+	// at obj_faces_i and the 12 faces starting at obj_faces_i / 3.
+	glm::vec4* vtx = &obj_vertices[obj_faces_i];
+	glm::vec4* nrm = &vtx_normals[obj_faces_i];
+	glm::uvec3* face = &obj_faces[obj_faces_i / 3];
+
 	// Cube data.
 	// Front, bottom-right triangle.
-	obj_vertices.push_back(glm::vec4(minx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 0, obj_faces_i + 1, obj_faces_i + 2));
+	*vtx++ = glm::vec4(minx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 0, obj_faces_i + 1, obj_faces_i + 2);
 
 	// Front, top-left triangle.
-	obj_vertices.push_back(glm::vec4(minx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 3, obj_faces_i + 4, obj_faces_i + 5));
+	*vtx++ = glm::vec4(minx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 3, obj_faces_i + 4, obj_faces_i + 5);
 
 	// Right, bottom-right triangle.
-	obj_vertices.push_back(glm::vec4(maxx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 6, obj_faces_i + 7, obj_faces_i + 8));
+	*vtx++ = glm::vec4(maxx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 6, obj_faces_i + 7, obj_faces_i + 8);
 
 	// Right, top-left triangle.
-	obj_vertices.push_back(glm::vec4(maxx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 9, obj_faces_i + 10, obj_faces_i + 11));
+	*vtx++ = glm::vec4(maxx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 9, obj_faces_i + 10, obj_faces_i + 11);
 
 	// Top, bottom-right triangle.
-	obj_vertices.push_back(glm::vec4(maxx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 12, obj_faces_i + 13, obj_faces_i + 14));
+	*vtx++ = glm::vec4(maxx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 12, obj_faces_i + 13, obj_faces_i + 14);
 
 	// Top, top-left triangle.
-	obj_vertices.push_back(glm::vec4(maxx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 15, obj_faces_i + 16, obj_faces_i + 17));
+	*vtx++ = glm::vec4(maxx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 15, obj_faces_i + 16, obj_faces_i + 17);
 
 	// Bottom, bottom-right triangle.
-	obj_vertices.push_back(glm::vec4(minx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 18, obj_faces_i + 19, obj_faces_i + 20));
+	*vtx++ = glm::vec4(minx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 18, obj_faces_i + 19, obj_faces_i + 20);
 
 	// Bottom, top-left triangle.
-	obj_vertices.push_back(glm::vec4(minx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 21, obj_faces_i + 22, obj_faces_i + 23));
+	*vtx++ = glm::vec4(minx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 21, obj_faces_i + 22, obj_faces_i + 23);
 
 	// Back, bottom-right triangle.
-	obj_vertices.push_back(glm::vec4(maxx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 24, obj_faces_i + 25, obj_faces_i + 26));
+	*vtx++ = glm::vec4(maxx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 24, obj_faces_i + 25, obj_faces_i + 26);
 
 	// Back, top-left triangle.
-	obj_vertices.push_back(glm::vec4(maxx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(maxx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 27, obj_faces_i + 28, obj_faces_i + 29));
+	*vtx++ = glm::vec4(maxx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	*vtx++ = glm::vec4(maxx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 27, obj_faces_i + 28, obj_faces_i + 29);
 
 	// Left, bottom-right triangle.
-	obj_vertices.push_back(glm::vec4(minx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, miny, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 30, obj_faces_i + 31, obj_faces_i + 32));
+	*vtx++ = glm::vec4(minx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, miny, maxz, 1.0f);
+	*nrm++ = glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 30, obj_faces_i + 31, obj_faces_i + 32);
 
 	// Left, top-left triangle.
-	obj_vertices.push_back(glm::vec4(minx, miny, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, maxz, 1.0f));
-	vtx_normals.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
-	obj_vertices.push_back(glm::vec4(minx, maxy, minz, 1.0f));
-	vtx_normals.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
-	obj_faces.push_back(glm::uvec3(obj_faces_i + 33, obj_faces_i + 34, obj_faces_i + 35));
+	*vtx++ = glm::vec4(minx, miny, minz, 1.0f);
+	*nrm++ = glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, maxz, 1.0f);
+	*nrm++ = glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+	*vtx++ = glm::vec4(minx, maxy, minz, 1.0f);
+	*nrm++ = glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+	*face++ = glm::uvec3(obj_faces_i + 33, obj_faces_i + 34, obj_faces_i + 35);
+}
+
+
+/*
+ * Treat the sponge as a 3^level voxel grid. A cell is solid unless, at some
+ * subdivision level, at least two of its coordinates fall in the middle
+ * third. For each of the six face directions we sweep the grid slice by
+ * slice, mark the faces whose neighbor is empty and greedily merge them into
+ * rectangles. Vertices are shared by all quads of a slice, and slices are
+ * emitted in order so neighboring triangles reference nearby vertices.
+ *
+ * A merged rectangle's edge can run past the corners of smaller
+ * neighbors, in its own plane or on a perpendicular one. Corner positions
+ * are multiples of 1/3^level, which float can't hold exactly, so such
+ * T-junctions would rasterize as cracks. Every rectangle edge is therefore
+ * split at each corner of any rectangle that lies on it, and a split
+ * rectangle is drawn as a fan around its center; the mesh stays watertight.
+ *
+ * Slices are independent, so they are merged and then meshed in parallel
+ * into local buffers which are copied into their pre-sized output ranges.
+ */
+void
+Menger::create_culled(std::vector<glm::vec4>& obj_vertices,
+	std::vector<glm::vec4>& vtx_normals, std::vector<glm::uvec3>& obj_faces,
+	glm::vec4 position, float length) const
+{
+	int level = nesting_level_ > 0 ? nesting_level_ : 0;
+	int n = 1;
+	for (int i = 0; i < level; i++)
+		n *= 3;
+	float cell = length / n;
+	glm::vec3 origin = glm::vec3(position) - glm::vec3(length * 0.5f);
+
+	std::vector<unsigned> digits(n);
+	for (int c = 0; c < n; c++)
+		digits[c] = middle_digits(c, level);
+	auto solid = [&digits, n](int x, int y, int z) -> bool {
+		if (x < 0 || y < 0 || z < 0 || x >= n || y >= n || z >= n)
+			return false;
+		unsigned dx = digits[x], dy = digits[y], dz = digits[z];
+		return ((dx & dy) | (dy & dz) | (dx & dz)) == 0;
+	};
+
+	struct Rect {
+		int u, v, w, h;
+	};
+	struct Slice {
+		std::vector<Rect> rects;
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::uvec3> faces; // indices local to the slice
+	};
+	// Slice order: axis, then sign, then depth.
+	std::vector<Slice> slices(6 * n);
+	// (u, v, axis) is a right-handed frame, so u x v points along +axis.
+	auto frame = [n](int id, int& axis, int& u_axis, int& v_axis, int& sign, int& k) {
+		axis = id / (2 * n);
+		sign = (id / n) % 2 ? 1 : -1;
+		k = id % n;
+		u_axis = (axis + 1) % 3;
+		v_axis = (axis + 2) % 3;
+	};
+
+	parallel_for(int(slices.size()), threads_, [&](int id) {
+		int axis, u_axis, v_axis, sign, k;
+		frame(id, axis, u_axis, v_axis, sign, k);
+		Slice& out = slices[id];
+
+		std::vector<char> mask(n * n);
+		int cell_pos[3];
+		int next_pos[3];
+		for (int v = 0; v < n; v++) {
+			for (int u = 0; u < n; u++) {
+				cell_pos[axis] = k;
+				cell_pos[u_axis] = u;
+				cell_pos[v_axis] = v;
+				next_pos[axis] = k + sign;
+				next_pos[u_axis] = u;
+				next_pos[v_axis] = v;
+				mask[v * n + u] =
+					solid(cell_pos[0], cell_pos[1], cell_pos[2]) &&
+					!solid(next_pos[0], next_pos[1], next_pos[2]);
+			}
+		}
+
+		for (int v = 0; v < n; v++) {
+			for (int u = 0; u < n; ) {
+				if (!mask[v * n + u]) {
+					u++;
+					continue;
+				}
+				int w = 1;
+				while (u + w < n && mask[v * n + u + w])
+					w++;
+				int h = 1;
+				for (bool grow = true; grow && v + h < n; ) {
+					for (int i = 0; i < w; i++) {
+						if (!mask[(v + h) * n + u + i]) {
+							grow = false;
+							break;
+						}
+					}
+					if (grow)
+						h++;
+				}
+				for (int j = 0; j < h; j++)
+					for (int i = 0; i < w; i++)
+						mask[(v + j) * n + u + i] = 0;
+				out.rects.push_back({ u, v, w, h });
+				u += w;
+			}
+		}
+	});
+
+	// Every rectangle corner of the whole sponge, on the (n + 1)^3 grid.
+	int m = n + 1;
+	std::vector<char> corners(size_t(m) * m * m, 0);
+	auto grid = [m](const int p[3]) -> size_t {
+		return (size_t(p[2]) * m + p[1]) * m + p[0];
+	};
+	for (int id = 0; id < int(slices.size()); id++) {
+		int axis, u_axis, v_axis, sign, k;
+		frame(id, axis, u_axis, v_axis, sign, k);
+		int p[3];
+		p[axis] = sign > 0 ? k + 1 : k;
+		for (const Rect& r : slices[id].rects) {
+			for (int c = 0; c < 4; c++) {
+				p[u_axis] = r.u + (c == 1 || c == 2 ? r.w : 0);
+				p[v_axis] = r.v + (c >= 2 ? r.h : 0);
+				corners[grid(p)] = 1;
+			}
+		}
+	}
+
+	parallel_for(int(slices.size()), threads_, [&](int id) {
+		int axis, u_axis, v_axis, sign, k;
+		frame(id, axis, u_axis, v_axis, sign, k);
+		Slice& out = slices[id];
+		int plane = sign > 0 ? k + 1 : k;
+
+		// Vertex index of each (u, v) grid corner on this plane.
+		std::vector<unsigned> corner(m * m, UINT_MAX);
+		auto point = [&](float u, float v) {
+			glm::vec4 p(0.0f, 0.0f, 0.0f, 1.0f);
+			p[axis] = origin[axis] + plane * cell;
+			p[u_axis] = origin[u_axis] + u * cell;
+			p[v_axis] = origin[v_axis] + v * cell;
+			return p;
+		};
+		auto vertex = [&](int u, int v) -> unsigned {
+			int cid = v * m + u;
+			if (corner[cid] == UINT_MAX) {
+				corner[cid] = out.vertices.size();
+				out.vertices.push_back(point(float(u), float(v)));
+			}
+			return corner[cid];
+		};
+		auto is_corner = [&](int u, int v) -> bool {
+			int p[3];
+			p[axis] = plane;
+			p[u_axis] = u;
+			p[v_axis] = v;
+			return corners[grid(p)] != 0;
+		};
+		auto triangle = [&](unsigned a, unsigned b, unsigned c) {
+			if (sign > 0)
+				out.faces.push_back(glm::uvec3(a, b, c));
+			else
+				out.faces.push_back(glm::uvec3(a, c, b));
+		};
+
+		std::vector<unsigned> ring;
+		for (const Rect& r : out.rects) {
+			// Counter-clockwise in (u, v), every corner on the way.
+			ring.clear();
+			for (int i = 0; i < r.w; i++)
+				if (i == 0 || is_corner(r.u + i, r.v))
+					ring.push_back(vertex(r.u + i, r.v));
+			for (int j = 0; j < r.h; j++)
+				if (j == 0 || is_corner(r.u + r.w, r.v + j))
+					ring.push_back(vertex(r.u + r.w, r.v + j));
+			for (int i = r.w; i > 0; i--)
+				if (i == r.w || is_corner(r.u + i, r.v + r.h))
+					ring.push_back(vertex(r.u + i, r.v + r.h));
+			for (int j = r.h; j > 0; j--)
+				if (j == r.h || is_corner(r.u, r.v + j))
+					ring.push_back(vertex(r.u, r.v + j));
+
+			if (ring.size() == 4) {
+				triangle(ring[0], ring[1], ring[2]);
+				triangle(ring[0], ring[2], ring[3]);
+				continue;
+			}
+			unsigned center = out.vertices.size();
+			out.vertices.push_back(point(r.u + r.w * 0.5f, r.v + r.h * 0.5f));
+			for (size_t i = 0; i < ring.size(); i++)
+				triangle(center, ring[i], ring[(i + 1) % ring.size()]);
+		}
+	});
+
+	std::vector<size_t> first_vertex(slices.size() + 1, 0);
+	std::vector<size_t> first_face(slices.size() + 1, 0);
+	for (size_t i = 0; i < slices.size(); i++) {
+		first_vertex[i + 1] = first_vertex[i] + slices[i].vertices.size();
+		first_face[i + 1] = first_face[i] + slices[i].faces.size();
+	}
+	obj_vertices.resize(first_vertex.back());
+	vtx_normals.resize(first_vertex.back());
+	obj_faces.resize(first_face.back());
+
+	parallel_for(int(slices.size()), threads_, [&](int id) {
+		int axis = id / (2 * n);
+		glm::vec4 normal(0.0f);
+		normal[axis] = (id / n) % 2 ? 1.0f : -1.0f;
+		Slice& slice = slices[id];
+		size_t base = first_vertex[id];
+		std::copy(slice.vertices.begin(), slice.vertices.end(),
+			obj_vertices.begin() + base);
+		std::fill(vtx_normals.begin() + base,
+			vtx_normals.begin() + first_vertex[id + 1], normal);
+		glm::uvec3 offset = glm::uvec3(unsigned(base));
+		for (size_t i = 0; i < slice.faces.size(); i++)
+			obj_faces[first_face[id] + i] = slice.faces[i] + offset;
+		std::vector<glm::vec4>().swap(slice.vertices);
+		std::vector<glm::uvec3>().swap(slice.faces);
+	});
 }
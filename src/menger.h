@@ -4,26 +4,100 @@
 #include <glm/glm.hpp>
 #include <vector>
 
+/*
+ * MengerView: what generate_visible_instances needs to know about the camera.
+ *      view_projection: culling frustum
+ *      eye: camera position, for the screen size of a node
+ *      pixel_scale: viewport height / (2 tan(fovy / 2)), a node of edge
+ *                   length l at distance d covers l / d * pixel_scale pixels
+ *      hole_pixels: only subdivide a node when the holes this would open
+ *                   are at least this many pixels across
+ *      margin, focus: grow node bounds before culling to cover views whose
+ *              eye is up to margin away and which still look at the point
+ *              focus ahead, e.g. the bokeh rays, with a single traversal.
+ *              Re-aiming at that point moves something at depth z by about
+ *              margin * |z / focus - 1|, so a node grows by
+ *              margin * max(1, z / focus). focus <= 0: by margin.
+ */
+struct MengerView {
+	glm::mat4 view_projection;
+	glm::vec3 eye;
+	float pixel_scale = 1.0f;
+	float hole_pixels = 2.0f;
+	float margin = 0.0f;
+	float focus = 0.0f;
+};
+
 class Menger {
 public:
+	/*
+	 * Geometry generation modes:
+	 *      kCubes: every sub-cube emits 36 unshared vertices.
+	 *      kCulled: faces between touching sub-cubes are dropped, coplanar
+	 *               faces are merged into larger quads and the result is an
+	 *               indexed, watertight mesh with shared vertices.
+	 *      kInstanced: generate_geometry emits a single unit cube at the
+	 *               origin and generate_instances gives one offset per
+	 *               sub-cube (xyz: center, w: edge length), to be drawn
+	 *               with glDrawElementsInstanced.
+	 *      kRaymarched: generate_geometry emits only the bounding cube;
+	 *               the sponge is raymarched per fragment from its
+	 *               distance field, so any level costs about the same.
+	 * All of them produce the same image.
+	 */
+	enum Mode {
+		kCubes,
+		kCulled,
+		kInstanced,
+		kRaymarched,
+	};
+
 	Menger();
 	~Menger();
 	void set_nesting_level(int);
+	int nesting_level() const;
+	// Deepest level worth asking for in the current mode.
+	int max_nesting_level() const;
+	// Sub-cubes in a sponge of the given level, 20^level.
+	static size_t cube_count(int level);
+	void set_mode(Mode);
+	Mode mode() const;
+	// Worker threads used by generate_geometry, <= 0 means one per core.
+	void set_threads(int);
 	bool is_dirty() const;
 	void set_clean();
 	void generate_geometry(std::vector<glm::vec4>& obj_vertices,
 		std::vector<glm::vec4>& vtx_normals,
     std::vector<glm::uvec3>& obj_faces,
     glm::vec4 position) const;
+	void generate_instances(std::vector<glm::vec4>& offsets, glm::vec4 position) const;
+	/*
+	 * Like generate_instances, but walks the sponge as a hierarchy: node
+	 * bounds are the cube at each level of the recursion. Subtrees outside
+	 * the view frustum are skipped and subtrees too small on screen to show
+	 * more holes are emitted as one solid cube of their own size.
+	 */
+	void generate_visible_instances(std::vector<glm::vec4>& offsets,
+		glm::vec4 position, const MengerView& view) const;
 	int create_menger(std::vector<glm::vec4>& obj_vertices,
 		std::vector<glm::vec4>& vtx_normals, std::vector<glm::uvec3>& obj_faces,
 		glm::vec4 position, float length, int level, int obj_faces_i) const;
 	void create_cube(std::vector<glm::vec4>& obj_vertices,
                 std::vector<glm::vec4>& vtx_normals, std::vector<glm::uvec3>& obj_faces,
                 glm::vec4 position, float length, int obj_faces_i) const;
+	int create_instances(std::vector<glm::vec4>& offsets,
+		glm::vec4 position, float length, int level, int offsets_i) const;
+	void cull_instances(std::vector<glm::vec4>& offsets, const glm::vec4 planes[6],
+		const MengerView& view, glm::vec3 center, float length, int level,
+		bool inside) const;
+	void create_culled(std::vector<glm::vec4>& obj_vertices,
+		std::vector<glm::vec4>& vtx_normals, std::vector<glm::uvec3>& obj_faces,
+		glm::vec4 position, float length) const;
 
 private:
 	int nesting_level_ = 0;
+	Mode mode_ = kCubes;
+	int threads_ = 0;
 	bool dirty_ = false;
 };
 
@@ -0,0 +1,82 @@
+#ifndef MENGER_RENDERER_H
+#define MENGER_RENDERER_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <future>
+
+#include <GL/glew.h>
+
+#include "menger.h"
+#include "render_pass.h"
+#include "lights.h"
+
+struct MengerGeometry {
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::vec4> normals;
+	std::vector<glm::uvec3> faces;
+	std::vector<glm::vec4> instances; // Menger::kInstanced only
+	int level = 0;
+};
+
+// Per-frame counts for the GUI.
+struct MengerStats {
+	size_t submitted_cubes = 0; // cubes actually drawn
+	size_t total_cubes = 0;     // cubes at the full nesting level
+};
+
+/*
+ * MengerRenderer: keeps the sponge geometry and its RenderPass alive across
+ * frames. The GPU buffers are built once in setup() and only refilled when
+ * the Menger becomes dirty.
+ *
+ * Regeneration runs on a worker thread into a back buffer; the current
+ * level keeps rendering until the new one is ready and swapped in.
+ *
+ * If the Menger is in kInstanced mode when setup() runs, the pass holds one
+ * unit cube plus a per-instance offset buffer (pass a vertex shader that
+ * reads instance_offset, e.g. shaders/menger_instanced.vert). The offsets
+ * are rebuilt on the render thread whenever the view changes, with
+ * frustum culling and screen-space LOD (Menger::generate_visible_instances),
+ * so they always match the frame being drawn.
+ *
+ * In kRaymarched mode the pass holds the bounding cube only and the
+ * fragment shader (shaders/menger_sdf.frag with shaders/menger_sdf.vert)
+ * raymarches the sponge; a level change is just a uniform.
+ *
+ * The mode is fixed at setup().
+ */
+class MengerRenderer {
+public:
+	MengerRenderer(Menger* menger, glm::vec4 position);
+	~MengerRenderer();
+
+	void setup(const char* vertex_shader,
+	           const char* fragment_shader,
+	           const std::vector<ShaderUniform>& uniforms,
+	           glm::vec4 light_color);
+	// Start regenerating if the Menger is dirty, and swap in and upload
+	// the new geometry once it is ready. In kInstanced mode, re-cull the
+	// sponge against view when it changed. Call once per frame.
+	void update(const MengerView& view);
+	void render();
+	const MengerStats& stats() const { return stats_; }
+
+private:
+	Menger* menger_;
+	glm::vec4 position_;
+
+	MengerGeometry front_; // what the GPU buffers hold
+	MengerGeometry back_;  // written by the worker
+	std::future<void> pending_;
+
+	RenderPass* pass_ = nullptr;
+	Menger::Mode mode_ = Menger::kCubes;
+	MengerStats stats_;
+	MengerView last_view_; // kInstanced: view the offsets were culled for
+	int level_ = 0;        // kRaymarched: the level uniform
+	glm::vec4 bounds_;     // kRaymarched: center and edge length
+	glm::vec4 light_color_;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "filesystem.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char kMagic[4] = { 'L', 'M', 'S', 'H' };
+    // Bump whenever Mesh or the layout below changes.
+    const uint32_t kVersion = 2;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t source_size;
+        int64_t source_mtime;
+        uint64_t source_hash;
+        uint64_t settings;
+        uint32_t mesh_count;
+        uint32_t reserved;
+    };
+
+    // Followed by the vertices, uvs, normals and faces arrays.
+    struct MeshRecord {
+        uint32_t material_id;
+        uint32_t reserved;
+        uint64_t vertex_count;
+        uint64_t uv_count;
+        uint64_t normal_count;
+        uint64_t face_count;
+    };
+
+    template<typename T>
+    bool readArray(const char*& cursor, const char* end, uint64_t count, std::vector<T>& out) {
+        size_t bytes = size_t(count) * sizeof(T);
+        if (size_t(end - cursor) < bytes)
+            return false;
+        out.resize(size_t(count));
+        if (bytes)
+            memcpy(out.data(), cursor, bytes);
+        cursor += bytes;
+        return true;
+    }
+
+    template<typename T>
+    void writeArray(std::ofstream& out, const std::vector<T>& data) {
+        out.write((const char*)data.data(), data.size() * sizeof(T));
+    }
+
+    // Validate data against source and decode it. meshes is only touched
+    // on success. stale is set if only the source's mtime differs, and
+    // stale_mtime to the mtime the header should record from now on.
+    bool parseCache(const std::string& source, const char* data, size_t size, MeshCacheSettings settings,
+                    std::vector<Mesh>& meshes, bool& stale, int64_t& stale_mtime) {
+        if (size < sizeof(Header))
+            return false;
+        Header header;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion)
+            return false;
+        bool optimized = header.settings == meshProcessingSettings(true);
+        if (!optimized && header.settings != meshProcessingSettings(false))
+            return false;
+        if ((settings == kMeshCacheOptimized && !optimized) ||
+            (settings == kMeshCacheUnoptimized && optimized))
+            return false;
+
+        uint64_t source_size;
+        int64_t source_mtime;
+        if (!stat_file(source, source_size, source_mtime) || source_size != header.source_size)
+            return false;
+        stale = false;
+        if (source_mtime != header.source_mtime) {
+            uint64_t hash;
+            if (!hash_file(source, hash) || hash != header.source_hash)
+                return false;
+            stale = true;
+            stale_mtime = source_mtime;
+        }
+
+        const char* cursor = data + sizeof(Header);
+        const char* end = data + size;
+        std::vector<Mesh> cached(header.mesh_count);
+        for (Mesh& m : cached) {
+            MeshRecord record;
+            if (size_t(end - cursor) < sizeof(record))
+                return false;
+            memcpy(&record, cursor, sizeof(record));
+            cursor += sizeof(record);
+            m.material_id = record.material_id;
+            if (!readArray(cursor, end, record.vertex_count, m.vertices) ||
+                !readArray(cursor, end, record.uv_count, m.uvs) ||
+                !readArray(cursor, end, record.normal_count, m.normals) ||
+                !readArray(cursor, end, record.face_count, m.faces))
+                return false;
+        }
+        for (Mesh& m : cached)
+            meshes.push_back(std::move(m));
+        return true;
+    }
+
+    // Record the source's new mtime after its hash matched, so the next
+    // run doesn't hash it again. Patches the header in place; failing to
+    // (read-only assets) only costs that hash.
+    void refreshMtime(const std::string& file, int64_t mtime) {
+        std::fstream out(file, std::ios::binary | std::ios::in | std::ios::out);
+        if (!out)
+            return;
+        out.seekp(offsetof(Header, source_mtime));
+        out.write((const char*)&mtime, sizeof(mtime));
+    }
+};
+
+std::string meshCachePath(const std::string& source) {
+    return source + ".meshcache";
+}
+
+bool readMeshCache(const std::string& source, std::vector<Mesh>& meshes, MeshCacheSettings settings, bool map) {
+    std::string file = meshCachePath(source);
+    bool ok = false;
+    bool stale = false;
+    int64_t stale_mtime = 0;
+#ifndef _WIN32
+    if (map) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size_t size = size_t(st.st_size);
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        ok = parseCache(source, (const char*)data, size, settings, meshes, stale, stale_mtime);
+        munmap(data, size);
+    } else
+#endif
+    {
+        // No mmap on Windows, read the whole file instead.
+        std::vector<char> data;
+        if (!read_file(file, data))
+            return false;
+        ok = parseCache(source, data.data(), data.size(), settings, meshes, stale, stale_mtime);
+    }
+    if (ok && stale)
+        refreshMtime(file, stale_mtime);
+    return ok;
+}
+
+bool writeMeshCache(const std::string& source, const std::vector<Mesh>& meshes, bool optimized) {
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.settings = meshProcessingSettings(optimized);
+    header.mesh_count = uint32_t(meshes.size());
+    header.reserved = 0;
+    if (!stat_file(source, header.source_size, header.source_mtime) ||
+        !hash_file(source, header.source_hash))
+        return false;
+
+    // Write to a temporary file and rename, so a crash can't leave a
+    // truncated cache behind.
+    std::string file = meshCachePath(source);
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write((const char*)&header, sizeof(header));
+        for (const Mesh& m : meshes) {
+            MeshRecord record;
+            record.material_id = m.material_id;
+            record.reserved = 0;
+            record.vertex_count = m.vertices.size();
+            record.uv_count = m.uvs.size();
+            record.normal_count = m.normals.size();
+            record.face_count = m.faces.size();
+            out.write((const char*)&record, sizeof(record));
+            writeArray(out, m.vertices);
+            writeArray(out, m.uvs);
+            writeArray(out, m.normals);
+            writeArray(out, m.faces);
+        }
+        if (!out)
+            return false;
+    }
+    remove(file.c_str());
+    if (rename(tmp.c_str(), file.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
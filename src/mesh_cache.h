@@ -0,0 +1,47 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+/*
+ * Binary cache of the Mesh vectors Loader::loadObj builds, stored next to
+ * the source file as <source>.meshcache so later runs skip parsing the OBJ.
+ *
+ * The header records the cache format version, meshProcessingSettings()
+ * and the source size, mtime and FNV-1a hash. A size mismatch invalidates the cache; if only the
+ * mtime changed (e.g. after a checkout) the source is hashed and the cache
+ * is kept when the content is the same, with the new mtime written back so
+ * later runs skip the hash.
+ */
+
+std::string meshCachePath(const std::string& source);
+
+// Which processMeshes settings a cache may have been written with.
+enum MeshCacheSettings {
+    kMeshCacheAny,          // either, e.g. at runtime: lens_cook decides
+    kMeshCacheOptimized,    // with the optional passes
+    kMeshCacheUnoptimized,  // without, lens_cook --no-optimize
+};
+
+/*
+ * readMeshCache: append the cached meshes of source to meshes.
+ *      settings: a cache written with any other settings is not valid
+ *      map: memory-map the cache instead of reading it into a buffer
+ *      return: false if there is no valid cache, meshes is left untouched
+ */
+bool readMeshCache(const std::string& source, std::vector<Mesh>& meshes,
+                   MeshCacheSettings settings = kMeshCacheAny, bool map = true);
+
+/*
+ * writeMeshCache: write meshes as the cache of source. Failing to write
+ * (e.g. a read-only asset directory) is not an error, the next run just
+ * parses again.
+ *      optimized: meshes went through processMeshes' optional passes,
+ *              recorded in the settings hash
+ */
+bool writeMeshCache(const std::string& source, const std::vector<Mesh>& meshes, bool optimized = true);
+
+#endif
@@ -0,0 +1,433 @@
+#include "mesh_optimizer.h"
+#include "filesystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+    const char kSettings[] = "smooth normals if missing, dedup pos/normal/uv";
+    const char kOptimizeSettings[] = ", forsyth 32, overdraw 1.05, fetch";
+
+    // Vertex cache the optimizer scores for, and the one the analysis
+    // simulates (closer to real hardware).
+    const int kCacheSize = 32;
+    const int kSimulatedCache = 16;
+    // Depth buffer size for overdrawRatio.
+    const int kOverdrawGrid = 256;
+
+    // Bitwise vertex key, so only exact duplicates merge.
+    template<size_t N>
+    struct Key {
+        float v[N];
+        bool operator==(const Key& o) const { return memcmp(v, o.v, sizeof(v)) == 0; }
+    };
+
+    template<size_t N>
+    struct KeyHash {
+        size_t operator()(const Key<N>& k) const {
+            return size_t(content_hash((const char*)k.v, sizeof(k.v)));
+        }
+    };
+
+    bool hasNormals(const Mesh& mesh) {
+        if (mesh.normals.size() != mesh.vertices.size())
+            return false;
+        for (const glm::vec4& n : mesh.normals) {
+            if (n.x != 0.0f || n.y != 0.0f || n.z != 0.0f)
+                return true;
+        }
+        return mesh.vertices.empty();
+    }
+
+    // Forsyth's vertex score: recently used vertices score high, the
+    // last triangle's a bit less so strips don't win, and vertices with
+    // few triangles left get a boost so they are finished off.
+    float vertexScore(int cache_position, unsigned remaining) {
+        if (remaining == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cache_position >= 0) {
+            if (cache_position < 3)
+                score = 0.75f;
+            else
+                score = powf(1.0f - float(cache_position - 3) / (kCacheSize - 3), 1.5f);
+        }
+        return score + 2.0f * powf(float(remaining), -0.5f);
+    }
+
+    // FIFO vertex cache simulation: a vertex is cached while fewer than
+    // kSimulatedCache others were loaded after it.
+    class FifoCache {
+    public:
+        explicit FifoCache(size_t vertices) : stamps_(vertices, 0) {}
+
+        // Vertices the triangle had to load.
+        int misses(const glm::uvec3& f) {
+            int count = 0;
+            for (int j = 0; j < 3; j++) {
+                if (time_ - stamps_[f[j]] > unsigned(kSimulatedCache)) {
+                    stamps_[f[j]] = time_++;
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        void clear() { time_ += kSimulatedCache + 1; }
+
+    private:
+        std::vector<unsigned> stamps_;
+        unsigned time_ = kSimulatedCache + 1;
+    };
+
+    // Pixels covered and shaded drawing mesh from one axis direction.
+    void rasterize(const Mesh& mesh, int axis, bool flip, const glm::vec3& low, float scale,
+                   std::vector<float>& depth, size_t& covered, size_t& shaded) {
+        // Keep the screen basis right handed with the view so the winding
+        // still tells front from back.
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        if (flip)
+            std::swap(u, v);
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+        const float size = float(kOverdrawGrid);
+        for (const glm::uvec3& f : mesh.faces) {
+            glm::vec3 p[3];
+            for (int j = 0; j < 3; j++) {
+                glm::vec3 q = (glm::vec3(mesh.vertices[f[j]]) - low) * scale;
+                p[j] = glm::vec3(q[u] * size, q[v] * size, flip ? q[axis] : 1.0f - q[axis]);
+            }
+            float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+            if (area <= 0.0f)
+                continue;
+            int x0 = std::max(0, int(std::floor(std::min(std::min(p[0].x, p[1].x), p[2].x))));
+            int y0 = std::max(0, int(std::floor(std::min(std::min(p[0].y, p[1].y), p[2].y))));
+            int x1 = std::min(kOverdrawGrid - 1, int(std::ceil(std::max(std::max(p[0].x, p[1].x), p[2].x))));
+            int y1 = std::min(kOverdrawGrid - 1, int(std::ceil(std::max(std::max(p[0].y, p[1].y), p[2].y))));
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    float px = x + 0.5f, py = y + 0.5f;
+                    float w0 = (p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x);
+                    float w1 = (p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x);
+                    float w2 = area - w0 - w1;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        continue;
+                    float z = (w0 * p[0].z + w1 * p[1].z + w2 * p[2].z) / area;
+                    float& d = depth[size_t(y) * kOverdrawGrid + x];
+                    covered += d == std::numeric_limits<float>::max();
+                    if (z < d) {
+                        d = z;
+                        shaded++;
+                    }
+                }
+            }
+        }
+    }
+};
+
+uint64_t meshProcessingSettings(bool optimized) {
+    std::string settings = kSettings;
+    if (optimized)
+        settings += kOptimizeSettings;
+    return content_hash(settings.data(), settings.size());
+}
+
+bool generateNormals(Mesh& mesh) {
+    if (hasNormals(mesh))
+        return false;
+    std::unordered_map<Key<3>, glm::vec3, KeyHash<3>> sums;
+    auto key = [&mesh](unsigned i) {
+        const glm::vec4& p = mesh.vertices[i];
+        Key<3> k = { { p.x, p.y, p.z } };
+        return k;
+    };
+    for (const glm::uvec3& f : mesh.faces) {
+        glm::vec3 a(mesh.vertices[f[0]]), b(mesh.vertices[f[1]]), c(mesh.vertices[f[2]]);
+        // Not normalized: the length is twice the area, which weights it.
+        glm::vec3 n = glm::cross(b - a, c - a);
+        for (int j = 0; j < 3; j++)
+            sums[key(f[j])] += n;
+    }
+    mesh.normals.resize(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        glm::vec3 n = sums[key(unsigned(i))];
+        float len = glm::length(n);
+        mesh.normals[i] = len > 0.0f ? glm::vec4(n / len, 0.0f) : glm::vec4(0.0f);
+    }
+    return true;
+}
+
+size_t dedupVertices(Mesh& mesh) {
+    size_t count = mesh.vertices.size();
+    bool has_normals = mesh.normals.size() == count;
+    bool has_uvs = mesh.uvs.size() == count;
+
+    std::unordered_map<Key<10>, unsigned, KeyHash<10>> unique;
+    unique.reserve(count);
+    std::vector<unsigned> remap(count);
+    Mesh out;
+    out.material_id = mesh.material_id;
+    for (size_t i = 0; i < count; i++) {
+        Key<10> k;
+        memset(k.v, 0, sizeof(k.v));
+        memcpy(k.v, &mesh.vertices[i][0], 4 * sizeof(float));
+        if (has_normals)
+            memcpy(k.v + 4, &mesh.normals[i][0], 4 * sizeof(float));
+        if (has_uvs)
+            memcpy(k.v + 8, &mesh.uvs[i][0], 2 * sizeof(float));
+        auto inserted = unique.insert(std::make_pair(k, unsigned(out.vertices.size())));
+        if (inserted.second) {
+            out.vertices.push_back(mesh.vertices[i]);
+            if (has_normals)
+                out.normals.push_back(mesh.normals[i]);
+            if (has_uvs)
+                out.uvs.push_back(mesh.uvs[i]);
+        }
+        remap[i] = inserted.first->second;
+    }
+    out.faces.reserve(mesh.faces.size());
+    for (const glm::uvec3& f : mesh.faces)
+        out.faces.push_back(glm::uvec3(remap[f[0]], remap[f[1]], remap[f[2]]));
+
+    size_t removed = count - out.vertices.size();
+    mesh = std::move(out);
+    return removed;
+}
+
+void optimizeVertexCache(Mesh& mesh) {
+    size_t vertex_count = mesh.vertices.size(), face_count = mesh.faces.size();
+    if (face_count < 2)
+        return;
+
+    // Triangles using each vertex, the first remaining[v] not yet drawn.
+    std::vector<unsigned> remaining(vertex_count, 0), offsets(vertex_count + 1, 0);
+    for (const glm::uvec3& f : mesh.faces) {
+        for (int j = 0; j < 3; j++)
+            remaining[f[j]]++;
+    }
+    for (size_t v = 0; v < vertex_count; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<unsigned> adjacency(offsets[vertex_count]);
+    std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < face_count; t++) {
+        for (int j = 0; j < 3; j++)
+            adjacency[fill[mesh.faces[t][j]]++] = unsigned(t);
+    }
+
+    std::vector<int> position(vertex_count, -1);
+    std::vector<float> vertex_scores(vertex_count), face_scores(face_count);
+    for (size_t v = 0; v < vertex_count; v++)
+        vertex_scores[v] = vertexScore(-1, remaining[v]);
+    for (size_t t = 0; t < face_count; t++) {
+        const glm::uvec3& f = mesh.faces[t];
+        face_scores[t] = vertex_scores[f[0]] + vertex_scores[f[1]] + vertex_scores[f[2]];
+    }
+
+    std::vector<glm::uvec3> out;
+    out.reserve(face_count);
+    std::vector<char> drawn(face_count, 0);
+    unsigned cache[kCacheSize + 3], next_cache[kCacheSize + 3];
+    int cache_count = 0;
+    size_t cursor = 0;
+    long best = std::max_element(face_scores.begin(), face_scores.end()) - face_scores.begin();
+    while (out.size() < face_count) {
+        // Nothing left around the cache: continue in input order.
+        if (best < 0) {
+            while (drawn[cursor])
+                cursor++;
+            best = long(cursor);
+        }
+        const glm::uvec3 f = mesh.faces[best];
+        out.push_back(f);
+        drawn[best] = 1;
+
+        int count = 0;
+        for (int j = 0; j < 3; j++) {
+            unsigned v = f[j];
+            unsigned* begin = &adjacency[offsets[v]];
+            unsigned* end = begin + remaining[v];
+            *std::find(begin, end, unsigned(best)) = end[-1];
+            remaining[v]--;
+            next_cache[count++] = v;
+        }
+        for (int i = 0; i < cache_count; i++) {
+            unsigned v = cache[i];
+            if (v != f[0] && v != f[1] && v != f[2])
+                next_cache[count++] = v;
+        }
+        for (int i = 0; i < count; i++) {
+            unsigned v = next_cache[i];
+            position[v] = i < kCacheSize ? i : -1;
+            vertex_scores[v] = vertexScore(position[v], remaining[v]);
+        }
+        cache_count = std::min(count, kCacheSize);
+        std::copy(next_cache, next_cache + cache_count, cache);
+
+        // Only triangles around the cache changed score.
+        best = -1;
+        float best_score = -1.0f;
+        for (int i = 0; i < count; i++) {
+            unsigned v = next_cache[i];
+            for (unsigned k = offsets[v]; k < offsets[v] + remaining[v]; k++) {
+                unsigned t = adjacency[k];
+                const glm::uvec3& g = mesh.faces[t];
+                face_scores[t] = vertex_scores[g[0]] + vertex_scores[g[1]] + vertex_scores[g[2]];
+                if (position[v] >= 0 && face_scores[t] > best_score) {
+                    best = long(t);
+                    best_score = face_scores[t];
+                }
+            }
+        }
+    }
+    mesh.faces = std::move(out);
+}
+
+void optimizeOverdraw(Mesh& mesh, float threshold) {
+    size_t face_count = mesh.faces.size();
+    if (face_count < 2)
+        return;
+    FifoCache cache(mesh.vertices.size());
+
+    // Hard boundaries where the cache order starts over anyway (all three
+    // vertices miss), then cut those clusters wherever the part so far is
+    // already within threshold of the whole cluster's miss ratio.
+    std::vector<size_t> hard;
+    for (size_t t = 0; t < face_count; t++) {
+        if (cache.misses(mesh.faces[t]) == 3)
+            hard.push_back(t);
+    }
+    hard.push_back(face_count);
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); h++) {
+        size_t begin = hard[h], end = hard[h + 1];
+        cache.clear();
+        int misses = 0;
+        for (size_t t = begin; t < end; t++)
+            misses += cache.misses(mesh.faces[t]);
+        float limit = threshold * float(misses) / float(end - begin);
+
+        cache.clear();
+        clusters.push_back(begin);
+        int run_misses = 0, run_faces = 0;
+        for (size_t t = begin; t + 1 < end; t++) {
+            run_misses += cache.misses(mesh.faces[t]);
+            run_faces++;
+            if (float(run_misses) / float(run_faces) <= limit) {
+                clusters.push_back(t + 1);
+                cache.clear();
+                run_misses = run_faces = 0;
+            }
+        }
+    }
+    clusters.push_back(face_count);
+
+    // Sort key: how far out the cluster is along its own average normal.
+    glm::vec3 center(0.0f);
+    float total_area = 0.0f;
+    std::vector<glm::vec3> centroids(clusters.size() - 1, glm::vec3(0.0f)), normals(clusters.size() - 1, glm::vec3(0.0f));
+    std::vector<float> areas(clusters.size() - 1, 0.0f);
+    for (size_t c = 0; c + 1 < clusters.size(); c++) {
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            const glm::uvec3& f = mesh.faces[t];
+            glm::vec3 a(mesh.vertices[f[0]]), b(mesh.vertices[f[1]]), d(mesh.vertices[f[2]]);
+            glm::vec3 n = glm::cross(b - a, d - a);
+            float area = glm::length(n);
+            centroids[c] += (a + b + d) * (area / 3.0f);
+            normals[c] += n;
+            areas[c] += area;
+        }
+        center += centroids[c];
+        total_area += areas[c];
+    }
+    if (total_area > 0.0f)
+        center /= total_area;
+    std::vector<std::pair<float, size_t>> order(clusters.size() - 1);
+    for (size_t c = 0; c < order.size(); c++) {
+        glm::vec3 centroid = areas[c] > 0.0f ? centroids[c] / areas[c] : center;
+        float length = glm::length(normals[c]);
+        float key = length > 0.0f ? glm::dot(centroid - center, normals[c] / length) : 0.0f;
+        order[c] = std::make_pair(-key, c);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first < b.first; });
+
+    std::vector<glm::uvec3> out;
+    out.reserve(face_count);
+    for (const auto& o : order)
+        out.insert(out.end(), mesh.faces.begin() + clusters[o.second], mesh.faces.begin() + clusters[o.second + 1]);
+    mesh.faces = std::move(out);
+}
+
+void optimizeVertexFetch(Mesh& mesh) {
+    size_t count = mesh.vertices.size();
+    bool has_normals = mesh.normals.size() == count;
+    bool has_uvs = mesh.uvs.size() == count;
+    const unsigned unused = ~0u;
+    std::vector<unsigned> remap(count, unused);
+    Mesh out;
+    out.material_id = mesh.material_id;
+    out.faces.reserve(mesh.faces.size());
+    for (const glm::uvec3& f : mesh.faces) {
+        glm::uvec3 g;
+        for (int j = 0; j < 3; j++) {
+            unsigned& r = remap[f[j]];
+            if (r == unused) {
+                r = unsigned(out.vertices.size());
+                out.vertices.push_back(mesh.vertices[f[j]]);
+                if (has_normals)
+                    out.normals.push_back(mesh.normals[f[j]]);
+                if (has_uvs)
+                    out.uvs.push_back(mesh.uvs[f[j]]);
+            }
+            g[j] = r;
+        }
+        out.faces.push_back(g);
+    }
+    mesh = std::move(out);
+}
+
+float vertexCacheMissRatio(const Mesh& mesh) {
+    if (mesh.faces.empty())
+        return 0.0f;
+    FifoCache cache(mesh.vertices.size());
+    size_t misses = 0;
+    for (const glm::uvec3& f : mesh.faces)
+        misses += cache.misses(f);
+    return float(misses) / float(mesh.faces.size());
+}
+
+float overdrawRatio(const Mesh& mesh) {
+    if (mesh.faces.empty())
+        return 0.0f;
+    glm::vec3 low(mesh.vertices[0]), high(mesh.vertices[0]);
+    for (const glm::vec4& p : mesh.vertices) {
+        low = glm::min(low, glm::vec3(p));
+        high = glm::max(high, glm::vec3(p));
+    }
+    glm::vec3 extent = high - low;
+    float largest = std::max(std::max(extent.x, extent.y), extent.z);
+    // Slightly under one so the far edge still lands on the grid.
+    float scale = largest > 0.0f ? 0.999f / largest : 0.0f;
+
+    std::vector<float> depth(size_t(kOverdrawGrid) * kOverdrawGrid);
+    size_t covered = 0, shaded = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        rasterize(mesh, axis, false, low, scale, depth, covered, shaded);
+        rasterize(mesh, axis, true, low, scale, depth, covered, shaded);
+    }
+    return covered ? float(shaded) / float(covered) : 0.0f;
+}
+
+void processMeshes(std::vector<Mesh>& meshes, bool optimize) {
+    for (Mesh& m : meshes) {
+        generateNormals(m);
+        dedupVertices(m);
+        if (optimize) {
+            optimizeVertexCache(m);
+            optimizeOverdraw(m);
+            optimizeVertexFetch(m);
+        }
+    }
+}
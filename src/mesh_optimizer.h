@@ -0,0 +1,73 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+
+/*
+ * Processing every imported mesh goes through before it is cached, by
+ * ./bin/lens_cook or by Loader::loadObj on a cache miss.
+ */
+
+// Identifies the steps below; stored in the mesh cache so changing them
+// invalidates caches made with the old ones.
+//      optimized: whether the vertex cache, overdraw and fetch passes ran
+uint64_t meshProcessingSettings(bool optimized = true);
+
+/*
+ * generateNormals: smooth, area weighted vertex normals, shared by all
+ * vertices at the same position. Only done when the mesh has none (the
+ * importer leaves them zero).
+ *      return: whether normals were generated
+ */
+bool generateNormals(Mesh& mesh);
+
+/*
+ * dedupVertices: merge vertices with identical position, normal and uv
+ * and reindex the faces. OBJ import gives every face corner its own
+ * vertex, so this typically shrinks the vertex arrays several times.
+ *      return: the number of vertices removed
+ */
+size_t dedupVertices(Mesh& mesh);
+
+/*
+ * optimizeVertexCache: reorder the faces so vertices are reused while
+ * still in the post-transform cache (Forsyth's linear-speed vertex cache
+ * optimization, scored for a 32 entry LRU cache).
+ */
+void optimizeVertexCache(Mesh& mesh);
+
+/*
+ * optimizeOverdraw: cut the vertex cache order into clusters and sort
+ * them so outward facing clusters far from the center come first, which
+ * draws roughly front to back from any direction (Sander et al., "Fast
+ * Triangle Reordering for Vertex Locality and Reduced Overdraw").
+ *      threshold: how much worse than the input's ACMR a cluster may get
+ *              from being cut smaller
+ */
+void optimizeOverdraw(Mesh& mesh, float threshold = 1.05f);
+
+/*
+ * optimizeVertexFetch: renumber the vertices in the order the faces
+ * first use them, so vertex fetches walk the buffers forwards. Unused
+ * vertices are dropped.
+ */
+void optimizeVertexFetch(Mesh& mesh);
+
+// Average cache miss ratio: transformed vertices per triangle with a 16
+// entry FIFO cache, 0.5 at best and 3 at worst.
+float vertexCacheMissRatio(const Mesh& mesh);
+
+// Pixels shaded per pixel covered, drawing the mesh in order with back
+// faces culled, averaged over views along the six axis directions.
+float overdrawRatio(const Mesh& mesh);
+
+/*
+ * processMeshes: everything above, on all meshes.
+ *      optimize: also run the vertex cache, overdraw and fetch passes
+ */
+void processMeshes(std::vector<Mesh>& meshes, bool optimize = true);
+
+#endif
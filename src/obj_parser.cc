@@ -0,0 +1,579 @@
+#include "obj_parser.h"
+#include "filesystem.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Less text than this per chunk isn't worth a thread.
+    const size_t kMinChunk = 256 * 1024;
+    // aiProcess_Triangulate drops polygon pieces smaller than this.
+    const double kMinArea = 1e-5;
+
+    // The whole file, memory-mapped where possible.
+    class Source {
+    public:
+        ~Source() {
+#ifndef _WIN32
+            if (mapped_)
+                munmap((void*)data_, size_);
+#endif
+        }
+
+        bool open(const char* path) {
+#ifndef _WIN32
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    data_ = (const char*)data;
+                    size_ = size_t(st.st_size);
+                    mapped_ = true;
+                }
+            }
+            close(fd);
+            if (mapped_)
+                return true;
+#endif
+            // No mmap on Windows, read the whole file instead.
+            if (!read_file(path, buffer_))
+                return false;
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+            return true;
+        }
+
+        const char* begin() const { return data_; }
+        const char* end() const { return data_ + size_; }
+        size_t size() const { return size_; }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+        bool mapped_ = false;
+        std::vector<char> buffer_;
+    };
+
+    enum {
+        kHasUv = 1,
+        kHasNormal = 2,
+        // Negative OBJ indices count back from the end of their chunk's
+        // data so far; these are stored chunk relative until the chunk's
+        // base is known.
+        kRelativeVertex = 4,
+        kRelativeUv = 8,
+        kRelativeNormal = 16,
+    };
+
+    struct Corner {
+        int vertex, uv, normal;
+        unsigned flags;
+    };
+
+    // A usemtl, g, o or mtllib line, seen before face `face` of its chunk.
+    struct Statement {
+        size_t face;
+        char kind;
+        std::string name;
+    };
+
+    // The faces of a chunk after a group of statements, built into a mesh
+    // of their own to be appended to the right output mesh later.
+    struct Part {
+        size_t statements_begin, statements_end;
+        Mesh mesh;
+        bool has_uvs = false;
+    };
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+        std::vector<Corner> corners;
+        std::vector<size_t> face_ends;  // into corners
+        std::vector<Statement> statements;
+        // Data in the chunks before this one.
+        size_t position_base = 0, uv_base = 0, normal_base = 0;
+        std::vector<Part> parts;
+        size_t bad_faces = 0;
+    };
+
+    const double kPow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline bool isDigit(char c) {
+        return unsigned(c - '0') < 10;
+    }
+
+    inline const char* skipSpace(const char* p, const char* end) {
+        while (p < end && isSpace(*p))
+            p++;
+        return p;
+    }
+
+    /*
+     * Decimal to float without strtod's locale handling: up to 19
+     * significant digits are collected exactly and scaled by a power of
+     * ten in double precision, which is plenty for a float.
+     * Returns the end of the number, p itself if there is none.
+     */
+    const char* parseFloat(const char* p, const char* end, float& out) {
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool any = false;
+        for (; p < end && isDigit(*p); p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + unsigned(*p - '0');
+                digits += mantissa != 0;
+            } else {
+                exponent++;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && isDigit(*p); p++, any = true) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + unsigned(*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+            }
+        }
+        if (!any) {
+            out = 0.0f;
+            return start;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char* q = p + 1;
+            bool negative_exponent = false;
+            if (q < end && (*q == '-' || *q == '+'))
+                negative_exponent = *q++ == '-';
+            if (q < end && isDigit(*q)) {
+                int e = 0;
+                for (; q < end && isDigit(*q); q++)
+                    e = e < 10000 ? e * 10 + (*q - '0') : e;
+                exponent += negative_exponent ? -e : e;
+                p = q;
+            }
+        }
+        double value = double(mantissa);
+        if (mantissa != 0) {
+            for (; exponent > 22; exponent -= 22)
+                value *= kPow10[22];
+            for (; exponent < -22; exponent += 22)
+                value /= kPow10[22];
+            value = exponent < 0 ? value / kPow10[-exponent] : value * kPow10[exponent];
+        }
+        out = float(negative ? -value : value);
+        return p;
+    }
+
+    // Returns the end of the index, p itself if there is none.
+    inline const char* parseIndex(const char* p, const char* end, int& out) {
+        const char* start = p;
+        bool negative = p < end && *p == '-';
+        if (negative)
+            p++;
+        int value = 0;
+        const char* digits = p;
+        for (; p < end && isDigit(*p); p++)
+            value = value * 10 + (*p - '0');
+        if (p == digits)
+            return start;
+        out = negative ? -value : value;
+        return p;
+    }
+
+    template <int N, typename V>
+    void parseVector(const char* p, const char* end, std::vector<V>& out) {
+        V v(0.0f);
+        for (int i = 0; i < N; i++)
+            p = parseFloat(skipSpace(p, end), end, v[i]);
+        out.push_back(v);
+    }
+
+    // Store an OBJ index (1 based, or negative from the end) as 0 based.
+    inline bool storeIndex(int index, size_t count, int& out, unsigned& flags, unsigned relative) {
+        if (index > 0) {
+            out = index - 1;
+        } else if (index < 0) {
+            out = int(count) + index;
+            flags |= relative;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void parseFace(const char* p, const char* end, Chunk& chunk) {
+        size_t first = chunk.corners.size();
+        for (p = skipSpace(p, end); p < end; p = skipSpace(p, end)) {
+            Corner c = { 0, 0, 0, 0 };
+            int index;
+            const char* q = parseIndex(p, end, index);
+            bool ok = q != p && storeIndex(index, chunk.positions.size(), c.vertex, c.flags, kRelativeVertex);
+            if (ok && q < end && *q == '/') {
+                p = q + 1;
+                q = parseIndex(p, end, index);
+                if (q != p) {
+                    ok = storeIndex(index, chunk.uvs.size(), c.uv, c.flags, kRelativeUv);
+                    c.flags |= kHasUv;
+                }
+                if (ok && q < end && *q == '/') {
+                    p = q + 1;
+                    q = parseIndex(p, end, index);
+                    ok = q != p && storeIndex(index, chunk.normals.size(), c.normal, c.flags, kRelativeNormal);
+                    c.flags |= kHasNormal;
+                }
+            }
+            if (!ok || (q < end && !isSpace(*q))) {
+                chunk.corners.resize(first);
+                chunk.bad_faces++;
+                return;
+            }
+            chunk.corners.push_back(c);
+            p = q;
+        }
+        if (chunk.corners.size() - first < 3) {
+            chunk.corners.resize(first);
+            return;
+        }
+        chunk.face_ends.push_back(chunk.corners.size());
+    }
+
+    // Everything after the keyword, without surrounding space.
+    std::string restOfLine(const char* p, const char* end) {
+        p = skipSpace(p, end);
+        while (end > p && isSpace(end[-1]))
+            end--;
+        return std::string(p, end);
+    }
+
+    inline bool keyword(const char* p, const char* end, const char* word, size_t length) {
+        return size_t(end - p) > length && memcmp(p, word, length) == 0 && isSpace(p[length]);
+    }
+
+    void parseLine(const char* p, const char* end, Chunk& chunk) {
+        p = skipSpace(p, end);
+        if (end - p < 2)
+            return;
+        char c = p[0], c1 = p[1];
+        if (c == 'v') {
+            if (isSpace(c1))
+                parseVector<3>(p + 2, end, chunk.positions);
+            else if (c1 == 't' && keyword(p, end, "vt", 2))
+                parseVector<2>(p + 3, end, chunk.uvs);
+            else if (c1 == 'n' && keyword(p, end, "vn", 2))
+                parseVector<3>(p + 3, end, chunk.normals);
+        } else if (c == 'f' && isSpace(c1)) {
+            parseFace(p + 2, end, chunk);
+        } else if ((c == 'g' || c == 'o') && isSpace(c1)) {
+            Statement s = { chunk.face_ends.size(), c, restOfLine(p + 2, end) };
+            chunk.statements.push_back(s);
+        } else if (keyword(p, end, "usemtl", 6) || keyword(p, end, "mtllib", 6)) {
+            Statement s = { chunk.face_ends.size(), c, restOfLine(p + 7, end) };
+            chunk.statements.push_back(s);
+        }
+    }
+
+    void parseChunk(Chunk& chunk) {
+        for (const char* p = chunk.begin; p < chunk.end;) {
+            const char* eol = (const char*)memchr(p, '\n', chunk.end - p);
+            if (!eol)
+                eol = chunk.end;
+            parseLine(p, eol, chunk);
+            p = eol + 1;
+        }
+    }
+
+    // Twice the signed area, as Assimp's GetArea2D.
+    inline double area2D(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c) {
+        return 0.5 * (a.x * (double(c.y) - b.y) + b.x * (double(a.y) - c.y) + c.x * (double(b.y) - a.y));
+    }
+
+    inline bool pointInTriangle2D(const glm::vec2& p0, const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p) {
+        glm::dvec2 v0(p1 - p0), v1(p2 - p0), v2(p - p0);
+        double dot00 = glm::dot(v0, v0), dot01 = glm::dot(v0, v1), dot02 = glm::dot(v0, v2);
+        double dot11 = glm::dot(v1, v1), dot12 = glm::dot(v1, v2);
+        double inv = 1.0 / (dot00 * dot11 - dot01 * dot01);
+        double u = (dot11 * dot02 - dot01 * dot12) * inv;
+        double v = (dot00 * dot12 - dot01 * dot02) * inv;
+        return u > 0 && v > 0 && u + v < 1;
+    }
+
+    /*
+     * Cut the polygon v[0..count) into triangles indexing from base, the
+     * same way aiProcess_Triangulate does: project it along the largest
+     * axis of its Newell normal, clip ears starting from the first corner
+     * and drop near zero area pieces. Where Assimp gives up on a polygon
+     * that isn't simple, the rest is fanned instead.
+     */
+    void triangulate(const glm::vec4* v, int count, unsigned base, std::vector<glm::uvec3>& faces) {
+        if (count == 3) {
+            faces.push_back(glm::uvec3(base, base + 1, base + 2));
+            return;
+        }
+        glm::vec3 n(0.0f);
+        for (int i = 0; i < count; i++) {
+            const glm::vec4& a = v[(i + count - 1) % count];
+            const glm::vec4& b = v[i];
+            const glm::vec4& c = v[(i + 1) % count];
+            n.x += b.y * (c.z - a.z);
+            n.y += b.z * (c.x - a.x);
+            n.z += b.x * (c.y - a.y);
+        }
+        int ac = 0, bc = 1;
+        float inv = n.z;
+        glm::vec3 an = glm::abs(n);
+        if (an.x > an.y) {
+            if (an.x > an.z) {
+                ac = 1; bc = 2;
+                inv = n.x;
+            }
+        } else if (an.y > an.z) {
+            ac = 2; bc = 0;
+            inv = n.y;
+        }
+        if (inv < 0.0f)
+            std::swap(ac, bc);
+
+        std::vector<glm::vec2> p(count);
+        std::vector<char> done(count, 0);
+        for (int i = 0; i < count; i++)
+            p[i] = glm::vec2(v[i][ac], v[i][bc]);
+
+        std::vector<glm::ivec3> out;
+        int num = count, ear = 0, prev = count - 1, next = 0;
+        while (num > 3) {
+            int found = 0;
+            for (ear = next;; prev = ear, ear = next) {
+                for (next = ear + 1; done[next >= count ? (next = 0) : next]; ++next)
+                    ;
+                if (next < ear && ++found == 2)
+                    break;
+                if (area2D(p[prev], p[ear], p[next]) > 0)
+                    continue;
+                int i = 0;
+                for (; i < count; i++) {
+                    if (p[i] != p[prev] && p[i] != p[ear] && p[i] != p[next] &&
+                        pointInTriangle2D(p[prev], p[ear], p[next], p[i]))
+                        break;
+                }
+                if (i == count)
+                    break;
+            }
+            if (found == 2)
+                break;
+            out.push_back(glm::ivec3(prev, ear, next));
+            done[ear] = 1;
+            --num;
+        }
+        // The last ear, or the fan of what was left.
+        std::vector<int> left;
+        for (int i = 0; i < count; i++) {
+            if (!done[i])
+                left.push_back(i);
+        }
+        for (size_t i = 2; i < left.size(); i++)
+            out.push_back(glm::ivec3(left[0], left[i - 1], left[i]));
+
+        for (const glm::ivec3& t : out) {
+            if (std::fabs(area2D(p[t.x], p[t.y], p[t.z])) >= kMinArea)
+                faces.push_back(glm::uvec3(t) + base);
+        }
+    }
+
+    // Turn the chunk's faces into parts, indices resolved against the
+    // merged data.
+    void buildParts(Chunk& chunk, const std::vector<glm::vec3>& positions,
+                    const std::vector<glm::vec2>& uvs, const std::vector<glm::vec3>& normals) {
+        size_t s = 0, first = 0;
+        Part* part = nullptr;
+        for (size_t f = 0; f < chunk.face_ends.size(); f++) {
+            size_t last = chunk.face_ends[f];
+            if (!part || (s < chunk.statements.size() && chunk.statements[s].face == f)) {
+                chunk.parts.push_back(Part());
+                part = &chunk.parts.back();
+                part->statements_begin = s;
+                while (s < chunk.statements.size() && chunk.statements[s].face == f)
+                    s++;
+                part->statements_end = s;
+            }
+
+            // Resolve and check the indices first, a bad face is skipped.
+            bool ok = true;
+            for (size_t i = first; i < last && ok; i++) {
+                Corner& c = chunk.corners[i];
+                if (c.flags & kRelativeVertex)
+                    c.vertex += int(chunk.position_base);
+                if (c.flags & kRelativeUv)
+                    c.uv += int(chunk.uv_base);
+                if (c.flags & kRelativeNormal)
+                    c.normal += int(chunk.normal_base);
+                c.flags &= kHasUv | kHasNormal;
+                ok = c.vertex >= 0 && size_t(c.vertex) < positions.size() &&
+                     (!(c.flags & kHasUv) || (c.uv >= 0 && size_t(c.uv) < uvs.size())) &&
+                     (!(c.flags & kHasNormal) || (c.normal >= 0 && size_t(c.normal) < normals.size()));
+            }
+            if (!ok) {
+                chunk.bad_faces++;
+                first = last;
+                continue;
+            }
+
+            Mesh& m = part->mesh;
+            unsigned base = unsigned(m.vertices.size());
+            for (size_t i = first; i < last; i++) {
+                const Corner& c = chunk.corners[i];
+                m.vertices.push_back(glm::vec4(positions[c.vertex], 1.0f));
+                m.normals.push_back(c.flags & kHasNormal ? glm::vec4(normals[c.normal], 0.0f) : glm::vec4(0.0f));
+                m.uvs.push_back(c.flags & kHasUv ? uvs[c.uv] : glm::vec2(0.0f));
+                part->has_uvs |= (c.flags & kHasUv) != 0;
+            }
+            triangulate(&m.vertices[base], int(last - first), base, m.faces);
+            first = last;
+        }
+        // Statements after the last face still matter to the next chunk.
+        if (s < chunk.statements.size()) {
+            chunk.parts.push_back(Part());
+            chunk.parts.back().statements_begin = s;
+            chunk.parts.back().statements_end = chunk.statements.size();
+        }
+    }
+
+    // Add the newmtl names of an mtllib to materials, numbered from 1 on.
+    void readMaterialNames(const char* path, const std::string& lib,
+                           std::unordered_map<std::string, unsigned>& materials, unsigned& count) {
+        std::vector<char> data;
+        if (!read_file(mtl_path(path, lib), data)) {
+            printf("parseObj(): warning could not read material library %s!\n", lib.c_str());
+            return;
+        }
+        const char* end = data.data() + data.size();
+        for (const char* p = data.data(); p < end;) {
+            const char* eol = (const char*)memchr(p, '\n', end - p);
+            if (!eol)
+                eol = end;
+            const char* q = skipSpace(p, eol);
+            if (keyword(q, eol, "newmtl", 6))
+                materials.insert(std::make_pair(restOfLine(q + 7, eol), ++count));
+            p = eol + 1;
+        }
+    }
+};
+
+bool parseObj(const char* path, std::vector<Mesh>& meshes, int threads) {
+    Source source;
+    if (!source.open(path))
+        return false;
+    if (threads <= 0)
+        threads = hardware_threads();
+
+    // Line-aligned chunks, a couple per thread so uneven ones balance.
+    size_t count = std::max<size_t>(1, std::min(source.size() / kMinChunk, size_t(threads) * 2));
+    std::vector<Chunk> chunks(count);
+    const char* p = source.begin();
+    for (size_t i = 0; i < count; i++) {
+        const char* end = source.begin() + source.size() * (i + 1) / count;
+        if (end < p)
+            end = p;
+        const char* eol = (const char*)memchr(end, '\n', source.end() - end);
+        end = i + 1 == count || !eol ? source.end() : eol + 1;
+        chunks[i].begin = p;
+        chunks[i].end = end;
+        p = end;
+    }
+    parallel_for(int(count), threads, [&chunks](int i) { parseChunk(chunks[i]); });
+
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+    for (Chunk& c : chunks) {
+        c.position_base = positions.size();
+        c.uv_base = uvs.size();
+        c.normal_base = normals.size();
+        positions.insert(positions.end(), c.positions.begin(), c.positions.end());
+        uvs.insert(uvs.end(), c.uvs.begin(), c.uvs.end());
+        normals.insert(normals.end(), c.normals.begin(), c.normals.end());
+    }
+    parallel_for(int(count), threads, [&](int i) { buildParts(chunks[i], positions, uvs, normals); });
+
+    // Stitch the parts in file order, starting a new mesh whenever the
+    // material or group changes.
+    std::unordered_map<std::string, unsigned> materials;
+    unsigned material_count = 0, material = 0;
+    std::string group;
+    std::vector<Mesh> out;
+    std::vector<bool> out_uvs;
+    std::string out_group;
+    size_t bad_faces = 0;
+    for (Chunk& c : chunks) {
+        bad_faces += c.bad_faces;
+        for (Part& part : c.parts) {
+            for (size_t s = part.statements_begin; s < part.statements_end; s++) {
+                const Statement& st = c.statements[s];
+                if (st.kind == 'm') {
+                    readMaterialNames(path, st.name, materials, material_count);
+                } else if (st.kind == 'u') {
+                    auto found = materials.find(st.name);
+                    material = found == materials.end() ? 0 : found->second;
+                } else {
+                    group = st.name;
+                }
+            }
+            if (part.mesh.faces.empty())
+                continue;
+            if (out.empty() || out.back().material_id != material || out_group != group) {
+                part.mesh.material_id = material;
+                out.push_back(std::move(part.mesh));
+                out_uvs.push_back(part.has_uvs);
+                out_group = group;
+                continue;
+            }
+            Mesh& m = out.back();
+            unsigned base = unsigned(m.vertices.size());
+            m.vertices.insert(m.vertices.end(), part.mesh.vertices.begin(), part.mesh.vertices.end());
+            m.normals.insert(m.normals.end(), part.mesh.normals.begin(), part.mesh.normals.end());
+            m.uvs.insert(m.uvs.end(), part.mesh.uvs.begin(), part.mesh.uvs.end());
+            for (const glm::uvec3& f : part.mesh.faces)
+                m.faces.push_back(f + base);
+            out_uvs.back() = out_uvs.back() || part.has_uvs;
+        }
+    }
+    if (bad_faces)
+        printf("parseObj(): warning skipped %lu faces with bad indices in %s!\n", (unsigned long)bad_faces, path);
+    if (out.empty())
+        return false;
+
+    for (size_t i = 0; i < out.size(); i++) {
+        if (!out_uvs[i])
+            out[i].uvs.clear();
+        meshes.push_back(std::move(out[i]));
+    }
+    return true;
+}
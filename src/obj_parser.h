@@ -0,0 +1,33 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include <vector>
+
+#include "mesh.h"
+
+/*
+ * Wavefront OBJ reader used by Loader::loadObj instead of Assimp. The file
+ * is memory-mapped and cut into line-aligned chunks that are parsed on all
+ * cores; the Mesh vectors are then built directly, again a chunk per
+ * thread, and stitched together.
+ *
+ * The output matches what Loader::importObj gives for the same file:
+ *      - every face corner is its own vertex, in file order
+ *      - polygons are ear-clipped the way aiProcess_Triangulate does
+ *      - a new mesh starts when usemtl, g or o switch to another name
+ *      - normals are zero where a mesh has none, uvs empty if it has none
+ *      - material_id is 0 for no/unknown material, otherwise 1 + the
+ *        material's position in the mtllib
+ * Only the material names are read from the mtllib, as Loader doesn't use
+ * the rest. Points and lines are skipped.
+ */
+
+/*
+ * parseObj: append the meshes of the OBJ file at path.
+ *      threads: parser threads, <= 0 means hardware_threads()
+ *      return: false if the file can't be read or has no faces, meshes is
+ *              left untouched
+ */
+bool parseObj(const char* path, std::vector<Mesh>& meshes, int threads = 0);
+
+#endif
@@ -1,4 +1,6 @@
 #include "object.h"
+#include "light_clusters.h"
+#include "shader_permutation.h"
 
 const char* picker_fragment_shader =
 #include "shaders/picker.frag"
@@ -8,10 +10,24 @@ const char* picker_vertex_shader =
 #include "shaders/picker.vert"
 ;
 
+const char* object_packed_vertex_shader =
+#include "shaders/object_packed.vert"
+;
+
+const char* picker_packed_vertex_shader =
+#include "shaders/picker_packed.vert"
+;
+
+const char* gbuffer_fragment_shader =
+#include "shaders/gbuffer.frag"
+;
+
 Object::Object(std::string name) {
     this->name = name;
-    loader = new Loader();
     this->color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    this->static_mesh = true;
+    this->initialized = false;
+    this->gbuffer_pass = nullptr;
     object_id = object_count++;
     // fill with dummy white value
     color_id_vec = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
@@ -22,7 +38,7 @@ Object::~Object() {
 }
 
 void Object::load(std::string file) {
-    loader->loadObj(path(file).c_str(), meshes, materials);
+    mesh_file = path(file);
 }
 
 void Object::shaders(
@@ -51,24 +67,17 @@ void Object::uniforms(
     this->std_view_position = std_view_position;
 }
 
-void Object::lights(
-    std::vector<DirectionalLight> directionalLights,
-    std::vector<PointLight> pointLights,
-    std::vector<SpotLight> spotLights
-    ) {
-
-    this->directionalLights = directionalLights;
-    this->pointLights = pointLights;
-    this->spotLights = spotLights;
-}
-
 void Object::lightColor(glm::vec4 c) {
     this->color = c;
 }
 
 void Object::textures(const char* diffuse, const char* specular) {
-    diffuseMap = loader->loadTexture(path(std::string(diffuse)).c_str());
-    specularMap = loader->loadTexture(path(std::string(specular)).c_str());
+    diffuse_file = path(std::string(diffuse));
+    specular_file = specular ? path(std::string(specular)) : std::string();
+}
+
+void Object::staticMesh(bool s) {
+    this->static_mesh = s;
 }
 
 glm::mat4 Object::translate(glm::mat4 model_matrix, glm::vec3 t) {
@@ -86,6 +95,19 @@ glm::mat4 Object::scale(glm::mat4 model_matrix, glm::vec3 s) {
 void Object::setup() {
     unsigned int i = 0;
 
+    if (initialized)
+        return;
+    if (!mesh) {
+        AssetRegistry& assets = AssetRegistry::get();
+        mesh = assets.mesh(mesh_file);
+        diffuseMap = assets.texture(diffuse_file);
+        if (!specular_file.empty())
+            specularMap = assets.texture(specular_file);
+    }
+    // Still uploading in the background, render() tries again.
+    if (!mesh->resident() || !diffuseMap->resident() || (specularMap && !specularMap->resident()))
+        return;
+
     // Create the ShaderUniform for this object_id
     int r = (object_id & 0x000000FF) >>  0;
     int g = (object_id & 0x0000FF00) >>  8;
@@ -100,37 +122,155 @@ void Object::setup() {
       glUniform4fv(loc, 1, (const GLfloat*)data);
     };
     ShaderUniform color_id_uniform = { "id_color", vector4_binder, std_color_id_data };
+    // Per draw, the program is shared with every other Object.
+    glm::vec4* light_color = &color;
+    ShaderUniform light_color_uniform = { "light_color", vector4_binder, [light_color]() -> const void* {
+        return &(*light_color)[0];
+    } };
 
-    RenderDataInput id_pass_input;
-    id_pass_input.assign(0, "vertex_position", meshes[i].vertices.data(), meshes[i].vertices.size(), 4, GL_FLOAT);
-    id_pass_input.assign_index(meshes[i].faces.data(), meshes[i].faces.size(), 3);
+    const Mesh& m = mesh->meshes[i];
+    RenderDataInput model_pass_input;
+    std::vector<ShaderUniform> model_uniforms = {std_model, std_view, std_projection, std_light, std_view_position,
+        light_color_uniform};
+    std::vector<ShaderUniform> id_uniforms = {std_model, std_view, std_projection, color_id_uniform};
+    const char* model_vertex_shader = vertex_shader;
+    // The fragment shader specialized for the scene's light counts and the
+    // features this object uses, see shader_permutation.h. Objects that
+    // agree share the variant's program.
+    ShaderPermutation permutation = ShaderPermutation::currentLights();
+    permutation.textured = !m.uvs.empty();
+    permutation.emissive = color != glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    permutation.specular = bool(specularMap);
+    const char* model_fragment_shader = permuteShader(fragment_shader, permutation);
+    const char* id_vertex_shader = picker_vertex_shader;
+    index_type = GL_UNSIGNED_INT;
+    if (static_mesh) {
+        // Draw straight from the buffers every user of this file shares.
+        const MeshBuffers& buffers = mesh->buffers(i);
+        if (buffers.packed) {
+            model_pass_input.assign_buffer(0, "vertex_position", buffers.vertices, m.vertices.size(), 4,
+                GL_UNSIGNED_SHORT, kAttribInteger, buffers.stride, 0);
+            if (buffers.has_uvs)
+                model_pass_input.assign_buffer(2, "vertex_uv", buffers.vertices, m.uvs.size(), 2,
+                    GL_UNSIGNED_SHORT, kAttribNormalized, buffers.stride, buffers.uv_offset);
 
-    id_pass = new RenderPass(
+            // buffers stays put for as long as mesh is held
+            const MeshBuffers* decode = &buffers;
+            auto vector3_binder = [](int loc, const void* data) {
+                glUniform3fv(loc, 1, (const GLfloat*)data);
+            };
+            ShaderUniform offset = { "position_offset", vector3_binder, [decode]() -> const void* {
+                return &decode->position_offset[0];
+            } };
+            ShaderUniform scale = { "position_scale", vector3_binder, [decode]() -> const void* {
+                return &decode->position_scale[0];
+            } };
+            ShaderUniform uv_transform = { "uv_transform", vector4_binder, [decode]() -> const void* {
+                return &decode->uv_transform[0];
+            } };
+            model_uniforms.insert(model_uniforms.end(), {offset, scale, uv_transform});
+            id_uniforms.insert(id_uniforms.end(), {offset, scale});
+            model_vertex_shader = object_packed_vertex_shader;
+            id_vertex_shader = picker_packed_vertex_shader;
+        } else {
+            model_pass_input.assign_buffer(0, "vertex_position", buffers.vertices, m.vertices.size(), 4,
+                GL_FLOAT, kAttribFloat, buffers.stride, 0);
+            model_pass_input.assign_buffer(1, "vertex_normal", buffers.vertices, m.normals.size(), 4,
+                GL_FLOAT, kAttribFloat, buffers.stride, buffers.normal_offset);
+            if (buffers.has_uvs)
+                model_pass_input.assign_buffer(2, "vertex_uv", buffers.vertices, m.uvs.size(), 2,
+                    GL_FLOAT, kAttribFloat, buffers.stride, buffers.uv_offset);
+        }
+        model_pass_input.assign_index_buffer(buffers.indices, m.faces.size(), 3, buffers.index_type);
+        index_type = buffers.index_type;
+    } else {
+        // Dynamic meshes get their own copy so updates don't touch the shared one.
+        model_pass_input.assign(0, "vertex_position", m.vertices.data(), m.vertices.size(), 4, GL_FLOAT);
+        model_pass_input.assign(1, "vertex_normal", m.normals.data(), m.normals.size(), 4, GL_FLOAT);
+        model_pass_input.assign(2, "vertex_uv", m.uvs.data(), m.uvs.size(), 2, GL_FLOAT);
+        model_pass_input.assign_index(m.faces.data(), m.faces.size(), 3);
+    }
+
+    // The G-buffer pass doesn't light anything.
+    gbuffer_uniforms = model_uniforms;
+    if (permutation.clustered) {
+        // The cluster buffer textures and the grid of the current bin().
+        auto int_binder = [](int loc, const void* data) {
+            glUniform1i(loc, *(const int*)data);
+        };
+        auto vector2_binder = [](int loc, const void* data) {
+            glUniform2fv(loc, 1, (const GLfloat*)data);
+        };
+        static const int units[3] = { LightClusters::kTextureUnit, LightClusters::kTextureUnit + 1,
+                                      LightClusters::kTextureUnit + 2 };
+        const LightClusters* clusters = &LightClusters::get();
+        model_uniforms.insert(model_uniforms.end(), {
+            { "cluster_lights", int_binder, []() -> const void* { return &units[0]; } },
+            { "cluster_table", int_binder, []() -> const void* { return &units[1]; } },
+            { "cluster_indices", int_binder, []() -> const void* { return &units[2]; } },
+            { "cluster_depth", vector2_binder, [clusters]() -> const void* { return &clusters->depthParams()[0]; } },
+            { "cluster_tile", vector2_binder, [clusters]() -> const void* { return &clusters->tileSize()[0]; } },
+        });
+    }
+
+    model_pass = new RenderPass(
         -1,
-        id_pass_input,
-        {picker_vertex_shader, geometry_shader, picker_fragment_shader},
-        {std_model, std_view, std_projection, color_id_uniform},
+        model_pass_input,
+        {model_vertex_shader, geometry_shader, model_fragment_shader},
+        model_uniforms,
         {"fragment_color"}
     );
 
-    // model render pass
-    RenderDataInput model_pass_input;
-    model_pass_input.assign(0, "vertex_position", meshes[i].vertices.data(), meshes[i].vertices.size(), 4, GL_FLOAT);
-    model_pass_input.assign(1, "normal", meshes[i].normals.data(), meshes[i].normals.size(), 4, GL_FLOAT);
-    model_pass_input.assign(2, "uv", meshes[i].uvs.data(), meshes[i].uvs.size(), 2, GL_FLOAT);
-    model_pass_input.assign_index(meshes[i].faces.data(), meshes[i].faces.size(), 3);
+    // id pass reads the positions and indices already on the GPU
+    RenderDataInput id_pass_input;
+    RenderInputMeta position = model_pass->getVBOMeta(0);
+    id_pass_input.assign_buffer(0, "vertex_position", model_pass->getVBO(0), position.nelements, 4,
+        position.element_type, position.conversion, position.stride, position.offset);
+    id_pass_input.assign_index_buffer(model_pass->getIndexBuffer(), m.faces.size(), 3, index_type);
 
-    model_pass = new RenderPass(
+    id_pass = new RenderPass(
         -1,
-        model_pass_input,
-        {vertex_shader, geometry_shader, fragment_shader},
-        {std_model, std_view, std_projection, std_light, std_view_position},
+        id_pass_input,
+        {id_vertex_shader, geometry_shader, picker_fragment_shader},
+        id_uniforms,
         {"fragment_color"}
     );
 
-    model_pass->loadLights(directionalLights, pointLights, spotLights);
-    model_pass->loadLightColor(this->color);
+    // The deferred path's G-buffer pass reads model_pass's buffers too.
+    // Only the forward path may ever run, so the pass is built on first use.
+    for (int k = 0; k < model_pass_input.getNBuffers(); k++) {
+        RenderInputMeta meta = model_pass->getVBOMeta(model_pass_input.getBufferMeta(k).position);
+        gbuffer_input.assign_buffer(meta.position, meta.name, model_pass->getVBO(meta.position), meta.nelements,
+            meta.element_length, meta.element_type, meta.conversion, meta.stride, meta.offset);
+    }
+    gbuffer_input.assign_index_buffer(model_pass->getIndexBuffer(), m.faces.size(), 3, index_type);
+    gbuffer_vertex_shader = model_vertex_shader;
+    gbuffer_permutation = permutation;
+
     model_pass->loadMaterials();
+    initialized = true;
+}
+
+void Object::setupAll(const std::vector<Object*>& objects, UploadThread* uploader) {
+    std::vector<std::string> meshes, textures;
+    for (const Object* o : objects) {
+        meshes.push_back(o->mesh_file);
+        textures.push_back(o->diffuse_file);
+        if (!o->specular_file.empty())
+            textures.push_back(o->specular_file);
+    }
+    AssetRegistry& assets = AssetRegistry::get();
+    if (uploader) {
+        assets.loadAsync(meshes, textures, *uploader);
+        for (Object* o : objects)
+            o->setup();
+        return;
+    }
+    assets.prefetch(meshes, textures);
+    assets.upload();
+    for (Object* o : objects)
+        o->setup();
+    assets.releasePrefetched();
 }
 
 void Object::update() {
@@ -140,21 +280,63 @@ void Object::update() {
 void Object::render() {
     unsigned int i = 0;
 
+    setup();
+    if (!initialized)
+        return;
+
     model_pass->setup();
-    model_pass->updateVBO(0, meshes[i].vertices.data(), meshes[i].vertices.size());
+    if (!static_mesh) {
+        // The id pass shares this buffer, so one upload serves both.
+        model_pass->updateVBO(0, mesh->meshes[i].vertices.data(), mesh->meshes[i].vertices.size());
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, diffuseMap->id);
+
+    if (specularMap) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, specularMap->id);
+    }
+
+	  CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh->meshes[i].faces.size() * 3, index_type, 0));
+}
+
+void Object::renderGBuffer() {
+    unsigned int i = 0;
+
+    setup();
+    if (!initialized)
+        return;
+
+    if (!gbuffer_pass) {
+        gbuffer_pass = new RenderPass(
+            -1,
+            gbuffer_input,
+            {gbuffer_vertex_shader, geometry_shader, permuteShader(gbuffer_fragment_shader, gbuffer_permutation)},
+            gbuffer_uniforms,
+            {"fragment_color", "albedo", "specular", "normal", "position"}
+        );
+        gbuffer_pass->loadMaterials();
+    }
+    gbuffer_pass->setup();
+    if (!static_mesh)
+        model_pass->updateVBO(0, mesh->meshes[i].vertices.data(), mesh->meshes[i].vertices.size());
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseMap);
+    glBindTexture(GL_TEXTURE_2D, diffuseMap->id);
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, specularMap);
+    if (specularMap) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, specularMap->id);
+    }
 
-	  CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0));
+    CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh->meshes[i].faces.size() * 3, index_type, 0));
 }
 
 void Object::render_id() {
     unsigned int i = 0;
+    if (!initialized)
+        return;
     id_pass->setup();
-    id_pass->updateVBO(0, meshes[i].vertices.data(), meshes[i].vertices.size());
-	  CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, meshes[i].faces.size() * 3, GL_UNSIGNED_INT, 0));
+	  CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh->meshes[i].faces.size() * 3, index_type, 0));
 }
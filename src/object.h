@@ -24,6 +24,9 @@
 #include "material.h"
 #include "render_pass.h"
 #include "lights.h"
+#include "shader_permutation.h"
+#include "assets.h"
+#include "upload_thread.h"
 
 class Object {
   // the number of objects generated (total)
@@ -32,8 +35,8 @@ public:
     int object_id;
     std::string name;
     glm::vec4 color_id_vec;
-    std::vector<Mesh> meshes;
-    std::vector<Material> materials;
+    // Shared with every Object that loads the same file.
+    std::shared_ptr<const MeshAsset> mesh;
 
     Object(std::string name);
     ~Object();
@@ -51,26 +54,36 @@ public:
         ShaderUniform std_light,
         ShaderUniform std_view_position
     );
-    void lights(
-        std::vector<DirectionalLight> directionalLights,
-        std::vector<PointLight> pointLights,
-        std::vector<SpotLight> spotLights
-    );
 
+    // Both before setup(): they pick the fragment shader permutation.
     void lightColor(glm::vec4 c);
+    // specular may be nullptr for an object without highlights.
     void textures(const char* diffuse, const char* specular);
+    // Static meshes (default) are uploaded once in setup() and stay
+    // resident. Dynamic meshes re-send their vertices on every render().
+    void staticMesh(bool s);
 
     glm::mat4 translate(glm::mat4 model_matrix, glm::vec3 t);
     glm::mat4 rotate(glm::mat4 model_matrix, float degrees, glm::vec3 axis);
     glm::mat4 scale(glm::mat4 model_matrix, glm::vec3 s);
 
+    // Meshes the AssetRegistry packed (see packed_mesh.h) are drawn with
+    // shaders/object_packed.vert in place of the vertex shader given here.
+    // Does nothing until the object's assets are resident; render() calls
+    // it again until then and skips drawing meanwhile.
     void setup();
+    // setup() a whole scene: every object's files are parsed and decoded
+    // in parallel first, then uploaded in one batch on this thread, or in
+    // the background by uploader if given.
+    static void setupAll(const std::vector<Object*>& objects, UploadThread* uploader = nullptr);
     void update();
     void render();
+    // render() into the deferred path's G-buffer (deferred_renderer.h),
+    // unlit: shaders/gbuffer.frag with the fragment shader's permutation.
+    // Its pass is only built by the first call.
+    void renderGBuffer();
     void render_id();
 private:
-    Loader* loader;
-
     const char* vertex_shader;
     const char* geometry_shader;
     const char* fragment_shader;
@@ -82,18 +95,27 @@ private:
 	ShaderUniform std_light; // TODO: Not sure if we need this.
 	ShaderUniform std_view_position; // TODO: rename to camera.
 
-    std::vector<DirectionalLight> directionalLights;
-	std::vector<PointLight> pointLights;
-	std::vector<SpotLight> spotLights;
-
     glm::vec4 color;
 
-    unsigned int diffuseMap;
-    unsigned int specularMap;
-
-    RenderPass* model_pass;
-    RenderPass* id_pass;
-
+    // Resolved through the AssetRegistry in setup().
+    std::string mesh_file;
+    std::string diffuse_file;
+    std::string specular_file;
+
+    std::shared_ptr<const TextureAsset> diffuseMap;
+    std::shared_ptr<const TextureAsset> specularMap;
+
+    RenderPass* model_pass; // static meshes draw from the shared MeshAsset buffers
+    RenderPass* id_pass; // shares position and index buffers with model_pass
+    RenderPass* gbuffer_pass; // shares all of model_pass's buffers, null until renderGBuffer()
+    // What renderGBuffer() builds gbuffer_pass from, kept by setup().
+    RenderDataInput gbuffer_input;
+    std::vector<ShaderUniform> gbuffer_uniforms;
+    const char* gbuffer_vertex_shader;
+    ShaderPermutation gbuffer_permutation;
+
+    unsigned index_type; // of the mesh's index buffer
+    bool static_mesh;
     bool initialized;
 };
 
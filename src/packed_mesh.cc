@@ -0,0 +1,122 @@
+#include "packed_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const float kUnorm16 = 65535.0f;
+
+    uint16_t quantize(float v, float offset, float scale) {
+        float q = std::round((v - offset) / scale * kUnorm16);
+        return uint16_t(std::min(std::max(q, 0.0f), kUnorm16));
+    }
+
+    // Extent of a range for quantizing, never zero.
+    float extent(float low, float high) {
+        return high > low ? high - low : 1.0f;
+    }
+
+    glm::vec2 octahedral(glm::vec3 n) {
+        float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (sum == 0.0f)
+            return glm::vec2(0.0f);
+        n /= sum;
+        if (n.z >= 0.0f)
+            return glm::vec2(n.x, n.y);
+        return glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                         (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    uint16_t bits(int x, int y) {
+        return uint16_t((x & 0xff) | ((y & 0xff) << 8));
+    }
+
+    // Of the four snorm8 roundings of the octahedral coordinates, the one
+    // that decodes closest to n.
+    uint16_t packNormal(const glm::vec3& n) {
+        glm::vec2 o = octahedral(n) * 127.0f;
+        float length = glm::length(n);
+        uint16_t best = bits(0, 0);
+        float best_dot = -2.0f;
+        for (int i = 0; i < 4; i++) {
+            int x = int(i & 1 ? std::ceil(o.x) : std::floor(o.x));
+            int y = int(i & 2 ? std::ceil(o.y) : std::floor(o.y));
+            x = std::min(std::max(x, -127), 127);
+            y = std::min(std::max(y, -127), 127);
+            uint16_t b = bits(x, y);
+            float d = length > 0.0f ? glm::dot(unpackNormal(b), n / length) : 0.0f;
+            if (d > best_dot) {
+                best = b;
+                best_dot = d;
+            }
+        }
+        return best;
+    }
+};
+
+size_t PackedMesh::bytes() const {
+    return (positions.size() + uvs.size() + indices16.size()) * sizeof(uint16_t) +
+        indices32.size() * sizeof(uint32_t);
+}
+
+glm::vec3 unpackNormal(uint16_t b) {
+    glm::vec2 f(float(int8_t(b & 0xff)), float(int8_t(b >> 8)));
+    f = glm::max(f / 127.0f, glm::vec2(-1.0f));
+    glm::vec3 n(f.x, f.y, 1.0f - std::fabs(f.x) - std::fabs(f.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+void packMesh(const Mesh& mesh, PackedMesh& out) {
+    size_t count = mesh.vertices.size();
+    out = PackedMesh();
+
+    glm::vec3 low(0.0f), high(0.0f);
+    if (count) {
+        low = high = glm::vec3(mesh.vertices[0]);
+        for (const glm::vec4& p : mesh.vertices) {
+            low = glm::min(low, glm::vec3(p));
+            high = glm::max(high, glm::vec3(p));
+        }
+    }
+    out.position_offset = low;
+    out.position_scale = glm::vec3(extent(low.x, high.x), extent(low.y, high.y), extent(low.z, high.z));
+    bool has_normals = mesh.normals.size() == count;
+    out.positions.resize(4 * count);
+    for (size_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++)
+            out.positions[4 * i + k] = quantize(mesh.vertices[i][k], out.position_offset[k], out.position_scale[k]);
+        out.positions[4 * i + 3] = has_normals ? packNormal(glm::vec3(mesh.normals[i])) : bits(0, 0);
+    }
+
+    if (mesh.uvs.size() == count && count) {
+        glm::vec2 uv_low = mesh.uvs[0], uv_high = mesh.uvs[0];
+        for (const glm::vec2& uv : mesh.uvs) {
+            uv_low = glm::min(uv_low, uv);
+            uv_high = glm::max(uv_high, uv);
+        }
+        glm::vec2 scale(extent(uv_low.x, uv_high.x), extent(uv_low.y, uv_high.y));
+        out.uv_transform = glm::vec4(uv_low, scale);
+        out.uvs.resize(2 * count);
+        for (size_t i = 0; i < count; i++) {
+            out.uvs[2 * i] = quantize(mesh.uvs[i].x, uv_low.x, scale.x);
+            out.uvs[2 * i + 1] = quantize(mesh.uvs[i].y, uv_low.y, scale.y);
+        }
+    }
+
+    if (count <= 65536) {
+        out.indices16.reserve(3 * mesh.faces.size());
+        for (const glm::uvec3& f : mesh.faces) {
+            for (int j = 0; j < 3; j++)
+                out.indices16.push_back(uint16_t(f[j]));
+        }
+    } else {
+        out.indices32.reserve(3 * mesh.faces.size());
+        for (const glm::uvec3& f : mesh.faces) {
+            for (int j = 0; j < 3; j++)
+                out.indices32.push_back(f[j]);
+        }
+    }
+}
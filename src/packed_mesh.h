@@ -0,0 +1,43 @@
+#ifndef PACKED_MESH_H
+#define PACKED_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+/*
+ * Compact GPU vertex format for static meshes: 12 bytes per vertex instead
+ * of the 40 of Mesh's vec4 positions and normals and vec2 uvs.
+ *      positions: 4 x uint16 per vertex, read as a uvec4. xyz is the
+ *              position quantized within the mesh bounds, w the normal
+ *              octahedral encoded as two snorm8 (about a degree off at
+ *              worst)
+ *      uvs: 2 x unorm16 within the mesh's uv bounds, which may go past
+ *              [0, 1] for tiling textures; empty if the mesh has none
+ *      indices: 16 bit if the mesh has at most 65536 vertices
+ * shaders/object_packed.vert and picker_packed.vert decode it.
+ */
+struct PackedMesh {
+    std::vector<uint16_t> positions;
+    std::vector<uint16_t> uvs;
+    std::vector<uint16_t> indices16;
+    std::vector<uint32_t> indices32;
+    // position = position_offset + position_scale * xyz / 65535
+    glm::vec3 position_offset = glm::vec3(0.0f);
+    glm::vec3 position_scale = glm::vec3(1.0f);
+    // uv = uv_transform.xy + uv_transform.zw * uv (normalized)
+    glm::vec4 uv_transform = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+    bool shortIndices() const { return indices32.empty(); }
+    size_t bytes() const;
+};
+
+void packMesh(const Mesh& mesh, PackedMesh& out);
+
+// The normal w of a packed position decodes to, as the shaders do it.
+glm::vec3 unpackNormal(uint16_t bits);
+
+#endif
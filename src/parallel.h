@@ -0,0 +1,45 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller doesn't say.
+inline int hardware_threads()
+{
+	int n = int(std::thread::hardware_concurrency());
+	return n > 0 ? n : 1;
+}
+
+/*
+ * parallel_for: run f(i) for every i in [0, count) on up to nthreads
+ * threads (nthreads <= 0 means hardware_threads()). Each thread grabs the
+ * next unclaimed index, so uneven jobs still balance, and f must only
+ * touch data owned by index i.
+ */
+template <typename F>
+void parallel_for(int count, int nthreads, F f)
+{
+	if (nthreads <= 0)
+		nthreads = hardware_threads();
+	nthreads = std::min(nthreads, count);
+	if (nthreads <= 1) {
+		for (int i = 0; i < count; i++)
+			f(i);
+		return;
+	}
+	std::atomic<int> next(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < nthreads; t++) {
+		workers.emplace_back([&next, count, &f]() {
+			for (int i = next++; i < count; i = next++)
+				f(i);
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+}
+
+#endif
@@ -1,8 +1,14 @@
 #include <GL/glew.h>
+#include <GLFW/glfw3.h>
 #include "render_pass.h"
 #include <iostream>
 #include "debuggl.h"
 #include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "filesystem.h"
 
 /*
  * For students:
@@ -46,62 +52,101 @@ RenderPass::RenderPass(int vao, // -1: create new VAO, otherwise use given VAO
 {
 	if (vao_ < 0) {
 		CHECK_GL_ERROR(glGenVertexArrays(1, (GLuint*)&vao_));
+		owns_vao_ = true;
 	}
 	CHECK_GL_ERROR(glBindVertexArray(vao_));
 
-	// Program first
-	vs_ = compileShader(shaders[0], GL_VERTEX_SHADER);
-	gs_ = compileShader(shaders[1], GL_GEOMETRY_SHADER);
-	fs_ = compileShader(shaders[2], GL_FRAGMENT_SHADER);
-	CHECK_GL_ERROR(sp_ = glCreateProgram());
-	glAttachShader(sp_, vs_);
-	glAttachShader(sp_, fs_);
-	if (shaders[1])
-		glAttachShader(sp_, gs_);
+	// Program first, shared with every pass that has the same shaders
+	// and bindings
+	std::vector<std::pair<int, std::string>> attributes;
+	for (int i = 0; i < input.getNBuffers(); i++) {
+		auto meta = input.getBufferMeta(i);
+		attributes.emplace_back(meta.position, meta.name);
+	}
+	program_ = &linkProgram(shaders, attributes, output);
+	sp_ = program_->id;
+	passes_++;
 
 	// ... and then buffers
 	size_t nbuffer = input.getNBuffers();
 	if (input.hasIndex())
 		nbuffer++;
 	glbuffers_.resize(nbuffer);
-	CHECK_GL_ERROR(glGenBuffers(nbuffer, glbuffers_.data()));
+	glbuffer_sizes_.resize(nbuffer, 0);
 	for (int i = 0; i < input.getNBuffers(); i++) {
 		auto meta = input.getBufferMeta(i);
-		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
-		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				meta.getElementSize() * meta.nelements,
-				meta.data,
-				GL_STATIC_DRAW));
-		CHECK_GL_ERROR(glVertexAttribPointer(meta.position,
-					meta.element_length,
-					meta.element_type,
-					GL_FALSE, 0, 0));
+		if (meta.buffer) {
+			// Shared with another pass, already resident.
+			glbuffers_[i] = meta.buffer;
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+		} else if (meta.interleaved && interleaved_buffer_ >= 0) {
+			glbuffers_[i] = glbuffers_[interleaved_buffer_];
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+		} else if (meta.interleaved) {
+			// The first interleaved attribute builds the buffer for all.
+			interleaved_buffer_ = i;
+			interleaved_.resize(meta.stride * meta.nelements);
+			for (int j = i; j < input.getNBuffers(); j++) {
+				auto other = input.getBufferMeta(j);
+				if (other.interleaved)
+					scatter(other, other.data, other.nelements);
+			}
+			CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_[i]));
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+			CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+					interleaved_.size(),
+					interleaved_.data(),
+					GL_STATIC_DRAW));
+			glbuffer_sizes_[i] = interleaved_.size();
+			upload_bytes_ += interleaved_.size();
+		} else {
+			size_t bytes = meta.getElementSize() * meta.nelements;
+			CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_[i]));
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+			CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+					bytes,
+					meta.data,
+					GL_STATIC_DRAW));
+			glbuffer_sizes_[i] = bytes;
+			upload_bytes_ += bytes;
+		}
+		if (meta.conversion == kAttribInteger)
+			CHECK_GL_ERROR(glVertexAttribIPointer(meta.position,
+						meta.element_length,
+						meta.element_type,
+						meta.stride, (const void*)meta.offset));
+		else
+			CHECK_GL_ERROR(glVertexAttribPointer(meta.position,
+						meta.element_length,
+						meta.element_type,
+						meta.conversion == kAttribNormalized ? GL_TRUE : GL_FALSE,
+						meta.stride, (const void*)meta.offset));
 		CHECK_GL_ERROR(glEnableVertexAttribArray(meta.position));
-		// ... because we need program to bind location
-		CHECK_GL_ERROR(glBindAttribLocation(sp_, meta.position, meta.name.c_str()));
+		if (meta.divisor)
+			CHECK_GL_ERROR(glVertexAttribDivisor(meta.position, meta.divisor));
 	}
-	// .. bind output position
-	for (size_t i = 0; i < output.size(); i++) {
-		CHECK_GL_ERROR(glBindFragDataLocation(sp_, i, output[i]));
-	}
-	// ... then we can link
-	glLinkProgram(sp_);
-	CHECK_GL_PROGRAM_ERROR(sp_);
 
 	if (input.hasIndex()) {
 		auto meta = input.getIndexMeta();
-		CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-					glbuffers_.back()
-					));
-		CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-					meta.getElementSize() * meta.nelements,
-					meta.data, GL_STATIC_DRAW));
-	}
-	// after linking uniform locations can be determined
-	unilocs_.resize(uniforms.size());
-	for (size_t i = 0; i < uniforms.size(); i++) {
-		CHECK_GL_ERROR(unilocs_[i] = glGetUniformLocation(sp_, uniforms[i].name.c_str()));
+		if (meta.buffer) {
+			glbuffers_.back() = meta.buffer;
+			CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+						glbuffers_.back()));
+		} else {
+			size_t bytes = meta.getElementSize() * meta.nelements;
+			CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_.back()));
+			CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+						glbuffers_.back()
+						));
+			CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+						bytes,
+						meta.data, GL_STATIC_DRAW));
+			glbuffer_sizes_.back() = bytes;
+			upload_bytes_ += bytes;
+		}
 	}
+	// Uniform locations are looked up on the first setup(), once the
+	// program has finished linking.
     /*
 	if (input_.hasMaterial()) {
 		createMaterialTexture();
@@ -239,28 +284,472 @@ void RenderPass::createMaterialTexture()
 }
 */
 
+int RenderPass::uniformLocation(unsigned program, const char* name)
+{
+	for (auto& entry : program_cache_) {
+		if (entry.second.id == program && entry.second.pending) {
+			finishProgram(entry.second);
+			break;
+		}
+	}
+	uniform_lookups_++;
+	return glGetUniformLocation(program, name);
+}
+
+namespace {
+	// The driver a program binary was made by. Part of the binary's key,
+	// so a driver update doesn't even try the old binaries.
+	std::string driverDescription()
+	{
+		std::string description;
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			const GLubyte* value = glGetString(name);
+			description += value ? (const char*)value : "";
+			description += '\n';
+		}
+		return description;
+	}
+
+	// GLEW 1.13 can't see extensions in a core profile, but loads the
+	// entry points anyway, so look for those (core since 4.1).
+	bool binariesSupported()
+	{
+		if (!glGetProgramBinary || !glProgramBinary || !glProgramParameteri)
+			return false;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		glGetError();
+		return formats > 0;
+	}
+
+	std::string binaryDirectory()
+	{
+		return path("/build/shader_cache");
+	}
+
+	std::string binaryPath(uint64_t key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+		return binaryDirectory() + name;
+	}
+
+	// KHR_parallel_shader_compile (or its ARB twin), which GLEW 1.13
+	// doesn't know yet.
+	const GLenum kMaxShaderCompilerThreads = 0x91B0;
+	const GLenum kCompletionStatus = 0x91B1;
+	typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+	bool hasExtension(const char* name)
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const GLubyte* extension = glGetStringi(GL_EXTENSIONS, i);
+			if (extension && strcmp((const char*)extension, name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	// Milliseconds since the first program was submitted.
+	double startupMs()
+	{
+		static auto start = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	const char kBinaryMagic[8] = { 'L', 'E', 'N', 'S', 'P', 'R', 'G', '1' };
+
+	struct BinaryHeader {
+		char magic[8];
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+		// What compiling and linking the program took when it was saved,
+		// for the time saved by loading it instead.
+		double build_ms;
+	};
+};
+
+unsigned RenderPass::program(const std::vector<const char*>& shaders,
+		const std::vector<std::pair<int, std::string>>& attributes,
+		const std::vector<const char*>& output)
+{
+	return linkProgram(shaders, attributes, output).id;
+}
+
+RenderPass::Program& RenderPass::linkProgram(const std::vector<const char*>& shaders,
+		const std::vector<std::pair<int, std::string>>& attributes,
+		const std::vector<const char*>& output)
+{
+	ProgramKey key;
+	std::get<0>(key) = shaders[0];
+	std::get<1>(key) = shaders[1];
+	std::get<2>(key) = shaders[2];
+	std::get<3>(key) = attributes;
+	for (const char* name : output)
+		std::get<4>(key).emplace_back(name);
+	auto iter = program_cache_.find(key);
+	if (iter != program_cache_.end())
+		return iter->second;
+
+	if (parallel_compile_ < 0) {
+		parallel_compile_ = 0;
+		const char* names[] = { "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile" };
+		const char* procs[] = { "glMaxShaderCompilerThreadsKHR", "glMaxShaderCompilerThreadsARB" };
+		for (int i = 0; i < 2 && !parallel_compile_; i++) {
+			auto threads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress(procs[i]);
+			if (threads && hasExtension(names[i])) {
+				// As many compiler threads as the driver likes.
+				threads(0xFFFFFFFF);
+				parallel_compile_ = 1;
+			}
+		}
+	}
+
+	// Everything the driver's binary depends on: the sources (not their
+	// addresses, which change from build to build), the bindings and the
+	// driver itself.
+	std::string description;
+	for (const char* source : shaders) {
+		description += source ? source : "";
+		description += '\0';
+	}
+	for (const auto& attribute : attributes)
+		description += std::to_string(attribute.first) + ' ' + attribute.second + '\0';
+	for (const char* name : output)
+		description += std::string(name) + '\0';
+	description += driverDescription();
+
+	Program& program = program_cache_[key];
+	program.binary_key = content_hash(description.data(), description.size());
+	program.submit_ms = startupMs();
+	program.pending = true;
+	if (loadProgramBinary(program, program.binary_key)) {
+		program.ready_ms = startupMs();
+		return program;
+	}
+
+	// Submit only: asking for the compile or link status here would make
+	// the driver finish this program before the next one is submitted.
+	program.shaders[0] = compileShader(shaders[0], GL_VERTEX_SHADER);
+	program.shaders[1] = compileShader(shaders[1], GL_GEOMETRY_SHADER);
+	program.shaders[2] = compileShader(shaders[2], GL_FRAGMENT_SHADER);
+	auto start = std::chrono::steady_clock::now();
+	CHECK_GL_ERROR(program.id = glCreateProgram());
+	for (unsigned shader : program.shaders) {
+		if (shader)
+			glAttachShader(program.id, shader);
+	}
+	for (const auto& attribute : attributes)
+		CHECK_GL_ERROR(glBindAttribLocation(program.id, attribute.first, attribute.second.c_str()));
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK_GL_ERROR(glBindFragDataLocation(program.id, i, output[i]));
+	program.save_binary = use_binaries_ && binariesSupported();
+	if (program.save_binary)
+		CHECK_GL_ERROR(glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+	glLinkProgram(program.id);
+	link_ms_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	programs_linked_++;
+	pollPrograms();
+	return program;
+}
+
+void RenderPass::pollPrograms()
+{
+	if (parallel_compile_ <= 0)
+		return;
+	for (auto& entry : program_cache_) {
+		Program& program = entry.second;
+		if (!program.pending || program.ready_ms >= 0.0)
+			continue;
+		GLint done = GL_FALSE;
+		glGetProgramiv(program.id, kCompletionStatus, &done);
+		if (done == GL_TRUE)
+			program.ready_ms = startupMs();
+	}
+}
+
+void RenderPass::finishProgram(Program& program)
+{
+	if (!program.pending)
+		return;
+	program.pending = false;
+	pollPrograms();
+
+	// The first status query blocks until the link is done.
+	double start = startupMs();
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program.id, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE) {
+		// The compile log says more than the link log.
+		for (unsigned shader : program.shaders) {
+			if (shader)
+				CHECK_GL_SHADER_ERROR(shader);
+		}
+		CHECK_GL_PROGRAM_ERROR(program.id);
+	}
+	double end = startupMs();
+	if (program.ready_ms < 0.0)
+		program.ready_ms = end;
+	program.wait_ms = end - start;
+	wait_ms_ += program.wait_ms;
+	if (program.save_binary)
+		saveProgramBinary(program, program.binary_key, program.ready_ms - program.submit_ms);
+
+	// after linking uniform locations can be determined
+	cacheUniformLocations(program);
+	// Programs that light read the shared LightBuffer. Block bindings
+	// aren't part of a program binary, so this is needed either way.
+	GLuint lights = glGetUniformBlockIndex(program.id, "Lights");
+	if (lights != GL_INVALID_INDEX)
+		CHECK_GL_ERROR(glUniformBlockBinding(program.id, lights, LightBuffer::kLightBinding));
+}
+
+void RenderPass::finishPrograms()
+{
+	std::vector<Program*> programs;
+	for (auto& entry : program_cache_) {
+		finishProgram(entry.second);
+		programs.push_back(&entry.second);
+	}
+	std::sort(programs.begin(), programs.end(), [](const Program* a, const Program* b) {
+		return a->submit_ms < b->submit_ms;
+	});
+	double submitted = 0.0, ready = 0.0;
+	for (const Program* program : programs) {
+		submitted = std::max(submitted, program->submit_ms);
+		ready = std::max(ready, program->ready_ms);
+	}
+	printf("Program build (%s): %lu programs submitted by %.2f ms, ready by %.2f ms, %.2f ms spent waiting\n",
+		parallel_compile_ > 0 ? "parallel shader compile" : "no parallel shader compile",
+		(unsigned long)programs.size(), submitted, ready, wait_ms_);
+	for (const Program* program : programs) {
+		printf("    program %3u: submitted %8.2f ms, ready %8.2f ms, waited %7.2f ms%s\n",
+			program->id, program->submit_ms, program->ready_ms, program->wait_ms,
+			program->shaders[0] ? "" : " (binary)");
+	}
+}
+
+bool RenderPass::loadProgramBinary(Program& program, uint64_t key)
+{
+	if (!use_binaries_ || !binariesSupported())
+		return false;
+	std::string file = binaryPath(key);
+	std::vector<char> data;
+	if (!read_file(file, data))
+		return false;
+
+	auto start = std::chrono::steady_clock::now();
+	BinaryHeader header;
+	bool valid = data.size() >= sizeof(header);
+	if (valid) {
+		memcpy(&header, data.data(), sizeof(header));
+		valid = memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) == 0 &&
+			header.key == key &&
+			header.length == data.size() - sizeof(header);
+	}
+	GLint linked = GL_FALSE;
+	if (valid) {
+		CHECK_GL_ERROR(program.id = glCreateProgram());
+		glProgramBinary(program.id, header.format, data.data() + sizeof(header), header.length);
+		// An unknown format is GL_INVALID_ENUM, not a failed link.
+		if (glGetError() == GL_NO_ERROR)
+			glGetProgramiv(program.id, GL_LINK_STATUS, &linked);
+	}
+	if (linked != GL_TRUE) {
+		// Stale or corrupt: build from source and save a new one.
+		if (program.id)
+			glDeleteProgram(program.id);
+		program.id = 0;
+		remove(file.c_str());
+		binaries_rejected_++;
+		return false;
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	load_ms_ += ms;
+	saved_ms_ += std::max(header.build_ms - ms, 0.0);
+	binaries_loaded_++;
+	return true;
+}
+
+void RenderPass::saveProgramBinary(const Program& program, uint64_t key, double build_ms)
+{
+	GLint length = 0;
+	glGetProgramiv(program.id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	BinaryHeader header;
+	memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+	header.key = key;
+	GLenum format = 0;
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	glGetProgramBinary(program.id, length, &written, &format, binary.data());
+	if (glGetError() != GL_NO_ERROR || written <= 0)
+		return;
+	header.format = format;
+	header.length = uint32_t(written);
+	header.build_ms = build_ms;
+
+	// A missing cache only costs the next run its compiles, so failing
+	// to write one isn't an error.
+	if (!make_dir(path("/build")) || !make_dir(binaryDirectory()))
+		return;
+	// Same temporary file and rename as the mesh cache.
+	std::string file = binaryPath(key);
+	std::string tmp = file + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return;
+		out.write((const char*)&header, sizeof(header));
+		out.write(binary.data(), written);
+		if (!out)
+			return;
+	}
+	remove(file.c_str());
+	if (rename(tmp.c_str(), file.c_str()) != 0)
+		remove(tmp.c_str());
+}
+
+void RenderPass::printProgramStats()
+{
+	printf("Programs: %lu passes share %lu linked programs, %lu shaders compiled; %.2f ms submitting compiles, %.2f ms submitting links, %.2f ms waiting\n",
+		(unsigned long)passes_, (unsigned long)programs_linked_, (unsigned long)shaders_compiled_,
+		compile_ms_, link_ms_, wait_ms_);
+	printf("Program binaries: %lu loaded in %.2f ms, %.2f ms of compiling and linking saved, %lu rejected\n",
+		(unsigned long)binaries_loaded_, load_ms_, saved_ms_, (unsigned long)binaries_rejected_);
+}
+
+void RenderPass::cacheUniformLocations(Program& program)
+{
+	GLint count = 0, max_length = 0;
+	CHECK_GL_ERROR(glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &count));
+	CHECK_GL_ERROR(glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length));
+	std::vector<char> buffer(max_length + 1);
+	for (GLint i = 0; i < count; i++) {
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		CHECK_GL_ERROR(glGetActiveUniform(program.id, i, buffer.size(), &length, &size, &type, buffer.data()));
+		std::string name(buffer.data(), length);
+		// Arrays are listed once as "name[0]". Their elements' locations
+		// aren't guaranteed to be consecutive, so ask for each.
+		size_t bracket = name.size() > 3 ? name.size() - 3 : 0;
+		if (name.compare(bracket, 3, "[0]") != 0) {
+			program.locations[UniformName(name).hash()] = uniformLocation(program.id, name.c_str());
+			continue;
+		}
+		std::string base = name.substr(0, bracket);
+		for (GLint j = 0; j < size; j++) {
+			std::string element = base + "[" + std::to_string(j) + "]";
+			int loc = uniformLocation(program.id, element.c_str());
+			program.locations[UniformName(element).hash()] = loc;
+			if (j == 0)
+				program.locations[UniformName(base).hash()] = loc;
+		}
+	}
+}
+
 RenderPass::~RenderPass()
 {
-	// TODO: Free resources
+	// Shaders and programs are shared through the caches and buffers
+	// handed in with assign_buffer belong to someone else, everything else
+	// is ours. The interleaved attributes all point at one buffer.
+	for (int i = 0; i < int(glbuffers_.size()); i++) {
+		auto meta = i < input_.getNBuffers() ? input_.getBufferMeta(i)
+		                                     : input_.getIndexMeta();
+		bool shared = meta.buffer || (meta.interleaved && i != interleaved_buffer_);
+		if (!shared)
+			glDeleteBuffers(1, &glbuffers_[i]);
+	}
+	if (owns_vao_)
+		glDeleteVertexArrays(1, (GLuint*)&vao_);
 }
 
-void RenderPass::updateVBO(int position, const void* data, size_t size)
+int RenderPass::findBuffer(int position) const
 {
-	int bufferid = -1;
 	for (int i = 0; i < input_.getNBuffers(); i++) {
-		auto meta = input_.getBufferMeta(i);
-		if (meta.position == position) {
-			bufferid = i;
-			break;
-		}
+		if (input_.getBufferMeta(i).position == position)
+			return i;
 	}
+	return -1;
+}
+
+unsigned RenderPass::getVBO(int position) const
+{
+	int bufferid = findBuffer(position);
+	if (bufferid < 0)
+		throw __func__+std::string(": error, can't find buffer with position ")+std::to_string(position);
+	return glbuffers_[bufferid];
+}
+
+RenderInputMeta RenderPass::getVBOMeta(int position) const
+{
+	int bufferid = findBuffer(position);
+	if (bufferid < 0)
+		throw __func__+std::string(": error, can't find buffer with position ")+std::to_string(position);
+	return input_.getBufferMeta(bufferid);
+}
+
+unsigned RenderPass::getIndexBuffer() const
+{
+	if (!input_.hasIndex())
+		throw __func__+std::string(": error, pass has no index buffer");
+	return glbuffers_.back();
+}
+
+void RenderPass::updateVBO(int position, const void* data, size_t size)
+{
+	int bufferid = findBuffer(position);
 	if (bufferid < 0)
 		throw __func__+std::string(": error, can't find buffer with position ")+std::to_string(position);
 	auto meta = input_.getBufferMeta(bufferid);
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[bufferid]));
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				size * meta.getElementSize(),
-				data, GL_STATIC_DRAW));
+	if (meta.interleaved) {
+		if (size != meta.nelements)
+			throw __func__+std::string(": error, interleaved buffers can't change size");
+		scatter(meta, data, size);
+		uploadBuffer(GL_ARRAY_BUFFER, interleaved_buffer_, interleaved_.data(), interleaved_.size());
+		return;
+	}
+	uploadBuffer(GL_ARRAY_BUFFER, bufferid, data, size * meta.getElementSize());
+}
+
+void RenderPass::scatter(const RenderInputMeta& meta, const void* data, size_t nelements)
+{
+	size_t size = meta.getElementSize();
+	const char* src = (const char*)data;
+	for (size_t v = 0; v < nelements; v++)
+		memcpy(&interleaved_[v * meta.stride + meta.offset], src + v * size, size);
+}
+
+void RenderPass::updateIndex(const void* data, size_t size)
+{
+	if (!input_.hasIndex())
+		throw __func__+std::string(": error, pass has no index buffer");
+	auto meta = input_.getIndexMeta();
+	// The element array binding is VAO state.
+	CHECK_GL_ERROR(glBindVertexArray(vao_));
+	uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, int(glbuffers_.size()) - 1,
+			data, size * meta.getElementSize());
+}
+
+void RenderPass::uploadBuffer(int target, int bufferid, const void* data, size_t bytes)
+{
+	CHECK_GL_ERROR(glBindBuffer(target, glbuffers_[bufferid]));
+	if (bytes <= glbuffer_sizes_[bufferid]) {
+		// Orphan the old storage so we don't wait on draws still
+		// reading it, then fill the fresh one.
+		CHECK_GL_ERROR(glBufferData(target, glbuffer_sizes_[bufferid],
+					nullptr, GL_STATIC_DRAW));
+		CHECK_GL_ERROR(glBufferSubData(target, 0, bytes, data));
+	} else {
+		CHECK_GL_ERROR(glBufferData(target, bytes, data, GL_STATIC_DRAW));
+		glbuffer_sizes_[bufferid] = bytes;
+	}
+	upload_bytes_ += bytes;
 }
 
 void RenderPass::setup()
@@ -268,7 +757,19 @@ void RenderPass::setup()
 	// Switch to our object VAO.
 	CHECK_GL_ERROR(glBindVertexArray(vao_));
 	// Use our program.
+	if (!unilocs_ready_) {
+		unilocs_.resize(uniforms_.size());
+		for (size_t i = 0; i < uniforms_.size(); i++)
+			unilocs_[i] = location(uniforms_[i].name);
+		unilocs_ready_ = true;
+	}
 	CHECK_GL_ERROR(glUseProgram(sp_));
+	if (load_materials_) {
+		setInt("material.diffuse", 0);
+		setInt("material.specular", 1);
+		setFloat("material.shininess", 32.0f);
+		load_materials_ = false;
+	}
 
 	bind_uniforms(uniforms_, unilocs_);
 }
@@ -316,9 +817,12 @@ unsigned RenderPass::compileShader(const char* source_ptr, int type)
 #if 0
 	std::cerr << __func__ << " shader id " << ret << " type " << type << "\tsource:\n" << source_ptr << std::endl;
 #endif
+	auto start = std::chrono::steady_clock::now();
 	CHECK_GL_ERROR(glShaderSource(ret, 1, &source_ptr, nullptr));
+	// Checked by finishProgram, if the link fails.
 	glCompileShader(ret);
-	CHECK_GL_SHADER_ERROR(ret);
+	compile_ms_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	shaders_compiled_++;
 	shader_cache_[source_ptr] = ret;
 	return ret;
 }
@@ -328,15 +832,72 @@ void RenderDataInput::assign(int position,
                              const void *data,
                              size_t nelements,
                              size_t element_length,
-                             int element_type)
+                             int element_type,
+                             AttribConversion conversion)
 {
 	meta_.emplace_back(position, name, data, nelements, element_length, element_type);
+	meta_.back().conversion = conversion;
 }
 
-void RenderDataInput::assign_index(const void *data, size_t nelements, size_t element_length)
+void RenderDataInput::assign_index(const void *data, size_t nelements, size_t element_length,
+                                   int element_type)
 {
 	has_index_ = true;
-	index_meta_ = {-1, "", data, nelements, element_length, GL_UNSIGNED_INT};
+	index_meta_ = {-1, "", data, nelements, element_length, element_type};
+}
+
+void RenderDataInput::assign_buffer(int position,
+                                    const std::string& name,
+                                    unsigned buffer,
+                                    size_t nelements,
+                                    size_t element_length,
+                                    int element_type,
+                                    AttribConversion conversion,
+                                    size_t stride,
+                                    size_t offset)
+{
+	meta_.emplace_back(position, name, nullptr, nelements, element_length, element_type);
+	meta_.back().buffer = buffer;
+	meta_.back().conversion = conversion;
+	meta_.back().stride = stride;
+	meta_.back().offset = offset;
+}
+
+void RenderDataInput::assign_index_buffer(unsigned buffer, size_t nelements, size_t element_length,
+                                          int element_type)
+{
+	has_index_ = true;
+	index_meta_ = {-1, "", nullptr, nelements, element_length, element_type};
+	index_meta_.buffer = buffer;
+}
+
+void RenderDataInput::interleave()
+{
+	size_t stride = 0;
+	for (auto& meta : meta_) {
+		if (meta.buffer || meta.divisor || meta.interleaved)
+			continue;
+		meta.offset = stride;
+		// Keep every attribute 4 byte aligned.
+		stride += (meta.getElementSize() + 3) & ~size_t(3);
+	}
+	for (auto& meta : meta_) {
+		if (meta.buffer || meta.divisor || meta.interleaved)
+			continue;
+		meta.stride = stride;
+		meta.interleaved = true;
+	}
+}
+
+void RenderDataInput::assign_instanced(int position,
+                                       const std::string& name,
+                                       const void *data,
+                                       size_t nelements,
+                                       size_t element_length,
+                                       int element_type)
+{
+	meta_.emplace_back(position, name, data, nelements, element_length, element_type);
+	meta_.back().divisor = 1;
 }
 
 /*
@@ -354,9 +915,28 @@ size_t RenderInputMeta::getElementSize() const
 	size_t element_size = 4;
 	if (element_type == GL_FLOAT)
 		element_size = 4;
-	else if (element_type == GL_UNSIGNED_INT)
+	else if (element_type == GL_UNSIGNED_INT || element_type == GL_INT)
 		element_size = 4;
+	else if (element_type == GL_UNSIGNED_SHORT || element_type == GL_SHORT)
+		element_size = 2;
+	else if (element_type == GL_UNSIGNED_BYTE || element_type == GL_BYTE)
+		element_size = 1;
 	return element_size * element_length;
 }
 
 std::map<const char*, unsigned> RenderPass::shader_cache_;
+size_t RenderPass::upload_bytes_ = 0;
+size_t RenderPass::uniform_lookups_ = 0;
+std::map<RenderPass::ProgramKey, RenderPass::Program> RenderPass::program_cache_;
+size_t RenderPass::passes_ = 0;
+size_t RenderPass::programs_linked_ = 0;
+size_t RenderPass::shaders_compiled_ = 0;
+double RenderPass::compile_ms_ = 0.0;
+double RenderPass::link_ms_ = 0.0;
+double RenderPass::wait_ms_ = 0.0;
+int RenderPass::parallel_compile_ = -1;
+bool RenderPass::use_binaries_ = true;
+size_t RenderPass::binaries_loaded_ = 0;
+size_t RenderPass::binaries_rejected_ = 0;
+double RenderPass::load_ms_ = 0.0;
+double RenderPass::saved_ms_ = 0.0;
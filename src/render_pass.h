@@ -13,10 +13,13 @@
  * function calls in your solution.
  */
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <functional>
+#include <tuple>
 #include "material.h"
 #include "lights.h"
 
@@ -46,6 +49,36 @@ struct ShaderUniform {
 	std::function<const void*()> data_source;
 };
 
+/*
+ * AttribConversion: how an attribute with an integer element_type reaches
+ * the shader
+ *      kAttribFloat: converted to float as is
+ *      kAttribNormalized: mapped to [0, 1], or [-1, 1] if signed
+ *      kAttribInteger: not converted, for int/uint/ivecN/uvecN inputs
+ */
+enum AttribConversion {
+	kAttribFloat,
+	kAttribNormalized,
+	kAttribInteger,
+};
+
+/*
+ * UniformName: a uniform name hashed (FNV-1a) once, to look up locations
+ * in a RenderPass without strings or glGetUniformLocation. String
+ * literals convert to it implicitly; loops can keep them around.
+ */
+class UniformName {
+public:
+	constexpr UniformName(const char* name) : hash_(fnv1a(name, 14695981039346656037ull)) {}
+	UniformName(const std::string& name) : UniformName(name.c_str()) {}
+	constexpr uint64_t hash() const { return hash_; }
+private:
+	static constexpr uint64_t fnv1a(const char* s, uint64_t h) {
+		return *s ? fnv1a(s + 1, (h ^ uint8_t(*s)) * 1099511628211ull) : h;
+	}
+	uint64_t hash_;
+};
+
 /*
  * RenderInputMeta: describe one buffer used in some RenderPass
  */
@@ -56,6 +89,14 @@ struct RenderInputMeta {
 	size_t nelements = 0;
 	size_t element_length = 0;
 	int element_type = 0;
+	unsigned buffer = 0; // non-zero: existing GL buffer, RenderPass won't upload or free it
+	unsigned divisor = 0; // non-zero: advance once per instance instead of per vertex
+	AttribConversion conversion = kAttribFloat;
+	// Byte distance between vertices (0: tightly packed) and byte offset
+	// of this attribute within a vertex.
+	size_t stride = 0;
+	size_t offset = 0;
+	bool interleaved = false; // set by RenderDataInput::interleave
 
 	size_t getElementSize() const; // simple check: return 12 (3 * 4 bytes) for float3
 	RenderInputMeta();
@@ -80,20 +121,63 @@ public:
 	 *      name: glBindAttribLocation name
 	 *      nelements: number of elements
 	 *      element_length: element dimension, e.g. for vec3 it's 3
-	 *      element_type: GL_FLOAT or GL_UNSIGNED_INT
+	 *      element_type: GL_FLOAT, or a GL integer type
+	 *      conversion: see AttribConversion, only for integer types
 	 */
 	void assign(int position,
 	            const std::string& name,
 	            const void *data,
 	            size_t nelements,
 	            size_t element_length,
-	            int element_type);
+	            int element_type,
+	            AttribConversion conversion = kAttribFloat);
 	/*
 	 * assign_index: assign the index buffer for vertices
 	 * This will bind the data to GL_ELEMENT_ARRAY_BUFFER
-	 * The element must be uvec3.
+	 * The element must be a triangle: 3 GL_UNSIGNED_INT (uvec3), or 3
+	 * GL_UNSIGNED_SHORT.
 	 */
-	void assign_index(const void *data, size_t nelements, size_t element_length);
+	void assign_index(const void *data, size_t nelements, size_t element_length,
+	                  int element_type = GL_UNSIGNED_INT);
+	/*
+	 * assign_buffer/assign_index_buffer: like assign/assign_index, but
+	 * reuse a GL buffer that already lives on the GPU (e.g. the one
+	 * returned by RenderPass::getVBO of another pass). Nothing is uploaded
+	 * and the RenderPass does not take ownership of the buffer.
+	 *      stride, offset: layout of an interleaved buffer, in bytes
+	 */
+	void assign_buffer(int position,
+	                   const std::string& name,
+	                   unsigned buffer,
+	                   size_t nelements,
+	                   size_t element_length,
+	                   int element_type,
+	                   AttribConversion conversion = kAttribFloat,
+	                   size_t stride = 0,
+	                   size_t offset = 0);
+	void assign_index_buffer(unsigned buffer, size_t nelements, size_t element_length,
+	                         int element_type = GL_UNSIGNED_INT);
+	/*
+	 * assign_instanced: like assign, but the attribute advances once per
+	 * instance (glVertexAttribDivisor 1), for glDrawElementsInstanced.
+	 */
+	void assign_instanced(int position,
+	                      const std::string& name,
+	                      const void *data,
+	                      size_t nelements,
+	                      size_t element_length,
+	                      int element_type);
+	/*
+	 * interleave: lay out the per-vertex attributes assign()ed so far in
+	 * one array buffer, each vertex's attributes back to back in
+	 * assignment order. RenderPass builds that buffer from the separate
+	 * arrays, so a vertex fetch reads one cache line instead of one per
+	 * attribute. Call it once; the attributes must have the same
+	 * nelements.
+	 * updateVBO of one of them re-uploads the whole buffer, so keep
+	 * attributes that change every frame out of it.
+	 */
+	void interleave();
 	/*
 	 * useMaterials: assign materials to the input data
 	 */
@@ -135,10 +219,83 @@ public:
 	           const std::vector<const char*> output // Order: 0, 1, 2...
 		  );
 	~RenderPass();
+	// A RenderPass owns GL objects, so it can't be copied.
+	RenderPass(const RenderPass&) = delete;
+	RenderPass& operator=(const RenderPass&) = delete;
 
 	unsigned getVAO() const { return unsigned(vao_); }
+	unsigned getVBO(int position) const;
+	// Layout of the attribute at position, e.g. to share an interleaved
+	// buffer through assign_buffer.
+	RenderInputMeta getVBOMeta(int position) const;
+	unsigned getIndexBuffer() const;
 	void updateVBO(int position, const void* data, size_t nelement);
+	void updateIndex(const void* data, size_t nelement);
 	void setup();
+
+	/*
+	 * Bytes sent to the GPU through RenderPass buffers since the last
+	 * resetUploadBytes(). Reset once per frame to get upload bytes per
+	 * frame; it should stay at zero for a static scene.
+	 */
+	static size_t getUploadBytes() { return upload_bytes_; }
+	static void resetUploadBytes() { upload_bytes_ = 0; }
+	/*
+	 * uniformLocation: glGetUniformLocation, counted. RenderPass only
+	 * calls it right after linking, so the count since the last
+	 * resetUniformLookups() should be zero per frame once every pass is
+	 * set up.
+	 */
+	static int uniformLocation(unsigned program, const char* name);
+	static size_t getUniformLookups() { return uniform_lookups_; }
+	static void resetUniformLookups() { uniform_lookups_ = 0; }
+	// Location of an active uniform of this pass's program, -1 if there
+	// is none (glUniform* ignores that, like an unknown name).
+	int location(UniformName name) const {
+		if (program_->pending)
+			finishProgram(*program_);
+		auto iter = program_->locations.find(name.hash());
+		return iter == program_->locations.end() ? -1 : iter->second;
+	}
+	/*
+	 * Passes with the same shaders, attribute names and outputs share one
+	 * program, linked by the first of them. Per-object state therefore
+	 * has to be a ShaderUniform, bound on every setup(), rather than set
+	 * once on the program. printProgramStats reports how many passes
+	 * were created vs programs linked, and the time spent.
+	 *
+	 * Linked programs are also saved as driver binaries under
+	 * build/shader_cache, keyed by the shader sources, the bindings and
+	 * the GL vendor, renderer and version. The next run loads them and
+	 * doesn't compile anything; a binary the driver rejects is deleted
+	 * and the program built from source again.
+	 *
+	 * Compiles and links are only submitted when a pass is created; the
+	 * driver (in parallel with KHR_parallel_shader_compile) builds them
+	 * while the rest of the scene is set up. Nothing waits for a program
+	 * or checks its status until it is first used: setup(), location(),
+	 * uniformLocation() or finishPrograms().
+	 */
+	static void printProgramStats();
+	/*
+	 * finishPrograms: wait for every submitted program, check it and
+	 * print the startup timeline, i.e. when each was submitted, ready
+	 * and waited for. Call it once the scene is set up.
+	 */
+	static void finishPrograms();
+	/*
+	 * program: the program of shaders (VS, GS, FS; GS may be nullptr)
+	 * with the given attribute locations and fragment outputs (0, 1,
+	 * 2...), for code that draws without a RenderPass. It is shared and
+	 * binary-cached like the passes' programs; don't delete it. The id
+	 * can be used right away, but it may still be building: submit all
+	 * of them before asking any for its uniforms.
+	 */
+	static unsigned program(const std::vector<const char*>& shaders,
+			const std::vector<std::pair<int, std::string>>& attributes,
+			const std::vector<const char*>& output);
+	// Turn the binary cache off, before any program is linked.
+	static void useProgramBinaries(bool use) { use_binaries_ = use; }
 	/*
  	 * Note: here we don't have an unified render() function, because the
 	 * reference solution renders with different primitives
@@ -154,154 +311,122 @@ public:
 	//bool renderWithMaterial(int i); // return false if material id is invalid
 
 	// <<<Lights>>>
-	// NOTE: Must be called when using default shaders.
-	// Source: https://learnopengl.com/Lighting/Multiple-lights
-	void loadLights(std::vector<DirectionalLight>& directionalLights,
-		std::vector<PointLight>& pointLights,
-		std::vector<SpotLight>& spotLights) {
-
-		int limit = 10; // Max Lights.
-
-		glUseProgram(sp_);
-
-		if (directionalLights.size() == 0 && pointLights.size() == 0 && spotLights.size() == 0) {
-			setInt("dLights", 1);
-			setInt("pLights", 0);
-			setInt("sLights", 0);
-
-			DirectionalLight directionalLight = DirectionalLight(glm::vec3(-1.0f, -1.0f, -1.0f));
-			setVec3("directionalLights[0].position", directionalLight.getDirection());
-		    setVec3("directionalLights[0].ambient", directionalLight.getAmbient());
-		    setVec3("directionalLights[0].diffuse", directionalLight.getDiffuse());
-		    setVec3("directionalLights[0].specular", directionalLight.getSpecular());
-		}
-
-		int size = directionalLights.size();
-		if (size != 0) {
-			if (size > limit) {
-				size = limit;
-			}
-			setInt("dLights", size);
-			for (int dLight = 0; dLight < size; dLight++) {
-				setVec3("directionalLights[" + std::to_string(dLight) + "].position", directionalLights[dLight].getDirection());
-		        setVec3("directionalLights[" + std::to_string(dLight) + "].ambient", directionalLights[dLight].getAmbient());
-		        setVec3("directionalLights[" + std::to_string(dLight) + "].diffuse", directionalLights[dLight].getDiffuse());
-		        setVec3("directionalLights[" + std::to_string(dLight) + "].specular", directionalLights[dLight].getSpecular());
-	   		}
-   		}
-
-   		size = pointLights.size();
-   		if (size != 0) {
-   			if (size > limit) {
-				size = limit;
-			}
-	        setInt("pLights", size);
-	        for (int pLight = 0; pLight < size; pLight++) {
-				setVec3("pointLights[" + std::to_string(pLight) + "].position", pointLights[pLight].getPosition());
-		        setVec3("pointLights[" + std::to_string(pLight) + "].ambient", pointLights[pLight].getAmbient());
-		        setVec3("pointLights[" + std::to_string(pLight) + "].diffuse", pointLights[pLight].getDiffuse());
-		        setVec3("pointLights[" + std::to_string(pLight) + "].specular", pointLights[pLight].getSpecular());
-		        setFloat("pointLights[" + std::to_string(pLight) + "].constant", pointLights[pLight].getConstant());
-		        setFloat("pointLights[" + std::to_string(pLight) + "].linear", pointLights[pLight].getLinear());
-		        setFloat("pointLights[" + std::to_string(pLight) + "].quadratic", pointLights[pLight].getQuadratic());
-	    	}
-    	}
-
-    	size = spotLights.size();
-    	if (size != 0) {
-    		if (size > limit) {
-				size = limit;
-			}
-	        setInt("sLights", size);
-	        for (int sLight = 0; sLight < size; sLight++) {
-		        setVec3("spotLights[" + std::to_string(sLight) + "].position", spotLights[sLight].getPosition());
-		        setVec3("spotLights[" + std::to_string(sLight) + "].direction", spotLights[sLight].getDirection());
-		        setVec3("spotLights[" + std::to_string(sLight) + "].ambient", spotLights[sLight].getAmbient());
-		        setVec3("spotLights[" + std::to_string(sLight) + "].diffuse", spotLights[sLight].getDiffuse());
-		        setVec3("spotLights[" + std::to_string(sLight) + "].specular", spotLights[sLight].getSpecular());
-		        setFloat("spotLights[" + std::to_string(sLight) + "].constant", spotLights[sLight].getConstant());
-		        setFloat("spotLights[" + std::to_string(sLight) + "].linear", spotLights[sLight].getLinear());
-		        setFloat("spotLights[" + std::to_string(sLight) + "].quadratic", spotLights[sLight].getQuadratic());
-		        setFloat("spotLights[" + std::to_string(sLight) + "].cutOff", spotLights[sLight].getCutOff());
-		        setFloat("spotLights[" + std::to_string(sLight) + "].outerCutOff", spotLights[sLight].getOuterCutOff());
-    		}
-		}
-	}
+	// The lights themselves come from the LightBuffer (lights.h).
 
+    // Set on the first setup(), so the program can finish building.
     void loadMaterials() {
-        glUseProgram(sp_);
-        setInt("material.diffuse", 0);
-        setInt("material.specular", 1);
-        setFloat("material.shininess", 32.0f);
-    }
-
-    void loadLightColor(glm::vec4 color) {
-        glUseProgram(sp_);
-        setVec4("light_color", color);
+        load_materials_ = true;
     }
 
-	void setBool(const std::string &name, const bool value) const
+	void setBool(UniformName name, const bool value) const
     {
-        glUniform1i(glGetUniformLocation(sp_, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
 
-	void setInt(const std::string &name, const int value) const
+	void setInt(UniformName name, const int value) const
     {
-        glUniform1i(glGetUniformLocation(sp_, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
 
-	void setFloat(const std::string &name, const float value) const
+	void setFloat(UniformName name, const float value) const
     {
-        glUniform1f(glGetUniformLocation(sp_, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
 
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(UniformName name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(sp_, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
 
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(UniformName name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(sp_, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
 
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(UniformName name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(sp_, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
 
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(UniformName name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(sp_, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(UniformName name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(sp_, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(UniformName name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(sp_, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 	// <<<Lights>>>
 private:
 	//void initMaterialUniform();
 	//void createMaterialTexture();
 
-	int vao_;
+	int vao_ = -1;
+	bool owns_vao_ = false;
 	RenderDataInput input_;
 	std::vector<ShaderUniform> uniforms_;
 	//std::vector<std::vector<ShaderUniform>> material_uniforms_;
 
 	std::vector<unsigned> glbuffers_, unilocs_, malocs_;
+	bool unilocs_ready_ = false;
+	bool load_materials_ = false;
+	std::vector<size_t> glbuffer_sizes_; // current allocation of each buffer
+	// CPU copy of the interleaved buffer for updateVBO, and its index in
+	// glbuffers_ (-1 if none)
+	std::vector<char> interleaved_;
+	int interleaved_buffer_ = -1;
 	//std::vector<unsigned> gltextures_, matexids_;
 	//unsigned sampler2d_;
-	unsigned vs_ = 0, gs_ = 0, fs_ = 0;
 	unsigned sp_ = 0;
 
+	struct Program {
+		unsigned id = 0;
+		// Every active uniform by UniformName hash, filled after linking.
+		std::unordered_map<uint64_t, int> locations;
+		// Until finishProgram the link may still be running; nothing has
+		// been checked and locations is empty.
+		bool pending = false;
+		unsigned shaders[3] = { 0, 0, 0 }; // VS, GS, FS; none if loaded
+		uint64_t binary_key = 0;
+		bool save_binary = false;
+		// Startup timeline, ms since the first program was submitted
+		double submit_ms = 0.0, ready_ms = -1.0, wait_ms = 0.0;
+	};
+	// VS, GS, FS, (position, name) of the attributes, outputs
+	typedef std::tuple<const char*, const char*, const char*,
+		std::vector<std::pair<int, std::string>>,
+		std::vector<std::string>> ProgramKey;
+	Program* program_ = nullptr;
+
 	static unsigned compileShader(const char*, int type);
+	static Program& linkProgram(const std::vector<const char*>& shaders,
+			const std::vector<std::pair<int, std::string>>& attributes,
+			const std::vector<const char*>& output);
+	static void finishProgram(Program& program);
+	static void pollPrograms();
+	static void cacheUniformLocations(Program& program);
+	static bool loadProgramBinary(Program& program, uint64_t key);
+	static void saveProgramBinary(const Program& program, uint64_t key, double build_ms);
 	static std::map<const char*, unsigned> shader_cache_;
+	static std::map<ProgramKey, Program> program_cache_;
+	static size_t upload_bytes_;
+	static size_t uniform_lookups_;
+	static size_t passes_, programs_linked_, shaders_compiled_;
+	static double compile_ms_, link_ms_, wait_ms_;
+	static int parallel_compile_; // -1 until checked
+	static bool use_binaries_;
+	static size_t binaries_loaded_, binaries_rejected_;
+	static double load_ms_, saved_ms_;
+
+	int findBuffer(int position) const;
+	void scatter(const RenderInputMeta& meta, const void* data, size_t nelements);
+	void uploadBuffer(int target, int bufferid, const void* data, size_t bytes);
 
 	static void bind_uniforms(std::vector<ShaderUniform>& uniforms, const std::vector<unsigned>& unilocs);
 };
@@ -0,0 +1,77 @@
+#include "shader_permutation.h"
+
+#include <cstring>
+#include <map>
+#include <utility>
+
+#include "light_clusters.h"
+#include "lights.h"
+
+namespace {
+    // std::map never moves its nodes, so the c_str() of a variant stays put.
+    std::map<std::pair<const char*, uint64_t>, std::string> variants;
+};
+
+ShaderPermutation ShaderPermutation::currentLights() {
+    const LightBuffer& lights = LightBuffer::get();
+    ShaderPermutation permutation;
+    permutation.directional_lights = lights.directionalCount();
+    permutation.point_lights = lights.pointCount();
+    permutation.spot_lights = lights.spotCount();
+    permutation.clustered = LightClusters::get().enabled();
+    return permutation;
+}
+
+uint64_t ShaderPermutation::key() const {
+    // 8 bits per count (+1 so -1 fits), one per flag.
+    return uint64_t(directional_lights + 1) |
+        uint64_t(point_lights + 1) << 8 |
+        uint64_t(spot_lights + 1) << 16 |
+        uint64_t(textured) << 24 |
+        uint64_t(emissive) << 25 |
+        uint64_t(specular) << 26 |
+        uint64_t(clustered) << 27;
+}
+
+std::string ShaderPermutation::defines() const {
+    std::string out;
+    if (directional_lights >= 0)
+        out += "#define NUM_DIR_LIGHTS " + std::to_string(directional_lights) + "\n";
+    if (point_lights >= 0)
+        out += "#define NUM_POINT_LIGHTS " + std::to_string(point_lights) + "\n";
+    if (spot_lights >= 0)
+        out += "#define NUM_SPOT_LIGHTS " + std::to_string(spot_lights) + "\n";
+    out += std::string("#define TEXTURED ") + (textured ? "1" : "0") + "\n";
+    out += std::string("#define EMISSIVE ") + (emissive ? "1" : "0") + "\n";
+    out += std::string("#define SPECULAR ") + (specular ? "1" : "0") + "\n";
+    if (clustered) {
+        out += "#define CLUSTERED 1\n";
+        out += "#define CLUSTER_GRID ivec3(" + std::to_string(LightClusters::kTilesX) + ", " +
+            std::to_string(LightClusters::kTilesY) + ", " + std::to_string(LightClusters::kSlices) + ")\n";
+    }
+    return out;
+}
+
+const char* permuteShader(const char* source, const ShaderPermutation& permutation) {
+    if (!source)
+        return nullptr;
+    auto key = std::make_pair(source, permutation.key());
+    auto iter = variants.find(key);
+    if (iter != variants.end())
+        return iter->second.c_str();
+
+    // #version has to stay the first line.
+    std::string variant(source);
+    size_t line = 0;
+    const char* version = strstr(source, "#version");
+    if (version) {
+        const char* end = strchr(version, '\n');
+        line = end ? size_t(end - source) + 1 : variant.size();
+    }
+    variant.insert(line, permutation.defines());
+    return variants.emplace(key, std::move(variant)).first->second.c_str();
+}
+
+size_t shaderPermutationCount() {
+    return variants.size();
+}
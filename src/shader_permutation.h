@@ -0,0 +1,54 @@
+#ifndef SHADER_PERMUTATION_H
+#define SHADER_PERMUTATION_H
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Compile-time specialized variants of one shader source. The permutation
+ * becomes #defines inserted right after the #version line:
+ *      NUM_DIR_LIGHTS, NUM_POINT_LIGHTS, NUM_SPOT_LIGHTS: loop bounds, so
+ *              the light loops unroll instead of reading dLights/pLights/
+ *              sLights from the Lights block
+ *      TEXTURED: 0 if the mesh has no uvs; the maps are then read once at
+ *              (0, 0), what an unset vertex_uv gives
+ *      EMISSIVE: 0 if light_color is the default (0, 0, 0, 1)
+ *      SPECULAR: 0 to skip the specular map and term
+ *      CLUSTERED: point and spot lights from the LightClusters buffer
+ *              textures instead of the Lights block (light_clusters.h),
+ *              with CLUSTER_GRID its tile and slice counts
+ * A shader that sees none of them (the plain source) behaves as before:
+ * counts from the Lights block and every feature on. object.frag reads all
+ * of them, default.frag only the light counts.
+ */
+struct ShaderPermutation {
+    // -1: read the count from the Lights block at run time
+    int directional_lights = -1;
+    int point_lights = -1;
+    int spot_lights = -1;
+    bool textured = true;
+    bool emissive = true;
+    bool specular = true;
+    bool clustered = false;
+
+    // The light counts of the current LightBuffer, every feature on, and
+    // clustered if LightClusters has lights.
+    static ShaderPermutation currentLights();
+
+    uint64_t key() const;
+    std::string defines() const;
+};
+
+/*
+ * permuteShader: source specialized for permutation. Variants are built the
+ * first time they are asked for and cached by source and permutation key,
+ * so the same pointer always comes back for the same pair. RenderPass keys
+ * its shaders and programs by that pointer and compiles each variant once,
+ * when a pass first uses it.
+ */
+const char* permuteShader(const char* source, const ShaderPermutation& permutation);
+
+// Number of variants built so far.
+size_t shaderPermutationCount();
+
+#endif
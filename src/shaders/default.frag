@@ -8,6 +8,8 @@ struct Material {
     float shininess;
 };
 
+// The "Lights" block is one std140 uniform buffer shared by every program,
+// see LightBuffer in lights.h. Each float fills the padding after a vec3.
 struct DirectionalLight {
     vec3 direction;
     vec3 ambient;
@@ -17,27 +19,47 @@ struct DirectionalLight {
 
 struct PointLight {
     vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
     float constant;
+    vec3 ambient;
     float linear;
+    vec3 diffuse;
     float quadratic;
+    vec3 specular;
 };
 
 struct SpotLight {
     vec3 position;
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
     float constant;
+    vec3 direction;
     float linear;
+    vec3 ambient;
     float quadratic;
+    vec3 diffuse;
     float cutOff;
+    vec3 specular;
     float outerCutOff;
 };
 
+layout(std140) uniform Lights {
+    DirectionalLight directionalLights[10];
+    PointLight pointLights[10];
+    SpotLight spotLights[10];
+    int dLights;
+    int pLights;
+    int sLights;
+};
+
+// Light counts of a permutation, see shader_permutation.h.
+#ifndef NUM_DIR_LIGHTS
+#define NUM_DIR_LIGHTS dLights
+#endif
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS pLights
+#endif
+#ifndef NUM_SPOT_LIGHTS
+#define NUM_SPOT_LIGHTS sLights
+#endif
+
 in vec4 normal;
 in vec4 light_direction;
 in vec4 world_normal;
@@ -46,14 +68,6 @@ in vec4 world_position;
 uniform vec4 view_position;
 uniform vec4 light_color;
 
-uniform int dLights;
-uniform int pLights;
-uniform int sLights;
-
-uniform DirectionalLight directionalLights[10];
-uniform PointLight pointLights[10];
-uniform SpotLight spotLights[10];
-
 out vec4 fragment_color;
 
 // calculates the color when using a directional light.
@@ -127,15 +141,15 @@ void main()
 	vec3 norm = vec3(normalize(normal));
 	vec3 viewDir = normalize(vec3(view_position) - vec3(world_position));
 
-    for (int dLight = 0; dLight < dLights; dLight++) {
+    for (int dLight = 0; dLight < NUM_DIR_LIGHTS; dLight++) {
         fragment_color += vec4(CalcDirLight(directionalLights[dLight], norm, viewDir), 1.0);
     }
 
-    for (int pLight = 0; pLight < pLights; pLight++) {
+    for (int pLight = 0; pLight < NUM_POINT_LIGHTS; pLight++) {
 	   fragment_color += vec4(CalcPointLight(pointLights[pLight], norm, vec3(world_position), viewDir), 1.0);
     }
 
-    for (int sLight = 0; sLight < sLights; sLight++) {
+    for (int sLight = 0; sLight < NUM_SPOT_LIGHTS; sLight++) {
         fragment_color += vec4(CalcSpotLight(spotLights[sLight], norm, vec3(world_position), viewDir), 1.0);
     }
 
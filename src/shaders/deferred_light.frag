@@ -0,0 +1,175 @@
+R"zzz(#version 330 core
+
+// Lighting pass of the deferred path (deferred_renderer.h): one full-screen
+// quad over the G-buffer gbuffer.frag wrote. Point and spot lights come
+// from this pixel's cluster when CLUSTERED is set (light_clusters.h), so
+// the cost is pixels times the lights near them.
+
+struct DirectionalLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    float constant;
+    vec3 direction;
+    float linear;
+    vec3 ambient;
+    float quadratic;
+    vec3 diffuse;
+    float cutOff;
+    vec3 specular;
+    float outerCutOff;
+};
+
+layout(std140) uniform Lights {
+    DirectionalLight directionalLights[10];
+    PointLight pointLights[10];
+    SpotLight spotLights[10];
+    int dLights;
+    int pLights;
+    int sLights;
+};
+
+#ifndef NUM_DIR_LIGHTS
+#define NUM_DIR_LIGHTS dLights
+#endif
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS pLights
+#endif
+#ifndef NUM_SPOT_LIGHTS
+#define NUM_SPOT_LIGHTS sLights
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+
+in vec2 TexCoords;
+
+uniform sampler2D gbuffer_emission;
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_specular;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_position;
+uniform mat4 view;
+uniform vec3 view_position;
+
+#if CLUSTERED
+uniform samplerBuffer cluster_lights;
+uniform usamplerBuffer cluster_table;
+uniform usamplerBuffer cluster_indices;
+uniform vec2 cluster_depth;
+uniform vec2 cluster_tile;
+#endif
+
+out vec4 fragment_color;
+
+struct Surface {
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+// One light of any kind: its colors, its direction from the surface and
+// how much of it arrives.
+vec3 Shade(vec3 ambient, vec3 diffuse, vec3 specular, vec3 lightDir, float attenuation,
+           Surface surface, vec3 normal, vec3 viewDir)
+{
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+    return (ambient * surface.diffuse + diffuse * diff * surface.diffuse +
+            specular * spec * surface.specular) * attenuation;
+}
+
+float Attenuation(vec3 lightPos, float constant, float linear, float quadratic, vec3 fragPos)
+{
+    float distance = length(lightPos - fragPos);
+    return 1.0 / (constant + linear * distance + quadratic * (distance * distance));
+}
+
+float SpotIntensity(vec3 lightDir, vec3 direction, float cutOff, float outerCutOff)
+{
+    float theta = dot(lightDir, normalize(-direction));
+    return clamp((theta - outerCutOff) / (cutOff - outerCutOff), 0.0, 1.0);
+}
+
+void main()
+{
+    vec4 emission = texture(gbuffer_emission, TexCoords);
+    vec4 position = texture(gbuffer_position, TexCoords);
+    // Forward-shaded geometry (the sponge, the floor) is already lit.
+    if (position.w == 0.0) {
+        fragment_color = clamp(emission, 0.0, 1.0);
+        return;
+    }
+
+    vec3 fragPos = position.xyz;
+    vec3 normal = normalize(texture(gbuffer_normal, TexCoords).xyz);
+    vec3 viewDir = normalize(view_position - fragPos);
+    vec4 specular = texture(gbuffer_specular, TexCoords);
+    Surface surface;
+    surface.diffuse = texture(gbuffer_albedo, TexCoords).rgb;
+    surface.specular = specular.rgb;
+    surface.shininess = specular.a * 256.0;
+
+    vec3 color = emission.rgb;
+    for (int i = 0; i < NUM_DIR_LIGHTS; i++) {
+        DirectionalLight light = directionalLights[i];
+        color += Shade(light.ambient, light.diffuse, light.specular, normalize(-light.direction), 1.0,
+                       surface, normal, viewDir);
+    }
+
+#if CLUSTERED
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / cluster_tile), CLUSTER_GRID.xy - 1);
+    int slice = clamp(int(log(max(depth, 1e-6)) * cluster_depth.x - cluster_depth.y), 0, CLUSTER_GRID.z - 1);
+    uvec2 cluster = texelFetch(cluster_table, (slice * CLUSTER_GRID.y + tile.y) * CLUSTER_GRID.x + tile.x).xy;
+    for (uint i = 0u; i < cluster.y; i++) {
+        int base = int(texelFetch(cluster_indices, int(cluster.x + i)).x) * 6;
+        vec4 t0 = texelFetch(cluster_lights, base);
+        vec4 t1 = texelFetch(cluster_lights, base + 1);
+        vec4 t2 = texelFetch(cluster_lights, base + 2);
+        vec4 t3 = texelFetch(cluster_lights, base + 3);
+        vec3 lightDir = normalize(t0.xyz - fragPos);
+        float attenuation = Attenuation(t0.xyz, t0.w, t1.w, t2.w, fragPos);
+        if (t3.w > 0.5) {
+            vec4 t4 = texelFetch(cluster_lights, base + 4);
+            attenuation *= SpotIntensity(lightDir, t4.xyz, t4.w, texelFetch(cluster_lights, base + 5).x);
+        }
+        color += Shade(t1.xyz, t2.xyz, t3.xyz, lightDir, attenuation, surface, normal, viewDir);
+    }
+#else
+    for (int i = 0; i < NUM_POINT_LIGHTS; i++) {
+        PointLight light = pointLights[i];
+        vec3 lightDir = normalize(light.position - fragPos);
+        float attenuation = Attenuation(light.position, light.constant, light.linear, light.quadratic, fragPos);
+        color += Shade(light.ambient, light.diffuse, light.specular, lightDir, attenuation, surface, normal, viewDir);
+    }
+    for (int i = 0; i < NUM_SPOT_LIGHTS; i++) {
+        SpotLight light = spotLights[i];
+        vec3 lightDir = normalize(light.position - fragPos);
+        float attenuation = Attenuation(light.position, light.constant, light.linear, light.quadratic, fragPos) *
+            SpotIntensity(lightDir, light.direction, light.cutOff, light.outerCutOff);
+        color += Shade(light.ambient, light.diffuse, light.specular, lightDir, attenuation, surface, normal, viewDir);
+    }
+#endif
+
+    // The forward path goes through an 8 bit MSAA buffer, clamping the
+    // same way keeps the post chain's input alike for both.
+    fragment_color = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
+)zzz"
@@ -0,0 +1,60 @@
+R"zzz(#version 330 core
+
+// object.frag's G-buffer half for the deferred path (deferred_renderer.h):
+// the surface at this fragment, lit later by deferred_light.frag. Reads
+// the TEXTURED, EMISSIVE and SPECULAR permutation defines.
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef EMISSIVE
+#define EMISSIVE 1
+#endif
+#ifndef SPECULAR
+#define SPECULAR 1
+#endif
+
+in vec2 uv;
+in vec3 scene_position;
+in vec3 scene_normal;
+
+#if EMISSIVE
+uniform vec4 light_color = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+#endif
+
+uniform Material material;
+
+out vec4 fragment_color;  // emission, what the lights add to
+out vec4 albedo;
+out vec4 specular;        // a: shininess / 256
+out vec4 normal;
+out vec4 position;        // w: 1 where there is a surface to light
+
+void main()
+{
+#if TEXTURED
+    vec2 texcoord = uv;
+#else
+    vec2 texcoord = vec2(0.0);
+#endif
+#if EMISSIVE
+    fragment_color = vec4(light_color.rgb, 1.0);
+#else
+    fragment_color = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
+    albedo = vec4(vec3(texture(material.diffuse, texcoord)), 1.0);
+#if SPECULAR
+    specular = vec4(vec3(texture(material.specular, texcoord)), material.shininess / 256.0);
+#else
+    specular = vec4(0.0, 0.0, 0.0, material.shininess / 256.0);
+#endif
+    normal = vec4(normalize(scene_normal), 0.0);
+    position = vec4(scene_position, 1.0);
+}
+)zzz"
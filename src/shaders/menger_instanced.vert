@@ -0,0 +1,27 @@
+R"zzz(#version 330 core
+in vec4 vertex_position;
+in vec4 vertex_normal;
+// xyz: sub-cube center, w: edge length
+in vec4 instance_offset;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 light_position;
+out vec4 light_direction;
+out vec4 normal;
+out vec4 world_normal;
+out vec4 world_position;
+void main()
+{
+// Place the unit cube at this instance
+	vec4 position = vec4(vertex_position.xyz * instance_offset.w + instance_offset.xyz, 1.0);
+// Transform vertex into clipping coordinates
+	gl_Position = projection * view * position;
+// Lighting in camera coordinates
+//  Compute light direction and transform to camera coordinates
+	light_direction = view * (light_position - position);
+//  Transform normal to camera coordinates
+	normal = view * vertex_normal;
+	world_normal = vertex_normal;
+	world_position = projection * view * position;
+}
+)zzz"
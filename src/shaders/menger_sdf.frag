@@ -0,0 +1,226 @@
+R"zzz(#version 330 core
+
+// Source: https://learnopengl.com/Lighting/Multiple-lights
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+// The "Lights" block is one std140 uniform buffer shared by every program,
+// see LightBuffer in lights.h. Each float fills the padding after a vec3.
+struct DirectionalLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    float constant;
+    vec3 direction;
+    float linear;
+    vec3 ambient;
+    float quadratic;
+    vec3 diffuse;
+    float cutOff;
+    vec3 specular;
+    float outerCutOff;
+};
+
+layout(std140) uniform Lights {
+    DirectionalLight directionalLights[10];
+    PointLight pointLights[10];
+    SpotLight spotLights[10];
+    int dLights;
+    int pLights;
+    int sLights;
+};
+
+in vec4 proxy_position;
+in vec3 eye;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 view_position;
+uniform vec4 light_color;
+// xyz: center, w: edge length of the whole sponge
+uniform vec4 menger_bounds;
+uniform int level;
+
+out vec4 fragment_color;
+
+const int kMaxSteps = 160;
+// Hit threshold relative to the ray length, roughly a pixel.
+const float kPixelAngle = 0.0005;
+
+// Distance to the sponge in its local [-1, 1]^3 frame. Levels whose holes
+// are smaller than min_size are not carved, they can't be seen anyway, so
+// the cost stops growing with the level.
+// Source: https://iquilezles.org/articles/menger/
+float menger(vec3 p, float min_size)
+{
+	vec3 q = abs(p) - vec3(1.0);
+	float d = min(max(q.x, max(q.y, q.z)), 0.0) + length(max(q, 0.0));
+	float s = 1.0;
+	for (int m = 0; m < level; m++) {
+		if (2.0 / s < min_size)
+			break;
+		vec3 a = mod(p * s, 2.0) - 1.0;
+		s *= 3.0;
+		vec3 r = abs(1.0 - 3.0 * abs(a));
+		float da = max(r.x, r.y);
+		float db = max(r.y, r.z);
+		float dc = max(r.z, r.x);
+		float c = (min(da, min(db, dc)) - 1.0) / s;
+		d = max(d, c);
+	}
+	return d;
+}
+
+float sponge(vec3 p, float min_size)
+{
+	float half_length = 0.5 * menger_bounds.w;
+	return menger((p - menger_bounds.xyz) / half_length, min_size / half_length) * half_length;
+}
+
+// calculates the color when using a directional light.
+vec3 CalcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 1.0); // material.shininess);
+    // combine results
+    vec3 ambient = light.ambient; // * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse = light.diffuse * diff; // * vec3(texture(material.diffuse, TexCoords));
+    vec3 specular = light.specular * spec; // * vec3(texture(material.specular, TexCoords));
+    return (ambient + diffuse + specular);
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 1.0); // material.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    vec3 ambient = light.ambient; // * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse = light.diffuse * diff; // * vec3(texture(material.diffuse, TexCoords));
+    vec3 specular = light.specular * spec; // * vec3(texture(material.specular, TexCoords));
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+// calculates the color when using a spot light.
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 1.0); // material.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient; // * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse = light.diffuse * diff; // * vec3(texture(material.diffuse, TexCoords));
+    vec3 specular = light.specular * spec; // * vec3(texture(material.specular, TexCoords));
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+    return (ambient + diffuse + specular);
+}
+
+void main()
+{
+	vec3 dir = normalize(proxy_position.xyz - eye);
+
+	// Only march the part of the ray inside the bounds.
+	vec3 lo = menger_bounds.xyz - vec3(0.5 * menger_bounds.w);
+	vec3 hi = menger_bounds.xyz + vec3(0.5 * menger_bounds.w);
+	vec3 t1 = (lo - eye) / dir;
+	vec3 t2 = (hi - eye) / dir;
+	vec3 tn = min(t1, t2);
+	vec3 tf = max(t1, t2);
+	float t = max(max(max(tn.x, tn.y), tn.z), 0.0);
+	float t_exit = min(min(tf.x, tf.y), tf.z);
+
+	bool hit = false;
+	for (int i = 0; i < kMaxSteps && t <= t_exit; i++) {
+		float eps = kPixelAngle * t;
+		float d = sponge(eye + dir * t, eps);
+		if (d < eps) {
+			hit = true;
+			break;
+		}
+		t += d;
+	}
+	if (!hit)
+		discard;
+
+	vec3 p = eye + dir * t;
+	float eps = kPixelAngle * t;
+	vec2 e = vec2(0.5 * eps, 0.0);
+	vec3 n = normalize(vec3(sponge(p + e.xyy, eps) - sponge(p - e.xyy, eps),
+	                        sponge(p + e.yxy, eps) - sponge(p - e.yxy, eps),
+	                        sponge(p + e.yyx, eps) - sponge(p - e.yyx, eps)));
+
+	vec4 clip = projection * view * vec4(p, 1.0);
+	gl_FragDepth = 0.5 * (clip.z / clip.w) + 0.5;
+
+	// Same inputs default.vert hands to default.frag, so both modes are lit
+	// the same way.
+	vec4 normal = view * vec4(n, 0.0);
+	vec4 world_normal = vec4(n, 0.0);
+	vec4 world_position = clip;
+
+	vec4 color = abs(normalize(world_normal)) + light_color;
+
+	vec3 norm = vec3(normalize(normal));
+	vec3 viewDir = normalize(vec3(view_position) - vec3(world_position));
+
+	fragment_color = vec4(0.0);
+    for (int dLight = 0; dLight < dLights; dLight++) {
+        fragment_color += vec4(CalcDirLight(directionalLights[dLight], norm, viewDir), 1.0);
+    }
+
+    for (int pLight = 0; pLight < pLights; pLight++) {
+	   fragment_color += vec4(CalcPointLight(pointLights[pLight], norm, vec3(world_position), viewDir), 1.0);
+    }
+
+    for (int sLight = 0; sLight < sLights; sLight++) {
+        fragment_color += vec4(CalcSpotLight(spotLights[sLight], norm, vec3(world_position), viewDir), 1.0);
+    }
+
+    fragment_color *= color;
+}
+)zzz"
@@ -0,0 +1,14 @@
+R"zzz(#version 330 core
+in vec4 vertex_position;
+uniform mat4 view;
+uniform mat4 projection;
+out vec4 proxy_position;
+out vec3 eye;
+void main()
+{
+// The bounding cube is only a proxy, the fragment shader finds the surface
+	gl_Position = projection * view * vertex_position;
+	proxy_position = vertex_position;
+	eye = vec3(inverse(view)[3]);
+}
+)zzz"
@@ -8,6 +8,8 @@ struct Material {
     float shininess;
 };
 
+// The "Lights" block is one std140 uniform buffer shared by every program,
+// see LightBuffer in lights.h. Each float fills the padding after a vec3.
 struct DirectionalLight {
     vec3 direction;
     vec3 ambient;
@@ -17,27 +19,60 @@ struct DirectionalLight {
 
 struct PointLight {
     vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
     float constant;
+    vec3 ambient;
     float linear;
+    vec3 diffuse;
     float quadratic;
+    vec3 specular;
 };
 
 struct SpotLight {
     vec3 position;
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
     float constant;
+    vec3 direction;
     float linear;
+    vec3 ambient;
     float quadratic;
+    vec3 diffuse;
     float cutOff;
+    vec3 specular;
     float outerCutOff;
 };
 
+layout(std140) uniform Lights {
+    DirectionalLight directionalLights[10];
+    PointLight pointLights[10];
+    SpotLight spotLights[10];
+    int dLights;
+    int pLights;
+    int sLights;
+};
+
+// Permutation defines, see shader_permutation.h. Without them the light
+// counts come from the Lights block and every feature is on.
+#ifndef NUM_DIR_LIGHTS
+#define NUM_DIR_LIGHTS dLights
+#endif
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS pLights
+#endif
+#ifndef NUM_SPOT_LIGHTS
+#define NUM_SPOT_LIGHTS sLights
+#endif
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef EMISSIVE
+#define EMISSIVE 1
+#endif
+#ifndef SPECULAR
+#define SPECULAR 1
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+
 in vec4 normal;
 in vec4 light_direction;
 in vec4 world_normal;
@@ -45,51 +80,72 @@ in vec4 world_position;
 in vec2 uv;
 
 uniform vec4 view_position;
+#if EMISSIVE
 uniform vec4 light_color = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+#endif
 
-uniform int dLights;
-uniform int pLights;
-uniform int sLights;
-
-uniform DirectionalLight directionalLights[10];
-uniform PointLight pointLights[10];
-uniform SpotLight spotLights[10];
 uniform Material material;
 
+#if CLUSTERED
+// Point and spot lights binned per view cluster, see light_clusters.h.
+in vec3 scene_position;
+in vec3 scene_normal;
+in float view_depth;
+uniform samplerBuffer cluster_lights;
+uniform usamplerBuffer cluster_table;
+uniform usamplerBuffer cluster_indices;
+uniform vec2 cluster_depth;
+uniform vec2 cluster_tile;
+#endif
+
 out vec4 fragment_color;
 
+// The material maps at this fragment, read once for all the lights.
+struct Surface {
+    vec3 diffuse;
+    vec3 specular;
+};
+
+float CalcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir)
+{
+#if SPECULAR
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+#else
+    return 0.0;
+#endif
+}
+
 // calculates the color when using a directional light.
-vec3 CalcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirectionalLight light, Surface surface, vec3 normal, vec3 viewDir)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = CalcSpecular(lightDir, normal, viewDir);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, uv));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, uv));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, uv));
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
     return (ambient + diffuse + specular);
 }
 
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = CalcSpecular(lightDir, normal, viewDir);
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, uv));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, uv));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, uv));
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -97,14 +153,13 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 }
 
 // calculates the color when using a spot light.
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = CalcSpecular(lightDir, normal, viewDir);
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
@@ -113,34 +168,96 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, uv));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, uv));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, uv));
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
 }
 
+#if CLUSTERED
+// calculates the color of one clustered light, a point light or a spot
+// light (type in the w of its fourth texel).
+vec3 CalcClusteredLight(int index, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    int base = index * 6;
+    vec4 position = texelFetch(cluster_lights, base);
+    vec4 ambient = texelFetch(cluster_lights, base + 1);
+    vec4 diffuse = texelFetch(cluster_lights, base + 2);
+    vec4 specular = texelFetch(cluster_lights, base + 3);
+    vec3 lightDir = normalize(position.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir);
+    float distance = length(position.xyz - fragPos);
+    float attenuation = 1.0 / (position.w + ambient.w * distance + diffuse.w * (distance * distance));
+    if (specular.w > 0.5) {
+        vec4 direction = texelFetch(cluster_lights, base + 4);
+        float outerCutOff = texelFetch(cluster_lights, base + 5).x;
+        float theta = dot(lightDir, normalize(-direction.xyz));
+        attenuation *= clamp((theta - outerCutOff) / (direction.w - outerCutOff), 0.0, 1.0);
+    }
+    return (ambient.xyz * surface.diffuse + diffuse.xyz * diff * surface.diffuse +
+            specular.xyz * spec * surface.specular) * attenuation;
+}
+#endif
+
 void main()
 {
 	//vec4 color = abs(normalize(world_normal)) + light_color;
 
+#if CLUSTERED
+    // Clustered lights are in the scene's space, so every light is shaded
+    // there, as in the deferred path's deferred_light.frag.
+    vec3 norm = normalize(scene_normal);
+    vec3 viewDir = normalize(vec3(view_position) - scene_position);
+#else
 	vec3 norm = vec3(normalize(normal));
 	vec3 viewDir = normalize(vec3(view_position) - vec3(world_position));
+#endif
 
-    for (int dLight = 0; dLight < dLights; dLight++) {
-        fragment_color += vec4(CalcDirLight(directionalLights[dLight], norm, viewDir), 1.0);
+#if TEXTURED
+    vec2 texcoord = uv;
+#else
+    vec2 texcoord = vec2(0.0);
+#endif
+    Surface surface;
+    surface.diffuse = vec3(texture(material.diffuse, texcoord));
+#if SPECULAR
+    surface.specular = vec3(texture(material.specular, texcoord));
+#else
+    surface.specular = vec3(0.0);
+#endif
+
+    fragment_color = vec4(0.0);
+    for (int dLight = 0; dLight < NUM_DIR_LIGHTS; dLight++) {
+        fragment_color += vec4(CalcDirLight(directionalLights[dLight], surface, norm, viewDir), 1.0);
     }
 
-    for (int pLight = 0; pLight < pLights; pLight++) {
-	   fragment_color += vec4(CalcPointLight(pointLights[pLight], norm, vec3(world_position), viewDir), 1.0);
+#if CLUSTERED
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / cluster_tile), CLUSTER_GRID.xy - 1);
+    int slice = clamp(int(log(max(view_depth, 1e-6)) * cluster_depth.x - cluster_depth.y), 0, CLUSTER_GRID.z - 1);
+    uvec2 cluster = texelFetch(cluster_table, (slice * CLUSTER_GRID.y + tile.y) * CLUSTER_GRID.x + tile.x).xy;
+    for (uint i = 0u; i < cluster.y; i++) {
+        int light = int(texelFetch(cluster_indices, int(cluster.x + i)).x);
+        fragment_color += vec4(CalcClusteredLight(light, surface, norm, scene_position, viewDir), 1.0);
+    }
+#else
+    for (int pLight = 0; pLight < NUM_POINT_LIGHTS; pLight++) {
+	   fragment_color += vec4(CalcPointLight(pointLights[pLight], surface, norm, vec3(world_position), viewDir), 1.0);
     }
 
-    for (int sLight = 0; sLight < sLights; sLight++) {
-        fragment_color += vec4(CalcSpotLight(spotLights[sLight], norm, vec3(world_position), viewDir), 1.0);
+    for (int sLight = 0; sLight < NUM_SPOT_LIGHTS; sLight++) {
+        fragment_color += vec4(CalcSpotLight(spotLights[sLight], surface, norm, vec3(world_position), viewDir), 1.0);
     }
+#endif
 
+#if EMISSIVE
     fragment_color += light_color;
+#else
+    // What the default light_color adds.
+    fragment_color.a += 1.0;
+#endif
 }
 )zzz"
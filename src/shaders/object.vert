@@ -11,6 +11,10 @@ out vec4 normal;
 out vec4 world_normal;
 out vec4 world_position;
 out vec2 uv;
+// World space and view depth, for the clustered lights
+out vec3 scene_position;
+out vec3 scene_normal;
+out float view_depth;
 void main()
 {
 // Transform vertex into clipping coordinates
@@ -22,6 +26,10 @@ void main()
         normal = view * vertex_normal;
         world_normal = vertex_normal;
         world_position = projection * view * vertex_position;
+        vec4 scene = model * vertex_position;
+        scene_position = vec3(scene);
+        scene_normal = mat3(model) * vec3(vertex_normal);
+        view_depth = -(view * scene).z;
         uv = vertex_uv;
 }
 )zzz"
\ No newline at end of file
@@ -0,0 +1,57 @@
+R"zzz(#version 330 core
+// object.vert for meshes in the PackedMesh format (see packed_mesh.h)
+in uvec4 vertex_position;
+in vec2 vertex_uv;
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 light_position;
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+uniform vec4 uv_transform;
+out vec4 light_direction;
+out vec4 normal;
+out vec4 world_normal;
+out vec4 world_position;
+out vec2 uv;
+// World space and view depth, for the clustered lights
+out vec3 scene_position;
+out vec3 scene_normal;
+out float view_depth;
+
+float snorm8(uint b)
+{
+	int i = int(b & 0xffu);
+	return max(float(i > 127 ? i - 256 : i) / 127.0, -1.0);
+}
+
+// Octahedral normal from the two snorm8 in w
+vec3 decode_normal(uint w)
+{
+	vec2 f = vec2(snorm8(w), snorm8(w >> 8u));
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = max(-n.z, 0.0);
+	n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+	return normalize(n);
+}
+
+void main()
+{
+	vec4 position = vec4(position_offset + position_scale * vec3(vertex_position.xyz) / 65535.0, 1.0);
+	vec4 vertex_normal = vec4(decode_normal(vertex_position.w), 0.0);
+// Transform vertex into clipping coordinates
+	gl_Position = projection * view * model * position;
+// Lighting in camera coordinates
+//  Compute light direction and transform to camera coordinates
+        light_direction = view * (light_position - position);
+//  Transform normal to camera coordinates
+        normal = view * vertex_normal;
+        world_normal = vertex_normal;
+        world_position = projection * view * position;
+        vec4 scene = model * position;
+        scene_position = vec3(scene);
+        scene_normal = mat3(model) * vec3(vertex_normal);
+        view_depth = -(view * scene).z;
+        uv = uv_transform.xy + uv_transform.zw * vertex_uv;
+}
+)zzz"
@@ -0,0 +1,18 @@
+R"zzz(#version 330 core
+
+// picker.vert for meshes in the PackedMesh format (see packed_mesh.h)
+in uvec4 vertex_position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+void main(){
+
+    vec3 position = position_offset + position_scale * vec3(vertex_position.xyz) / 65535.0;
+    gl_Position =  projection * view * model * vec4(position, 1.0);
+
+}
+)zzz"
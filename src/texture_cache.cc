@@ -0,0 +1,471 @@
+#include "texture_cache.h"
+#include "filesystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    // DDS_HEADER, after the "DDS " magic.
+    struct DdsPixelFormat {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t four_cc;
+        uint32_t rgb_bit_count;
+        uint32_t r_mask, g_mask, b_mask, a_mask;
+    };
+
+    struct DdsHeader {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitch_or_linear_size;
+        uint32_t depth;
+        uint32_t mip_map_count;
+        uint32_t reserved1[11];
+        DdsPixelFormat format;
+        uint32_t caps, caps2, caps3, caps4;
+        uint32_t reserved2;
+    };
+
+    // Stored in reserved1 of cooked files.
+    struct Stamp {
+        char tag[4];
+        uint32_t version;
+        uint64_t source_size;
+        int64_t source_mtime;
+        uint64_t source_hash;
+        uint64_t settings;
+    };
+
+    static_assert(sizeof(DdsHeader) == 124, "DDS_HEADER is 124 bytes");
+    static_assert(sizeof(Stamp) <= sizeof(DdsHeader::reserved1), "stamp must fit the reserved words");
+
+    const char kMagic[4] = { 'D', 'D', 'S', ' ' };
+    const char kTag[4] = { 'L', 'E', 'N', 'S' };
+    const uint32_t kVersion = 1;
+    // Change whenever the encoder or mip filter changes.
+    const char kSettings[] = "bc1/bc3 pca + least squares, box filtered mips";
+
+    const uint32_t kCaps = 0x1, kHeight = 0x2, kWidth = 0x4, kPixelFormat = 0x1000;
+    const uint32_t kMipMapCount = 0x20000, kLinearSize = 0x80000;
+    const uint32_t kFourCC = 0x4, kRGB = 0x40;
+    const uint32_t kCapsComplex = 0x8, kCapsTexture = 0x1000, kCapsMipMap = 0x400000;
+
+    uint32_t fourCC(const char* c) {
+        return uint32_t(c[0]) | uint32_t(c[1]) << 8 | uint32_t(c[2]) << 16 | uint32_t(c[3]) << 24;
+    }
+
+    bool endsWith(const std::string& s, const std::string& suffix) {
+        if (s.size() < suffix.size())
+            return false;
+        for (size_t i = 0; i < suffix.size(); i++) {
+            if (tolower(s[s.size() - suffix.size() + i]) != suffix[i])
+                return false;
+        }
+        return true;
+    }
+
+    size_t levelBytes(TextureFormat format, int width, int height) {
+        size_t blocks = size_t(std::max(1, (width + 3) / 4)) * std::max(1, (height + 3) / 4);
+        switch (format) {
+        case kTextureBC1: return blocks * 8;
+        case kTextureBC2:
+        case kTextureBC3: return blocks * 16;
+        default: return size_t(width) * height * 4;
+        }
+    }
+
+    bool stampMatches(const Stamp& stamp, const std::string& source) {
+        if (memcmp(stamp.tag, kTag, sizeof(kTag)) != 0 || stamp.version != kVersion ||
+            stamp.settings != textureCookSettings())
+            return false;
+        uint64_t size;
+        int64_t mtime;
+        if (!stat_file(source, size, mtime) || size != stamp.source_size)
+            return false;
+        if (mtime != stamp.source_mtime) {
+            uint64_t hash;
+            if (!hash_file(source, hash) || hash != stamp.source_hash)
+                return false;
+        }
+        return true;
+    }
+
+    // source: if given, the file must be a cooked texture of it.
+    bool readDds(const std::string& file, const std::string* source, CookedTexture& out) {
+        std::vector<char> data;
+        if (!read_file(file, data) || data.size() < sizeof(kMagic) + sizeof(DdsHeader))
+            return false;
+        if (memcmp(data.data(), kMagic, sizeof(kMagic)) != 0)
+            return false;
+        DdsHeader header;
+        memcpy(&header, data.data() + sizeof(kMagic), sizeof(header));
+        if (header.size != sizeof(DdsHeader) || header.depth > 1 || header.caps2 != 0)
+            return false;
+        if (source) {
+            Stamp stamp;
+            memcpy(&stamp, header.reserved1, sizeof(stamp));
+            if (!stampMatches(stamp, *source))
+                return false;
+        }
+
+        CookedTexture texture;
+        const DdsPixelFormat& pf = header.format;
+        if (pf.flags & kFourCC) {
+            if (pf.four_cc == fourCC("DXT1"))
+                texture.format = kTextureBC1;
+            else if (pf.four_cc == fourCC("DXT3"))
+                texture.format = kTextureBC2;
+            else if (pf.four_cc == fourCC("DXT5"))
+                texture.format = kTextureBC3;
+            else
+                return false;
+        } else if ((pf.flags & kRGB) && pf.rgb_bit_count == 32 && pf.g_mask == 0xff00) {
+            if (pf.r_mask == 0xff0000 && pf.b_mask == 0xff)
+                texture.format = kTextureBGRA8;
+            else if (pf.r_mask == 0xff && pf.b_mask == 0xff0000)
+                texture.format = kTextureRGBA8;
+            else
+                return false;
+        } else {
+            return false;
+        }
+
+        uint32_t levels = (header.flags & kMipMapCount) ? std::max(1u, header.mip_map_count) : 1;
+        const char* cursor = data.data() + sizeof(kMagic) + sizeof(header);
+        const char* end = data.data() + data.size();
+        int width = int(header.width), height = int(header.height);
+        for (uint32_t i = 0; i < levels && width > 0 && height > 0; i++) {
+            size_t bytes = levelBytes(texture.format, width, height);
+            if (size_t(end - cursor) < bytes)
+                return false;
+            TextureLevel level;
+            level.width = width;
+            level.height = height;
+            level.data.assign(cursor, cursor + bytes);
+            texture.levels.push_back(std::move(level));
+            cursor += bytes;
+            if (width == 1 && height == 1)
+                break;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        if (texture.levels.empty())
+            return false;
+        out = std::move(texture);
+        return true;
+    }
+
+    // Half size, averaging 2x2 RGBA pixels (clamped at odd edges).
+    std::vector<unsigned char> downsample(const std::vector<unsigned char>& rgba, int width, int height) {
+        int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        std::vector<unsigned char> out(size_t(w) * h * 4);
+        for (int y = 0; y < h; y++) {
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < w; x++) {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                for (int c = 0; c < 4; c++) {
+                    int sum = rgba[(size_t(y0) * width + x0) * 4 + c] + rgba[(size_t(y0) * width + x1) * 4 + c] +
+                        rgba[(size_t(y1) * width + x0) * 4 + c] + rgba[(size_t(y1) * width + x1) * 4 + c];
+                    out[(size_t(y) * w + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        return out;
+    }
+
+    uint16_t to565(const float* c) {
+        int r = std::min(31, std::max(0, int(c[0] * 31.0f / 255.0f + 0.5f)));
+        int g = std::min(63, std::max(0, int(c[1] * 63.0f / 255.0f + 0.5f)));
+        int b = std::min(31, std::max(0, int(c[2] * 31.0f / 255.0f + 0.5f)));
+        return uint16_t(r << 11 | g << 5 | b);
+    }
+
+    void from565(uint16_t c, int* rgb) {
+        rgb[0] = ((c >> 11) & 31) * 255 / 31;
+        rgb[1] = ((c >> 5) & 63) * 255 / 63;
+        rgb[2] = (c & 31) * 255 / 31;
+    }
+
+    // Best 4-color mode indices of block for e0 > e1, error gets the
+    // squared error.
+    uint32_t fitIndices(const unsigned char* block, uint16_t e0, uint16_t e1, int& error) {
+        int palette[4][3];
+        from565(e0, palette[0]);
+        from565(e1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        uint32_t indices = 0;
+        error = 0;
+        for (int i = 0; i < 16; i++) {
+            int best = 0, best_error = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+                int e = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = block[i * 4 + c] - palette[p][c];
+                    e += d * d;
+                }
+                if (e < best_error) {
+                    best_error = e;
+                    best = p;
+                }
+            }
+            indices |= uint32_t(best) << (2 * i);
+            error += best_error;
+        }
+        return indices;
+    }
+
+    void orderEndpoints(const float* c0, const float* c1, uint16_t& e0, uint16_t& e1) {
+        e0 = to565(c0);
+        e1 = to565(c1);
+        if (e0 < e1)
+            std::swap(e0, e1);
+    }
+
+    // BC1 color block of 16 RGBA pixels, always in 4-color mode: endpoints
+    // at the extremes of the block's principal axis, then refined once by
+    // least squares for the chosen indices.
+    void encodeColorBlock(const unsigned char* block, unsigned char* out) {
+        float mean[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++)
+                mean[c] += block[i * 4 + c] / 16.0f;
+        }
+        float cov[6] = { 0, 0, 0, 0, 0, 0 };
+        for (int i = 0; i < 16; i++) {
+            float d[3] = { block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2] };
+            cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+        }
+        // Power iteration, starting from the luminance direction.
+        float axis[3] = { 0.3f, 0.59f, 0.11f };
+        for (int it = 0; it < 8; it++) {
+            float v[3] = {
+                cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+            };
+            float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            if (len < 1e-6f)
+                break;
+            for (int c = 0; c < 3; c++)
+                axis[c] = v[c] / len;
+        }
+        float lo = 1e9f, hi = -1e9f;
+        for (int i = 0; i < 16; i++) {
+            float t = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] +
+                (block[i * 4 + 2] - mean[2]) * axis[2];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+        float c0[3], c1[3];
+        for (int c = 0; c < 3; c++) {
+            c0[c] = mean[c] + axis[c] * hi;
+            c1[c] = mean[c] + axis[c] * lo;
+        }
+        uint16_t e0, e1;
+        orderEndpoints(c0, c1, e0, e1);
+
+        uint32_t indices = 0;
+        if (e0 != e1) {
+            int error;
+            indices = fitIndices(block, e0, e1, error);
+
+            // Solve for the endpoints that best reproduce the block with
+            // these indices: x_i = w_i * c0 + (1 - w_i) * c1.
+            const float weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+            float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+            for (int i = 0; i < 16; i++) {
+                float w = weight[(indices >> (2 * i)) & 3];
+                aa += w * w;
+                ab += w * (1 - w);
+                bb += (1 - w) * (1 - w);
+                for (int c = 0; c < 3; c++) {
+                    ax[c] += w * block[i * 4 + c];
+                    bx[c] += (1 - w) * block[i * 4 + c];
+                }
+            }
+            float det = aa * bb - ab * ab;
+            if (std::fabs(det) > 1e-6f) {
+                for (int c = 0; c < 3; c++) {
+                    c0[c] = (ax[c] * bb - bx[c] * ab) / det;
+                    c1[c] = (bx[c] * aa - ax[c] * ab) / det;
+                }
+                uint16_t r0, r1;
+                orderEndpoints(c0, c1, r0, r1);
+                int refined_error;
+                if (r0 != r1) {
+                    uint32_t refined = fitIndices(block, r0, r1, refined_error);
+                    if (refined_error < error) {
+                        e0 = r0;
+                        e1 = r1;
+                        indices = refined;
+                    }
+                }
+            }
+        }
+        out[0] = e0 & 0xff; out[1] = e0 >> 8;
+        out[2] = e1 & 0xff; out[3] = e1 >> 8;
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (indices >> (8 * i)) & 0xff;
+    }
+
+    // BC3 alpha block: 8 interpolated alphas between the block min and max.
+    void encodeAlphaBlock(const unsigned char* block, unsigned char* out) {
+        int a0 = 0, a1 = 255;
+        for (int i = 0; i < 16; i++) {
+            a0 = std::max(a0, int(block[i * 4 + 3]));
+            a1 = std::min(a1, int(block[i * 4 + 3]));
+        }
+        uint64_t indices = 0;
+        if (a0 != a1) {
+            int palette[8] = { a0, a1 };
+            for (int p = 1; p < 7; p++)
+                palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+            for (int i = 0; i < 16; i++) {
+                int best = 0;
+                for (int p = 1; p < 8; p++) {
+                    if (std::abs(block[i * 4 + 3] - palette[p]) < std::abs(block[i * 4 + 3] - palette[best]))
+                        best = p;
+                }
+                indices |= uint64_t(best) << (3 * i);
+            }
+        }
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (indices >> (8 * i)) & 0xff;
+    }
+
+    TextureLevel compressLevel(const std::vector<unsigned char>& rgba, int width, int height, TextureFormat format) {
+        TextureLevel level;
+        level.width = width;
+        level.height = height;
+        level.data.resize(levelBytes(format, width, height));
+        unsigned char* out = level.data.data();
+        unsigned char block[16 * 4];
+        for (int by = 0; by < height; by += 4) {
+            for (int bx = 0; bx < width; bx += 4) {
+                // Edge blocks repeat the last row and column.
+                for (int y = 0; y < 4; y++) {
+                    for (int x = 0; x < 4; x++) {
+                        int sx = std::min(bx + x, width - 1), sy = std::min(by + y, height - 1);
+                        memcpy(block + (y * 4 + x) * 4, &rgba[(size_t(sy) * width + sx) * 4], 4);
+                    }
+                }
+                if (format == kTextureBC3) {
+                    encodeAlphaBlock(block, out);
+                    out += 8;
+                }
+                encodeColorBlock(block, out);
+                out += 8;
+            }
+        }
+        return level;
+    }
+};
+
+uint64_t textureCookSettings() {
+    return content_hash(kSettings, sizeof(kSettings) - 1);
+}
+
+size_t CookedTexture::bytes() const {
+    size_t bytes = 0;
+    for (const TextureLevel& level : levels)
+        bytes += level.data.size();
+    return bytes;
+}
+
+std::string cookedTexturePath(const std::string& source) {
+    return source + ".cooked.dds";
+}
+
+bool readTexture(const std::string& file, CookedTexture& out) {
+    if (endsWith(file, ".dds"))
+        return readDds(file, nullptr, out);
+    return readDds(cookedTexturePath(file), &file, out);
+}
+
+bool compressTexture(const unsigned char* pixels, int width, int height, int channels, CookedTexture& out) {
+    if (!pixels || width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4))
+        return false;
+
+    // Expand to RGBA the way GL would read it: one channel is red only.
+    std::vector<unsigned char> rgba(size_t(width) * height * 4);
+    bool alpha = false;
+    for (size_t i = 0; i < size_t(width) * height; i++) {
+        const unsigned char* p = pixels + i * channels;
+        unsigned char* q = &rgba[i * 4];
+        q[0] = p[0];
+        q[1] = channels >= 3 ? p[1] : 0;
+        q[2] = channels >= 3 ? p[2] : 0;
+        q[3] = channels == 4 ? p[3] : 255;
+        alpha = alpha || q[3] != 255;
+    }
+
+    CookedTexture texture;
+    texture.format = alpha ? kTextureBC3 : kTextureBC1;
+    for (;;) {
+        texture.levels.push_back(compressLevel(rgba, width, height, texture.format));
+        if (width == 1 && height == 1)
+            break;
+        rgba = downsample(rgba, width, height);
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    out = std::move(texture);
+    return true;
+}
+
+bool writeCookedTexture(const std::string& source, const CookedTexture& texture) {
+    if (texture.levels.empty() || !texture.compressed())
+        return false;
+    Stamp stamp;
+    memcpy(stamp.tag, kTag, sizeof(kTag));
+    stamp.version = kVersion;
+    stamp.settings = textureCookSettings();
+    if (!stat_file(source, stamp.source_size, stamp.source_mtime) ||
+        !hash_file(source, stamp.source_hash))
+        return false;
+
+    DdsHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(DdsHeader);
+    header.flags = kCaps | kHeight | kWidth | kPixelFormat | kMipMapCount | kLinearSize;
+    header.width = uint32_t(texture.levels[0].width);
+    header.height = uint32_t(texture.levels[0].height);
+    header.pitch_or_linear_size = uint32_t(texture.levels[0].data.size());
+    header.mip_map_count = uint32_t(texture.levels.size());
+    memcpy(header.reserved1, &stamp, sizeof(stamp));
+    header.format.size = sizeof(DdsPixelFormat);
+    header.format.flags = kFourCC;
+    header.format.four_cc = fourCC(texture.format == kTextureBC1 ? "DXT1" : texture.format == kTextureBC2 ? "DXT3" : "DXT5");
+    header.caps = kCapsTexture | kCapsComplex | kCapsMipMap;
+
+    // Same temporary file and rename as the mesh cache.
+    std::string file = cookedTexturePath(source);
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(kMagic, sizeof(kMagic));
+        out.write((const char*)&header, sizeof(header));
+        for (const TextureLevel& level : texture.levels)
+            out.write((const char*)level.data.data(), level.data.size());
+        if (!out)
+            return false;
+    }
+    remove(file.c_str());
+    if (rename(tmp.c_str(), file.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
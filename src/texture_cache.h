@@ -0,0 +1,65 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * GPU-ready textures: block-compressed mip chains in a DDS container, so
+ * loading is a file read and one glCompressedTexImage2D per level instead
+ * of an image decode, an uncompressed upload and glGenerateMipmap.
+ *
+ * Images are cooked to <source>.cooked.dds by ./bin/lens_cook, or the
+ * first time they are loaded if that hasn't been run. Opaque images
+ * become BC1 (4 bits per pixel), images with alpha BC3 (8 bits per pixel).
+ * The cooked file stamps the source size, mtime and hash and the encoder
+ * settings into the DDS reserved words and is rebuilt when they no longer
+ * match, the same way as the mesh cache.
+ */
+
+enum TextureFormat {
+    kTextureBC1,    // DXT1
+    kTextureBC2,    // DXT3, only read
+    kTextureBC3,    // DXT5
+    kTextureBGRA8,  // uncompressed, only read
+    kTextureRGBA8,  // uncompressed, only read
+};
+
+struct TextureLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> data;
+};
+
+struct CookedTexture {
+    TextureFormat format = kTextureBC1;
+    // Largest first. A single level of an uncompressed format still needs
+    // mipmaps generated.
+    std::vector<TextureLevel> levels;
+
+    bool compressed() const { return format <= kTextureBC3; }
+    size_t bytes() const;
+};
+
+std::string cookedTexturePath(const std::string& source);
+// Identifies the encoder, see mesh_optimizer.h's meshProcessingSettings().
+uint64_t textureCookSettings();
+
+/*
+ * readTexture: read a .dds file directly, or the valid cooked texture of
+ * any other image.
+ *      return: false if there is none, out is left untouched
+ */
+bool readTexture(const std::string& file, CookedTexture& out);
+
+/*
+ * compressTexture: build the mip chain of 8 bit pixels with 1, 3 or 4
+ * channels (as loadImg returns them) and block-compress every level.
+ */
+bool compressTexture(const unsigned char* pixels, int width, int height, int channels, CookedTexture& out);
+
+// writeCookedTexture: save texture as the cooked version of source.
+bool writeCookedTexture(const std::string& source, const CookedTexture& texture);
+
+#endif
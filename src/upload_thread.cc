@@ -0,0 +1,95 @@
+#include "upload_thread.h"
+
+#include <cstdio>
+
+UploadThread::UploadThread(GLFWwindow* share) {
+    // The window hints of share still apply, just never show it.
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    context_ = glfwCreateWindow(1, 1, "upload", nullptr, share);
+    glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+    if (!context_) {
+        printf("UploadThread: no shared context, uploading on the render thread\n");
+        return;
+    }
+    thread_ = std::thread(&UploadThread::run, this);
+}
+
+UploadThread::~UploadThread() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+    for (Finished& f : finished_)
+        glDeleteSync(f.fence);
+    if (context_)
+        glfwDestroyWindow(context_);
+}
+
+void UploadThread::push(Job work, Job done) {
+    if (!context_) {
+        work();
+        if (done)
+            done();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.emplace_back(std::move(work), std::move(done));
+        pending_++;
+    }
+    wake_.notify_one();
+}
+
+size_t UploadThread::poll() {
+    size_t count = 0;
+    for (;;) {
+        Finished f;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_.empty())
+                break;
+            GLenum status = glClientWaitSync(finished_.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            f = std::move(finished_.front());
+            finished_.pop_front();
+            pending_--;
+        }
+        glDeleteSync(f.fence);
+        if (f.done)
+            f.done();
+        count++;
+    }
+    return count;
+}
+
+size_t UploadThread::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_;
+}
+
+void UploadThread::run() {
+    glfwMakeContextCurrent(context_);
+    for (;;) {
+        std::pair<Job, Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this]() { return quit_ || !queue_.empty(); });
+            if (quit_)
+                break;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        job.first();
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // Make sure the fence reaches the GPU, or the render thread could
+        // poll it forever.
+        glFlush();
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_.push_back({ fence, std::move(job.second) });
+    }
+    glfwMakeContextCurrent(nullptr);
+}
@@ -0,0 +1,64 @@
+#ifndef UPLOAD_THREAD_H
+#define UPLOAD_THREAD_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+/*
+ * UploadThread: a loader thread with its own hidden GLFW context that
+ * shares objects with the render window, so buffers and textures can be
+ * created without stalling a frame.
+ *
+ * Each job's work runs on the loader thread with the upload context
+ * current. A fence is inserted after it, and its done callback runs on the
+ * render thread from poll() once the GPU has passed that fence, so the
+ * render thread never sees a half-uploaded object. Only buffers, textures
+ * and syncs are shared between contexts: VAOs must still be created on
+ * the render thread, in done or later.
+ *
+ * Must be constructed and destroyed on the thread that created share.
+ */
+class UploadThread {
+public:
+    typedef std::function<void()> Job;
+
+    explicit UploadThread(GLFWwindow* share);
+    ~UploadThread();
+    UploadThread(const UploadThread&) = delete;
+    UploadThread& operator=(const UploadThread&) = delete;
+
+    // Queue work for the loader thread; done (may be empty) follows on the
+    // render thread. Jobs run in the order they are pushed.
+    void push(Job work, Job done = Job());
+
+    // Render thread, once per frame: run done for every job whose fence
+    // has signaled. Never waits. Returns how many finished.
+    size_t poll();
+    // Jobs pushed but not yet finished by poll().
+    size_t pending() const;
+
+private:
+    struct Finished {
+        GLsync fence;
+        Job done;
+    };
+
+    void run();
+
+    GLFWwindow* context_;
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::pair<Job, Job>> queue_;
+    std::deque<Finished> finished_;
+    size_t pending_ = 0;
+    bool quit_ = false;
+};
+
+#endif